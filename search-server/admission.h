@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <iostream>
+
+// Requests of a higher priority are run first by RequestQueue and wait only behind each other
+enum class RequestPriority
+{
+    HIGH,
+    NORMAL,
+    LOW,
+};
+
+const size_t REQUEST_PRIORITY_COUNT = 3;
+
+// What admission control did with a request
+enum class AdmissionDecision
+{
+    ACCEPTED,       // run in full
+    DEGRADED,       // run as a bounded search for fewer documents that stops at the latency target
+    REJECTED,       // not run: its queue was full or it could not have started within the latency target
+};
+
+std::ostream& operator<<(std::ostream& os, AdmissionDecision decision);
\ No newline at end of file
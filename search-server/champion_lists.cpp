@@ -0,0 +1,51 @@
+#include "champion_lists.h"
+#include "memory_stats.h"
+
+#include <algorithm>
+
+ChampionLists::ChampionLists(size_t list_size, double min_document_share)
+    : list_size_(std::max<size_t>(list_size, 1)),
+    min_document_share_(min_document_share) {}
+
+void ChampionLists::AddPosting(int term_id, uint32_t ordinal, double term_freq)
+{
+    const auto it = lists_.find(term_id);
+    if (it == lists_.end() || term_freq <= it->second.max_other_term_freq)
+        return;
+    // new documents get the highest ordinal, so the list stays sorted
+    it->second.postings.push_back(ChampionPosting{ ordinal, term_freq });
+    it->second.max_term_freq = std::max(it->second.max_term_freq, term_freq);
+}
+
+size_t ChampionLists::GetMemoryUsage() const
+{
+    size_t result = HeapBytes(lists_);
+    for (const auto& [term_id, list] : lists_)
+        result += HeapBytes(list.postings);
+    return result;
+}
+
+const ChampionList* ChampionLists::Find(int term_id) const
+{
+    const auto it = lists_.find(term_id);
+    return it == lists_.end() ? nullptr : &it->second;
+}
+
+ChampionList ChampionLists::BuildList(std::vector<ChampionPosting> postings) const
+{
+    ChampionList list;
+    if (postings.size() > list_size_)
+    {
+        const auto by_freq = [](const ChampionPosting& lhs, const ChampionPosting& rhs) { return lhs.term_freq > rhs.term_freq; };
+        std::nth_element(postings.begin(), postings.begin() + list_size_, postings.end(), by_freq);
+        list.max_other_term_freq = postings[list_size_].term_freq;
+        postings.resize(list_size_);
+        postings.shrink_to_fit();   // the copy was as long as the full list
+    }
+    std::sort(postings.begin(), postings.end(),
+        [](const ChampionPosting& lhs, const ChampionPosting& rhs) { return lhs.ordinal < rhs.ordinal; });
+    for (const ChampionPosting& posting : postings)
+        list.max_term_freq = std::max(list.max_term_freq, posting.term_freq);
+    list.postings = std::move(postings);
+    return list;
+}
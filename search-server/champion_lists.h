@@ -0,0 +1,98 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "segmented_index.h"
+
+struct ChampionPosting
+{
+    uint32_t ordinal;
+    double term_freq;
+};
+
+// Documents where a frequent term has its highest frequencies
+struct ChampionList
+{
+    std::vector<ChampionPosting> postings;  // ordinals ascending
+    double max_term_freq = 0;               // highest frequency in the list
+    double max_other_term_freq = 0;         // no document outside the list has a higher frequency
+    size_t document_freq = 0;               // when the list was built
+};
+
+struct TieredTermStats
+{
+    std::string_view word;
+    size_t document_freq = 0;           // when its list was built
+    size_t champion_count = 0;
+    double max_other_term_freq = 0;
+};
+
+struct ChampionStats
+{
+    std::vector<TieredTermStats> terms;     // most frequent first
+    size_t champion_postings = 0;
+    size_t built_for_documents = 0;
+    size_t answered_queries = 0;            // top documents proven from the champion tier
+    size_t fallback_queries = 0;            // tier tried, full lists needed
+};
+
+// Tier of short posting lists for terms found in a large share of the documents.
+// A query can be answered from the champion lists and the full lists of the other
+// terms whenever max_other_term_freq proves no other document reaches the top.
+class ChampionLists
+{
+public:
+    ChampionLists(size_t list_size, double min_document_share);
+
+    // Picks the terms with at least min_document_share of document_count live documents
+    // and keeps the list_size postings with the highest frequency for each of them
+    template <typename IsLive>
+    void Build(const IndexSnapshot& snapshot, const std::vector<int>& document_freqs, size_t document_count, IsLive is_live);
+
+    // Keeps the lists exact for a newly indexed document
+    void AddPosting(int term_id, uint32_t ordinal, double term_freq);
+
+    void Clear() { lists_.clear(); }
+
+    // nullptr unless term_id is tiered
+    const ChampionList* Find(int term_id) const;
+
+    const std::unordered_map<int, ChampionList>& GetLists() const { return lists_; }
+
+    bool IsEmpty() const { return lists_.empty(); }
+
+    // Heap bytes of the lists
+    size_t GetMemoryUsage() const;
+
+private:
+    size_t list_size_;
+    double min_document_share_;
+    std::unordered_map<int, ChampionList> lists_;
+
+    ChampionList BuildList(std::vector<ChampionPosting> postings) const;
+};
+
+template <typename IsLive>
+void ChampionLists::Build(const IndexSnapshot& snapshot, const std::vector<int>& document_freqs, size_t document_count, IsLive is_live)
+{
+    lists_.clear();
+    const double min_document_freq = std::max<double>(4 * list_size_, min_document_share_ * document_count);
+    std::vector<ChampionPosting> postings;
+    for (size_t term_id = 0; term_id < document_freqs.size(); ++term_id)
+    {
+        if (document_freqs[term_id] < min_document_freq)
+            continue;
+        postings.clear();
+        snapshot.ForEachPosting(static_cast<int>(term_id), [&](uint32_t ordinal, double term_freq)
+            {
+                if (is_live(ordinal))
+                    postings.push_back(ChampionPosting{ ordinal, term_freq });
+            });
+        ChampionList list = BuildList(postings);
+        list.document_freq = document_freqs[term_id];
+        lists_.emplace(static_cast<int>(term_id), std::move(list));
+    }
+}
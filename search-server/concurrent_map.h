@@ -1,68 +1,324 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <execution>
+#include <functional>
+#include <future>
 #include <map>
 #include <mutex>
-#include <vector>
+#include <numeric>
+#include <optional>
+#include <thread>
 #include <type_traits>
-#include <future>
+#include <utility>
+#include <vector>
 
 using namespace std::string_literals;
 
-template <typename Key, typename Value>
-class ConcurrentMap {
+// Test-and-test-and-set lock for critical sections of a few dozen instructions
+class SpinLock
+{
 public:
-    static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys"s);
+    void lock()
+    {
+        for (int spins = 0; flag_.exchange(true, std::memory_order_acquire); ++spins)
+        {
+            while (flag_.load(std::memory_order_relaxed))
+            {
+                // the holder may be descheduled, so stop burning its time slice after a while
+                if (++spins > 64)
+                    std::this_thread::yield();
+            }
+        }
+    }
 
-    struct Bucket
+    bool try_lock() { return !flag_.load(std::memory_order_relaxed) && !flag_.exchange(true, std::memory_order_acquire); }
+
+    void unlock() { flag_.store(false, std::memory_order_release); }
+
+private:
+    std::atomic<bool> flag_{ false };
+};
+
+// Hash map for concurrent updates: keys are spread over shards, each an open addressing
+// table with linear probing behind its own spin lock. Shards are aligned to cache lines
+// so that threads working on different shards do not share lines.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class ConcurrentMap {
+private:
+    struct Slot
+    {
+        size_t hash = 0;
+        std::optional<std::pair<Key, Value>> entry;
+    };
+
+    struct alignas(64) Shard
     {
-        std::map<Key, Value> map;
-        std::mutex mutex;
+        mutable SpinLock lock;
+        std::vector<Slot> slots;    // size is zero or a power of two
+        size_t size = 0;
     };
 
+public:
+    // Keeps the shard locked while the value is in use
     struct Access
     {
-        std::lock_guard<std::mutex> lg;
+        std::lock_guard<SpinLock> lg;
         Value& ref_to_value;
 
-        explicit Access(Bucket& b, const Key& k)
-            : lg(b.mutex),
-            ref_to_value(b.map[k]) {}
+        Access(ConcurrentMap& map, Shard& shard, size_t hash, const Key& key)
+            : lg(shard.lock),
+            ref_to_value(map.FindOrInsert(shard, hash, key)) {}
     };
 
-    explicit ConcurrentMap(size_t bucket_count)
-        : buckets_(bucket_count) {}
+    explicit ConcurrentMap(size_t shard_count, Hash hash = Hash(), KeyEqual key_equal = KeyEqual())
+        : shards_(std::max<size_t>(shard_count, 1)),
+        hash_(std::move(hash)),
+        key_equal_(std::move(key_equal)) {}
 
     Access operator[](const Key& key)
     {
-        size_t submap_number = size_t(key) % buckets_.size();
-        return Access{ buckets_[submap_number], key };
+        const size_t hash = Mix(hash_(key));
+        return Access{ *this, GetShard(hash), hash, key };
     }
 
-    std::map<Key, Value> BuildOrdinaryMap()
+    std::optional<Value> Find(const Key& key) const
+    {
+        const size_t hash = Mix(hash_(key));
+        const Shard& shard = GetShard(hash);
+        std::lock_guard lg(shard.lock);
+        const size_t index = FindIndex(shard, hash, key);
+        if (index == NOT_FOUND)
+            return std::nullopt;
+        return shard.slots[index].entry->second;
+    }
+
+    bool Erase(const Key& key)
+    {
+        const size_t hash = Mix(hash_(key));
+        Shard& shard = GetShard(hash);
+        std::lock_guard lg(shard.lock);
+        const size_t index = FindIndex(shard, hash, key);
+        if (index == NOT_FOUND)
+            return false;
+        EraseAt(shard, index);
+        return true;
+    }
+
+    size_t Size() const
+    {
+        size_t result = 0;
+        for (const Shard& shard : shards_)
+        {
+            std::lock_guard lg(shard.lock);
+            result += shard.size;
+        }
+        return result;
+    }
+
+    // Copies every entry into one vector, shards in parallel with policy; the order is unspecified
+    template <typename ExecutionPolicy>
+    std::vector<std::pair<Key, Value>> Snapshot(ExecutionPolicy&& policy) const
+    {
+        return Collect(policy, shards_);
+    }
+
+    // Moves every entry into one vector and leaves the map empty
+    template <typename ExecutionPolicy>
+    std::vector<std::pair<Key, Value>> Extract(ExecutionPolicy&& policy)
+    {
+        return Collect(policy, shards_);
+    }
+
+    // Adds every entry to target; values of keys present in both become combine(target value, value).
+    // No lock of this map is held while target is locked.
+    template <typename Combine = std::plus<>>
+    void MergeInto(ConcurrentMap& target, Combine combine = Combine()) const
+    {
+        target.MergeFrom(Snapshot(std::execution::seq), combine);
+    }
+
+    // Same for a std::map or std::unordered_map
+    template <typename Map, typename Combine = std::plus<>>
+    void MergeInto(Map& target, Combine combine = Combine()) const
     {
-        std::map<Key, Value> result;
-        for (auto& bucket : buckets_)
+        for (const Shard& shard : shards_)
         {
-            std::lock_guard lg(bucket.mutex);
-            for (const auto& [k, v] : bucket.map)
+            std::lock_guard lg(shard.lock);
+            for (const Slot& slot : shard.slots)
             {
-                result[k] = v;
+                if (!slot.entry)
+                    continue;
+                const auto [it, inserted] = target.try_emplace(slot.entry->first, slot.entry->second);
+                if (!inserted)
+                    it->second = combine(it->second, slot.entry->second);
             }
         }
-        return result;
     }
 
-    size_t Size() const
+    // Upserts a batch of entries, locking every shard once
+    template <typename Combine = std::plus<>>
+    void MergeFrom(const std::vector<std::pair<Key, Value>>& entries, Combine combine = Combine())
     {
-        size_t result = 0;
-        for (const Bucket& b : buckets_)
+        std::vector<std::vector<std::pair<size_t, const std::pair<Key, Value>*>>> by_shard(shards_.size());
+        for (const auto& entry : entries)
         {
-            result += b.map.size();
+            const size_t hash = Mix(hash_(entry.first));
+            by_shard[ShardIndex(hash)].emplace_back(hash, &entry);
         }
-        return result;
+        for (size_t i = 0; i < shards_.size(); ++i)
+        {
+            if (by_shard[i].empty())
+                continue;
+            std::lock_guard lg(shards_[i].lock);
+            for (const auto& [hash, entry] : by_shard[i])
+            {
+                Value& value = FindOrInsert(shards_[i], hash, entry->first);
+                value = combine(value, entry->second);
+            }
+        }
+    }
+
+    std::map<Key, Value> BuildOrdinaryMap()
+    {
+        std::vector<std::pair<Key, Value>> entries = Snapshot(std::execution::par);
+        std::sort(std::execution::par, entries.begin(), entries.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+        return std::map<Key, Value>(std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
     }
 
 private:
-    std::vector<Bucket> buckets_;
+    static constexpr size_t NOT_FOUND = static_cast<size_t>(-1);
+    static constexpr size_t MIN_SLOTS = 16;
+
+    std::vector<Shard> shards_;
+    Hash hash_;
+    KeyEqual key_equal_;
+
+    // std::hash of integers is the identity; spreads the bits over the whole word
+    static size_t Mix(size_t hash)
+    {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    // high bits choose the shard, low bits the slot
+    size_t ShardIndex(size_t hash) const { return (hash >> 40) % shards_.size(); }
+    Shard& GetShard(size_t hash) { return shards_[ShardIndex(hash)]; }
+    const Shard& GetShard(size_t hash) const { return shards_[ShardIndex(hash)]; }
+
+    size_t FindIndex(const Shard& shard, size_t hash, const Key& key) const
+    {
+        if (shard.slots.empty())
+            return NOT_FOUND;
+        const size_t mask = shard.slots.size() - 1;
+        for (size_t index = hash & mask;; index = (index + 1) & mask)
+        {
+            const Slot& slot = shard.slots[index];
+            if (!slot.entry)
+                return NOT_FOUND;
+            if (slot.hash == hash && key_equal_(slot.entry->first, key))
+                return index;
+        }
+    }
+
+    Value& FindOrInsert(Shard& shard, size_t hash, const Key& key)
+    {
+        const size_t index = FindIndex(shard, hash, key);
+        if (index != NOT_FOUND)
+            return shard.slots[index].entry->second;
+
+        // load factor stays at most 3/4
+        if ((shard.size + 1) * 4 > shard.slots.size() * 3)
+            Grow(shard);
+        Slot& slot = shard.slots[FreeIndex(shard, hash)];
+        slot.hash = hash;
+        slot.entry.emplace(key, Value());
+        ++shard.size;
+        return slot.entry->second;
+    }
+
+    static size_t FreeIndex(const Shard& shard, size_t hash)
+    {
+        const size_t mask = shard.slots.size() - 1;
+        size_t index = hash & mask;
+        while (shard.slots[index].entry)
+            index = (index + 1) & mask;
+        return index;
+    }
+
+    static void Grow(Shard& shard)
+    {
+        std::vector<Slot> old_slots(std::max(MIN_SLOTS, shard.slots.size() * 2));
+        old_slots.swap(shard.slots);
+        for (Slot& slot : old_slots)
+        {
+            if (slot.entry)
+                shard.slots[FreeIndex(shard, slot.hash)] = std::move(slot);
+        }
+    }
+
+    // Backward shift deletion: later entries of the probe run move into the hole
+    static void EraseAt(Shard& shard, size_t hole)
+    {
+        const size_t mask = shard.slots.size() - 1;
+        for (size_t index = (hole + 1) & mask; shard.slots[index].entry; index = (index + 1) & mask)
+        {
+            const size_t home = shard.slots[index].hash & mask;
+            // the entry may fill the hole if its home does not lie in (hole, index]
+            if (((index - home) & mask) >= ((index - hole) & mask))
+            {
+                shard.slots[hole] = std::move(shard.slots[index]);
+                hole = index;
+            }
+        }
+        shard.slots[hole].entry.reset();
+        --shard.size;
+    }
+
+    // Copies the entries of const shards, moves them out of mutable ones and clears those
+    template <typename ExecutionPolicy, typename Shards>
+    static std::vector<std::pair<Key, Value>> Collect(ExecutionPolicy&& policy, Shards& shards)
+    {
+        // shards stay locked from sizing to copying, so the offsets remain valid
+        for (const Shard& shard : shards)
+            shard.lock.lock();
+        std::vector<size_t> offsets(shards.size() + 1, 0);
+        for (size_t i = 0; i < shards.size(); ++i)
+            offsets[i + 1] = offsets[i] + shards[i].size;
+
+        std::vector<std::pair<Key, Value>> result(offsets.back());
+        std::vector<size_t> shard_indexes(shards.size());
+        std::iota(shard_indexes.begin(), shard_indexes.end(), 0);
+        std::for_each(policy, shard_indexes.begin(), shard_indexes.end(),
+            [&](size_t i)
+            {
+                size_t out = offsets[i];
+                for (auto& slot : shards[i].slots)
+                {
+                    if constexpr (std::is_const_v<Shards>)
+                    {
+                        if (slot.entry)
+                            result[out++] = *slot.entry;
+                    }
+                    else
+                    {
+                        if (slot.entry)
+                            result[out++] = std::move(*slot.entry);
+                    }
+                }
+                if constexpr (!std::is_const_v<Shards>)
+                {
+                    shards[i].slots.clear();
+                    shards[i].size = 0;
+                }
+            });
+        for (const Shard& shard : shards)
+            shard.lock.unlock();
+        return result;
+    }
 };
 
 template <typename ExecutionPolicy, typename ForwardRange, typename Function>
@@ -0,0 +1,119 @@
+#include "deletion_index.h"
+#include "memory_stats.h"
+
+#include <algorithm>
+#include <string>
+
+namespace
+{
+    uint64_t HashWord(std::string_view word)
+    {
+        uint64_t hash = 14695981039346656037ull;    // FNV-1a
+        for (const char ch : word)
+        {
+            hash ^= static_cast<unsigned char>(ch);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Deletes characters at positions not before from, so each set of positions is visited once
+    void CollectDeletions(std::string& word, size_t from, int deletions_left, std::vector<uint64_t>& hashes)
+    {
+        if (deletions_left == 0)
+            return;
+        for (size_t pos = from; pos < word.size(); ++pos)
+        {
+            const char removed = word[pos];
+            word.erase(pos, 1);
+            hashes.push_back(HashWord(word));
+            CollectDeletions(word, pos, deletions_left - 1, hashes);
+            word.insert(word.begin() + pos, removed);
+        }
+    }
+}
+
+DeletionIndex::DeletionIndex(int max_distance)
+    : max_distance_(max_distance) {}
+
+size_t DeletionIndex::GetMemoryUsage() const
+{
+    size_t result = HeapBytes(variants_);
+    for (const auto& [hash, term_ids] : variants_)
+        result += HeapBytes(term_ids);
+    return result;
+}
+
+void DeletionIndex::AddTerm(int term_id, std::string_view word)
+{
+    for (const uint64_t hash : ComputeVariantHashes(word))
+    {
+        variants_[hash].push_back(term_id);
+    }
+}
+
+std::vector<std::pair<int, int>> DeletionIndex::Lookup(std::string_view word, const TermDictionary& dictionary) const
+{
+    std::vector<int> candidates;
+    for (const uint64_t hash : ComputeVariantHashes(word))
+    {
+        const auto it = variants_.find(hash);
+        if (it != variants_.end())
+            candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    std::vector<std::pair<int, int>> result;
+    for (const int term_id : candidates)
+    {
+        const int distance = ComputeEditDistance(word, dictionary.GetTerm(term_id), max_distance_);
+        if (distance <= max_distance_)
+            result.push_back({ term_id, distance });
+    }
+    return result;
+}
+
+std::vector<uint64_t> DeletionIndex::ComputeVariantHashes(std::string_view word) const
+{
+    std::vector<uint64_t> hashes{ HashWord(word) };
+    std::string buffer(word);
+    CollectDeletions(buffer, 0, max_distance_, hashes);
+    // repeated letters give the same variant by different deletions
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    return hashes;
+}
+
+int ComputeEditDistance(std::string_view lhs, std::string_view rhs, int max_distance)
+{
+    const int too_far = max_distance + 1;
+    if (static_cast<int>(std::max(lhs.size(), rhs.size()) - std::min(lhs.size(), rhs.size())) > max_distance)
+        return too_far;
+
+    // three rolling rows of the dynamic programming table
+    std::vector<int> before_previous(rhs.size() + 1);
+    std::vector<int> previous(rhs.size() + 1);
+    std::vector<int> current(rhs.size() + 1);
+    for (size_t j = 0; j <= rhs.size(); ++j)
+        previous[j] = static_cast<int>(j);
+
+    for (size_t i = 1; i <= lhs.size(); ++i)
+    {
+        current[0] = static_cast<int>(i);
+        int row_min = current[0];
+        for (size_t j = 1; j <= rhs.size(); ++j)
+        {
+            const int cost = lhs[i - 1] == rhs[j - 1] ? 0 : 1;
+            current[j] = std::min({ previous[j] + 1, current[j - 1] + 1, previous[j - 1] + cost });
+            if (i > 1 && j > 1 && lhs[i - 1] == rhs[j - 2] && lhs[i - 2] == rhs[j - 1])
+                current[j] = std::min(current[j], before_previous[j - 2] + 1);
+            row_min = std::min(row_min, current[j]);
+        }
+        if (row_min > max_distance)
+            return too_far;
+        before_previous.swap(previous);
+        previous.swap(current);
+    }
+    return std::min(previous[rhs.size()], too_far);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "term_dictionary.h"
+
+// SymSpell-style index for typo-tolerant term lookup.
+//
+// Every term is stored under each string obtained by deleting up to
+// max_distance of its characters. Two words within edit distance d share a
+// deletion variant of at most d deletions, so a lookup only has to generate
+// the variants of the query word and verify the few candidates found under
+// them, instead of comparing the word with the whole dictionary.
+class DeletionIndex
+{
+public:
+    explicit DeletionIndex(int max_distance);
+
+    void AddTerm(int term_id, std::string_view word);
+
+    // Terms of dictionary within max_distance edits (insert, delete, substitute,
+    // swap of neighbours) of word, as (term ID, distance) pairs
+    std::vector<std::pair<int, int>> Lookup(std::string_view word, const TermDictionary& dictionary) const;
+
+    int GetMaxDistance() const { return max_distance_; }
+
+    // Heap bytes of the variant table
+    size_t GetMemoryUsage() const;
+
+private:
+    int max_distance_;
+    // variants are keyed by hash; collisions are weeded out by verification
+    std::unordered_map<uint64_t, std::vector<int>> variants_;
+
+    std::vector<uint64_t> ComputeVariantHashes(std::string_view word) const;
+};
+
+// Optimal string alignment distance, or max_distance + 1 if it is larger than max_distance
+int ComputeEditDistance(std::string_view lhs, std::string_view rhs, int max_distance);
@@ -21,4 +21,12 @@ struct Document
     int rating = 0;
 };
 
+// Document predicate of the searches for one status
+struct StatusFilter
+{
+    DocumentStatus status = DocumentStatus::ACTUAL;
+
+    bool operator()(int, DocumentStatus document_status, int) const { return document_status == status; }
+};
+
 std::ostream& operator<<(std::ostream& os, const Document& d);
\ No newline at end of file
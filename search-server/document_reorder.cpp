@@ -0,0 +1,170 @@
+#include "document_reorder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace std::string_literals;
+
+namespace
+{
+    const size_t MIN_PARTITION_SIZE = 16;
+    const int MAX_SWAP_ITERATIONS = 20;
+
+    // Term degrees of the two halves of the partition being refined
+    struct BisectionState
+    {
+        const std::vector<const std::vector<int>*>& documents;
+        std::vector<int> left_degrees;
+        std::vector<int> right_degrees;
+        std::vector<double> gain_to_right;
+        std::vector<double> gain_to_left;
+        std::vector<int> touched_terms;
+        std::vector<bool> moved;            // indexed by document
+    };
+
+    // Estimated bits for a term's gaps in one half: degree * log2(size / (degree + 1))
+    double GapCost(int degree, size_t size)
+    {
+        return degree * std::log2(static_cast<double>(size) / (degree + 1));
+    }
+
+    void CountDegrees(BisectionState& state, const uint32_t* begin, const uint32_t* end, std::vector<int>& degrees)
+    {
+        for (const uint32_t* it = begin; it != end; ++it)
+        {
+            for (const int term_id : *state.documents[*it])
+            {
+                if (state.left_degrees[term_id] == 0 && state.right_degrees[term_id] == 0)
+                    state.touched_terms.push_back(term_id);
+                ++degrees[term_id];
+            }
+        }
+    }
+
+    // Gain of moving every document of [begin, end) to the other half, best first
+    std::vector<std::pair<double, uint32_t>> RankMoves
+        (const BisectionState& state, const uint32_t* begin, const uint32_t* end, const std::vector<double>& term_gains)
+    {
+        std::vector<std::pair<double, uint32_t>> moves;
+        moves.reserve(end - begin);
+        for (const uint32_t* it = begin; it != end; ++it)
+        {
+            double gain = 0;
+            for (const int term_id : *state.documents[*it])
+                gain += term_gains[term_id];
+            moves.push_back({ gain, *it });
+        }
+        std::sort(moves.begin(), moves.end(), [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
+        return moves;
+    }
+
+    void Bisect(BisectionState& state, uint32_t* begin, uint32_t* end)
+    {
+        const size_t size = end - begin;
+        if (size <= MIN_PARTITION_SIZE)
+            return;
+        uint32_t* middle = begin + size / 2;
+        const size_t left_size = middle - begin;
+        const size_t right_size = end - middle;
+
+        for (int iteration = 0; iteration < MAX_SWAP_ITERATIONS; ++iteration)
+        {
+            CountDegrees(state, begin, middle, state.left_degrees);
+            CountDegrees(state, middle, end, state.right_degrees);
+            for (const int term_id : state.touched_terms)
+            {
+                const int left = state.left_degrees[term_id];
+                const int right = state.right_degrees[term_id];
+                const double cost = GapCost(left, left_size) + GapCost(right, right_size);
+                state.gain_to_right[term_id] = left > 0
+                    ? cost - GapCost(left - 1, left_size) - GapCost(right + 1, right_size) : 0;
+                state.gain_to_left[term_id] = right > 0
+                    ? cost - GapCost(left + 1, left_size) - GapCost(right - 1, right_size) : 0;
+            }
+
+            const auto left_moves = RankMoves(state, begin, middle, state.gain_to_right);
+            const auto right_moves = RankMoves(state, middle, end, state.gain_to_left);
+            size_t swaps = 0;
+            while (swaps < left_moves.size() && swaps < right_moves.size()
+                && left_moves[swaps].first + right_moves[swaps].first > 0)
+            {
+                ++swaps;
+            }
+            for (size_t i = 0; i < swaps; ++i)
+            {
+                state.moved[left_moves[i].second] = state.moved[right_moves[i].second] = true;
+            }
+            size_t next_left = 0;
+            size_t next_right = 0;
+            for (uint32_t* it = begin; it != middle; ++it)
+            {
+                if (state.moved[*it])
+                {
+                    state.moved[*it] = false;
+                    *it = right_moves[next_right++].second;
+                }
+            }
+            for (uint32_t* it = middle; it != end; ++it)
+            {
+                if (state.moved[*it])
+                {
+                    state.moved[*it] = false;
+                    *it = left_moves[next_left++].second;
+                }
+            }
+
+            for (const int term_id : state.touched_terms)
+                state.left_degrees[term_id] = state.right_degrees[term_id] = 0;
+            state.touched_terms.clear();
+            if (swaps == 0)
+                break;
+        }
+
+        Bisect(state, begin, middle);
+        Bisect(state, middle, end);
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, const ReorderReport& report)
+{
+    using namespace std::chrono;
+    return os << "{ documents = "s << report.document_count
+        << ", posting bytes = "s << report.posting_bytes_before << " -> "s << report.posting_bytes_after
+        << ", query time = "s << duration_cast<microseconds>(report.query_time_before).count()
+        << " us -> "s << duration_cast<microseconds>(report.query_time_after).count() << " us }"s;
+}
+
+std::vector<uint32_t> ComputeBisectionOrder(const std::vector<const std::vector<int>*>& documents, size_t term_count)
+{
+    std::vector<uint32_t> order(documents.size());
+    std::iota(order.begin(), order.end(), 0);
+    BisectionState state{ documents,
+        std::vector<int>(term_count), std::vector<int>(term_count),
+        std::vector<double>(term_count), std::vector<double>(term_count), {}, std::vector<bool>(documents.size()) };
+    Bisect(state, order.data(), order.data() + order.size());
+    return order;
+}
+
+size_t ComputePostingGapBytes(const IndexSnapshot& snapshot, size_t term_count)
+{
+    size_t bytes = 0;
+    for (size_t term_id = 0; term_id < term_count; ++term_id)
+    {
+        for (const PostingSpan& span : snapshot.GetPostings(static_cast<int>(term_id)))
+        {
+            uint32_t previous = 0;
+            for (size_t i = 0; i < span.size; ++i)
+            {
+                for (uint32_t gap = span.ordinals[i] - previous; ; gap >>= 7)
+                {
+                    ++bytes;
+                    if (gap < 0x80)
+                        break;
+                }
+                previous = span.ordinals[i];
+            }
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "segmented_index.h"
+
+struct ReorderReport
+{
+    size_t document_count = 0;
+    size_t posting_bytes_before = 0;    // postings encoded as varint ordinal gaps
+    size_t posting_bytes_after = 0;
+    std::chrono::nanoseconds query_time_before{ 0 };   // all sample queries, sequential
+    std::chrono::nanoseconds query_time_after{ 0 };
+};
+
+std::ostream& operator<<(std::ostream& os, const ReorderReport& report);
+
+// Orders documents by recursive graph bisection: every partition is split in
+// two halves and documents are swapped between them while that lowers the
+// estimated cost of encoding the gaps of the posting lists, then both halves
+// are split again. documents[i] holds the sorted term IDs of document i.
+// Returns order, where order[k] is the document that should get ordinal k.
+std::vector<uint32_t> ComputeBisectionOrder(const std::vector<const std::vector<int>*>& documents, size_t term_count);
+
+// Size of all postings in the snapshot when stored as varint gaps between ordinals
+size_t ComputePostingGapBytes(const IndexSnapshot& snapshot, size_t term_count);
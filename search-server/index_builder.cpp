@@ -0,0 +1,581 @@
+#include "index_builder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <execution>
+#include <numeric>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+#include "search_server.h"
+#include "varint.h"
+
+using namespace std::string_literals;
+
+// Index file: the "SSINDEX3" magic, then varints unless noted
+//   u8 text analysis | u8 document storage
+//   stop word count, stop words         (varint size | bytes each, as analyzed)
+//   document count | term count | posting count
+//   terms in ID order                   (varint size | bytes each)
+//   documents in ordinal order          (id | zigzag rating | u8 status | varint size | varint term IDs in text order,
+//                                        then with RAW_TEXT storage varint size | raw text)
+//   postings of every term in ID order  (count | ordinal gaps | raw doubles)
+// A run file holds term blocks: term ID | the same postings layout.
+namespace
+{
+    const std::string_view INDEX_MAGIC = "SSINDEX3";
+    const uint64_t RUN_INDEX_INTERVAL = 64 * 1024;
+    const size_t COPY_CHUNK_SIZE = 1 << 20;
+
+    void AppendDouble(std::string& out, double value)
+    {
+        char bytes[sizeof(double)];
+        std::memcpy(bytes, &value, sizeof(double));
+        out.append(bytes, sizeof(double));
+    }
+
+    void AppendString(std::string& out, std::string_view value)
+    {
+        AppendVarint(out, value.size());
+        out.append(value);
+    }
+
+    void AppendPostings(std::string& out, const std::vector<uint32_t>& ordinals, const std::vector<double>& term_freqs)
+    {
+        AppendVarint(out, ordinals.size());
+        uint32_t previous = 0;
+        for (const uint32_t ordinal : ordinals)
+        {
+            AppendVarint(out, ordinal - previous);
+            previous = ordinal;
+        }
+        for (const double term_freq : term_freqs)
+            AppendDouble(out, term_freq);
+    }
+
+    uint64_t ReadVarint(std::istream& in)
+    {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            const int byte = in.get();
+            if (byte == std::char_traits<char>::eof())
+                throw std::runtime_error("Truncated index file"s);
+            result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                return result;
+        }
+        throw std::runtime_error("Malformed varint in index file"s);
+    }
+
+    std::string ReadString(std::istream& in)
+    {
+        std::string result(ReadVarint(in), '\0');
+        if (!in.read(result.data(), result.size()))
+            throw std::runtime_error("Truncated index file"s);
+        return result;
+    }
+
+    // Appends count postings in the layout of AppendPostings, the count already read
+    void ReadPostings(std::istream& in, uint64_t count, std::vector<uint32_t>& ordinals, std::vector<double>& term_freqs)
+    {
+        uint32_t ordinal = 0;
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            ordinal += static_cast<uint32_t>(ReadVarint(in));
+            ordinals.push_back(ordinal);
+        }
+        const size_t old_size = term_freqs.size();
+        term_freqs.resize(old_size + count);
+        if (!in.read(reinterpret_cast<char*>(term_freqs.data() + old_size), count * sizeof(double)))
+            throw std::runtime_error("Truncated index file"s);
+    }
+
+    void CopyFile(const std::string& path, std::ostream& out)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Cannot open "s + path);
+        std::vector<char> chunk(COPY_CHUNK_SIZE);
+        while (in.read(chunk.data(), chunk.size()) || in.gcount() > 0)
+            out.write(chunk.data(), in.gcount());
+    }
+
+    // Sequential reader of the term blocks of one run, starting at a given term
+    class RunReader
+    {
+    public:
+        RunReader(const std::string& path, uint64_t offset, int first_term_id)
+            : in_(path, std::ios::binary)
+        {
+            if (!in_)
+                throw std::runtime_error("Cannot open run "s + path);
+            in_.seekg(offset);
+            ReadHeader();
+            while (!AtEnd() && term_id_ < first_term_id)
+            {
+                SkipPostings();
+                ReadHeader();
+            }
+        }
+
+        bool AtEnd() const { return at_end_; }
+        int GetTermId() const { return term_id_; }
+
+        // Appends the postings of the current term and moves to the next one
+        void ReadTerm(std::vector<uint32_t>& ordinals, std::vector<double>& term_freqs)
+        {
+            ReadPostings(in_, count_, ordinals, term_freqs);
+            ReadHeader();
+        }
+
+    private:
+        std::ifstream in_;
+        int term_id_ = 0;
+        uint64_t count_ = 0;
+        bool at_end_ = false;
+
+        void ReadHeader()
+        {
+            if (in_.peek() == std::char_traits<char>::eof())
+            {
+                at_end_ = true;
+                return;
+            }
+            term_id_ = static_cast<int>(ReadVarint(in_));
+            count_ = ReadVarint(in_);
+        }
+
+        void SkipPostings()
+        {
+            for (uint64_t i = 0; i < count_; ++i)
+                ReadVarint(in_);
+            in_.seekg(count_ * sizeof(double), std::ios::cur);
+        }
+    };
+}
+
+std::ostream& operator<<(std::ostream& os, const IndexBuildReport& report)
+{
+    return os << report.document_count << " documents, "s << report.term_count << " terms, "s
+        << report.posting_count << " postings from "s << report.run_count << " runs, buffer peak "s
+        << report.peak_buffer_bytes << " bytes, index "s << report.index_bytes << " bytes"s << std::endl;
+}
+
+IndexBuilder::IndexBuilder(const std::string& stop_words_text, const std::string& path, IndexBuildOptions options)
+    : stop_words_(MakeStopWords(SplitIntoWords(stop_words_text), options.text_analysis)),
+    path_(path),
+    options_(options),
+    documents_out_(GetDocumentsPath(), std::ios::binary | std::ios::trunc)
+{
+    if (!documents_out_)
+        throw std::runtime_error("Cannot create "s + GetDocumentsPath());
+    buffer_.reserve(std::max<size_t>(options_.memory_limit / sizeof(Posting), 1));
+}
+
+IndexBuilder::~IndexBuilder()
+{
+    RemoveTemporaryFiles();
+}
+
+void IndexBuilder::AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings)
+{
+    if (finished_)
+        throw std::logic_error("IndexBuilder is already finished"s);
+    if (document_id < 0)
+        throw std::invalid_argument("Negative ID"s);
+    if (document_ids_.count(document_id) > 0)
+        throw std::invalid_argument("ID "s + std::to_string(document_id) + " is already used"s);
+
+    WithTextAnalyzer(options_.text_analysis,
+        [&](auto analyzer) { analyzer.Analyze(document, stop_words_, analyzed_text_, words_); });
+
+    std::vector<int> word_ids;
+    word_ids.reserve(words_.size());
+    for (const std::string_view word : words_)
+        word_ids.push_back(terms_.Add(word));
+    document_ids_.insert(document_id);
+
+    const uint32_t ordinal = static_cast<uint32_t>(report_.document_count++);
+    std::string record;
+    AppendVarint(record, static_cast<uint64_t>(document_id));
+    AppendVarint(record, ZigZagEncode(SearchServer::ComputeAverageRating(ratings)));
+    record.push_back(static_cast<char>(status));
+    AppendString(record, SearchServer::EncodeTermSequence(word_ids));
+    documents_out_.write(record.data(), record.size());
+
+    // frequencies are computed exactly as SearchServer::AddDocument does
+    std::sort(word_ids.begin(), word_ids.end());
+    term_posting_counts_.resize(terms_.GetTermCount());
+    const double inv_word_count = 1.0 / words_.size();
+    std::vector<Posting> postings;
+    for (auto run_begin = word_ids.begin(); run_begin != word_ids.end();)
+    {
+        const auto run_end = std::upper_bound(run_begin, word_ids.end(), *run_begin);
+        postings.push_back(Posting{ *run_begin, ordinal, (run_end - run_begin) * inv_word_count });
+        ++term_posting_counts_[*run_begin];
+        run_begin = run_end;
+    }
+
+    // the buffer never grows past its reserved size unless one document alone is larger
+    if (buffer_.size() + postings.size() > buffer_.capacity())
+        SpillRun();
+    buffer_.insert(buffer_.end(), postings.begin(), postings.end());
+}
+
+IndexBuildReport IndexBuilder::Finish()
+{
+    if (finished_)
+        throw std::logic_error("IndexBuilder is already finished"s);
+    finished_ = true;
+    SpillRun();
+    documents_out_.close();
+    if (!documents_out_)
+        throw std::runtime_error("Cannot write "s + GetDocumentsPath());
+
+    // term ranges of about equal posting counts, one per partition
+    const int term_count = static_cast<int>(terms_.GetTermCount());
+    report_.term_count = term_count;
+    report_.posting_count = std::accumulate(term_posting_counts_.begin(), term_posting_counts_.end(), size_t{ 0 });
+    size_t partition_count = options_.merge_partitions > 0 ? options_.merge_partitions : std::max(1u, std::thread::hardware_concurrency());
+    partition_count = std::min<size_t>(partition_count, term_count);
+    std::vector<int> partition_bounds{ 0 };
+    size_t postings_so_far = 0;
+    for (int term_id = 0; term_id < term_count && partition_bounds.size() < partition_count; ++term_id)
+    {
+        postings_so_far += term_posting_counts_[term_id];
+        if (postings_so_far * partition_count >= report_.posting_count * partition_bounds.size())
+            partition_bounds.push_back(term_id + 1);
+    }
+    if (term_count > 0)
+        partition_bounds.push_back(term_count);
+    MergeRuns(partition_bounds);
+
+    const std::string tmp_path = path_ + ".tmp"s;
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Cannot create "s + tmp_path);
+        std::string header(INDEX_MAGIC);
+        header.push_back(static_cast<char>(options_.text_analysis));
+        header.push_back(static_cast<char>(DocumentStorage::TERM_IDS));
+        AppendVarint(header, stop_words_.size());
+        for (const std::string& word : stop_words_)
+            AppendString(header, word);
+        AppendVarint(header, report_.document_count);
+        AppendVarint(header, report_.term_count);
+        AppendVarint(header, report_.posting_count);
+        for (int term_id = 0; term_id < term_count; ++term_id)
+            AppendString(header, terms_.GetTerm(term_id));
+        out.write(header.data(), header.size());
+
+        CopyFile(GetDocumentsPath(), out);
+        for (size_t partition = 0; partition + 1 < partition_bounds.size(); ++partition)
+            CopyFile(GetPartitionPath(partition), out);
+        report_.index_bytes = static_cast<size_t>(out.tellp());
+        out.close();
+        if (!out)
+            throw std::runtime_error("Cannot write "s + tmp_path);
+    }
+    if (std::rename(tmp_path.c_str(), path_.c_str()) != 0)
+        throw std::runtime_error("Cannot install index "s + path_);
+
+    report_.run_count = runs_.size();
+    RemoveTemporaryFiles();
+    return report_;
+}
+
+void IndexBuilder::Open(const std::string& path, SearchServer& server)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Cannot open index "s + path);
+    Open(in, path, server);
+}
+
+void IndexBuilder::Open(std::istream& in, const std::string& path, SearchServer& server)
+{
+    if (!server.documents_.empty() || !server.document_slots_.empty())
+        throw std::invalid_argument("IndexBuilder::Open needs an empty server"s);
+    std::string magic(INDEX_MAGIC.size(), '\0');
+    if (!in.read(magic.data(), magic.size()) || magic != INDEX_MAGIC)
+        throw std::runtime_error("Not an index file: "s + path);
+
+    if (static_cast<TextAnalysis>(in.get()) != server.text_analysis_)
+        throw std::invalid_argument("Index "s + path + " was built with another text analysis"s);
+    const auto document_storage = static_cast<DocumentStorage>(in.get());
+    std::set<std::string, std::less<>> stop_words;
+    for (uint64_t count = ReadVarint(in); count > 0; --count)
+        stop_words.insert(ReadString(in));
+    if (stop_words != *server.stop_words_)
+        throw std::invalid_argument("Index "s + path + " was built with other stop words"s);
+    const uint64_t document_count = ReadVarint(in);
+    const uint64_t term_count = ReadVarint(in);
+    const uint64_t posting_count = ReadVarint(in);
+
+    for (uint64_t term_id = 0; term_id < term_count; ++term_id)
+    {
+        const int added_id = server.terms_.Add(ReadString(in));
+        if (added_id != static_cast<int>(term_id))
+            throw std::runtime_error("Duplicate term in index "s + path);
+        if (server.GetExtras().fuzzy_index)
+            server.GetExtras().fuzzy_index->AddTerm(added_id, server.terms_.GetTerm(added_id));
+    }
+    server.document_freqs_.assign(term_count, 0);
+
+    server.document_storage_ = document_storage;
+    for (uint32_t ordinal = 0; ordinal < document_count; ++ordinal)
+    {
+        const int document_id = static_cast<int>(ReadVarint(in));
+        const int rating = static_cast<int>(ZigZagDecode(ReadVarint(in)));
+        const auto status = static_cast<DocumentStatus>(in.get());
+        std::string doc_text = ReadString(in);
+
+        std::vector<int> word_ids;
+        for (std::string_view encoded = doc_text; !encoded.empty();)
+            word_ids.push_back(static_cast<int>(ReadVarint(encoded)));
+        if (document_storage == DocumentStorage::RAW_TEXT)
+            doc_text = ReadString(in);
+        const size_t word_count = word_ids.size();
+        const SearchServer::DocumentTerms& doc_terms = server.document_to_word_freqs_[document_id] =
+            server.ComputeDocumentTerms(std::move(word_ids));
+        for (const int term_id : doc_terms.term_ids)
+            ++server.document_freqs_[term_id];
+        server.documents_.emplace(document_id, SearchServer::DocumentData{ rating, std::move(doc_text), status, ordinal });
+        server.document_slots_.push_back(SearchServer::DocumentSlot{ document_id, rating, status });
+        server.document_lengths_.push_back(static_cast<uint32_t>(word_count));
+        server.total_document_length_ += word_count;
+        server.document_ids_.push_back(document_id);
+    }
+
+    std::vector<int> term_ids(term_count);
+    std::iota(term_ids.begin(), term_ids.end(), 0);
+    std::vector<uint32_t> offsets{ 0 };
+    std::vector<uint32_t> ordinals;
+    TermFreqArray term_freqs(server.term_freq_precision_);
+    std::vector<double> term_freqs_read;     // of one term, before they take the precision of the server
+    offsets.reserve(term_count + 1);
+    ordinals.reserve(posting_count);
+    term_freqs.reserve(posting_count);
+    for (uint64_t term_id = 0; term_id < term_count; ++term_id)
+    {
+        term_freqs_read.clear();
+        ReadPostings(in, ReadVarint(in), ordinals, term_freqs_read);
+        for (const double term_freq : term_freqs_read)
+            term_freqs.push_back(term_freq);
+        offsets.push_back(static_cast<uint32_t>(ordinals.size()));
+    }
+    if (ordinals.size() != posting_count)
+        throw std::runtime_error("Damaged index "s + path);
+
+    server.index_.AddSegment(std::make_shared<const IndexSegment>(0, static_cast<uint32_t>(document_count), document_count,
+        std::move(term_ids), std::move(offsets), std::move(ordinals), std::move(term_freqs)));
+    // the file has no impacts, which depend on the relevance model of the server, nor positions
+    if (server.impact_scoring_ || server.positional_index_)
+        server.RebuildIndex(server.document_ids_);
+    else if (server.documents_.size() >= CHAMPION_MIN_DOCUMENTS)
+        server.RebuildChampionLists();
+}
+
+void IndexBuilder::Save(const SearchServer& server, std::ostream& out)
+{
+    const size_t term_count = server.terms_.GetTermCount();
+    size_t posting_count = 0;
+    for (const int document_id : server.document_ids_)
+        posting_count += server.document_to_word_freqs_.at(document_id).term_ids.size();
+
+    std::string data(INDEX_MAGIC);
+    data.push_back(static_cast<char>(server.text_analysis_));
+    data.push_back(static_cast<char>(server.document_storage_));
+    AppendVarint(data, server.stop_words_->size());
+    for (const std::string& word : *server.stop_words_)
+        AppendString(data, word);
+    AppendVarint(data, server.documents_.size());
+    AppendVarint(data, term_count);
+    AppendVarint(data, posting_count);
+    for (size_t term_id = 0; term_id < term_count; ++term_id)
+        AppendString(data, server.terms_.GetTerm(static_cast<int>(term_id)));
+
+    // removed documents leave gaps in the slot table, which the renumbering closes
+    std::vector<std::vector<uint32_t>> term_ordinals(term_count);
+    std::vector<std::vector<double>> term_freqs(term_count);
+    uint32_t ordinal = 0;
+    for (const SearchServer::DocumentSlot& slot : server.document_slots_)
+    {
+        if (slot.document_id < 0)
+            continue;
+        const SearchServer::DocumentData& document_data = server.documents_.at(slot.document_id);
+        AppendVarint(data, static_cast<uint64_t>(slot.document_id));
+        AppendVarint(data, ZigZagEncode(document_data.rating));
+        data.push_back(static_cast<char>(document_data.status));
+        AppendString(data, SearchServer::EncodeTermSequence(server.GetTermSequence(document_data)));
+        // the term IDs spare Open the analysis, the raw text keeps what the server stores
+        if (server.document_storage_ == DocumentStorage::RAW_TEXT)
+            AppendString(data, document_data.doc_text);
+        const SearchServer::DocumentTerms& doc_terms = server.document_to_word_freqs_.at(slot.document_id);
+        for (size_t i = 0; i < doc_terms.term_ids.size(); ++i)
+        {
+            term_ordinals[doc_terms.term_ids[i]].push_back(ordinal);
+            term_freqs[doc_terms.term_ids[i]].push_back(doc_terms.freqs[i]);
+        }
+        ++ordinal;
+    }
+    for (size_t term_id = 0; term_id < term_count; ++term_id)
+    {
+        AppendPostings(data, term_ordinals[term_id], term_freqs[term_id]);
+        std::vector<uint32_t>().swap(term_ordinals[term_id]);
+        std::vector<double>().swap(term_freqs[term_id]);
+    }
+    out.write(data.data(), data.size());
+}
+
+std::string IndexBuilder::GetDocumentsPath() const
+{
+    return path_ + ".documents.tmp"s;
+}
+
+std::string IndexBuilder::GetPartitionPath(size_t partition) const
+{
+    return path_ + ".part"s + std::to_string(partition) + ".tmp"s;
+}
+
+void IndexBuilder::SpillRun()
+{
+    if (buffer_.empty())
+        return;
+    report_.peak_buffer_bytes = std::max(report_.peak_buffer_bytes, buffer_.size() * sizeof(Posting));
+    std::sort(std::execution::par, buffer_.begin(), buffer_.end(),
+        [](const Posting& lhs, const Posting& rhs)
+        {
+            return std::tie(lhs.term_id, lhs.ordinal) < std::tie(rhs.term_id, rhs.ordinal);
+        });
+
+    Run& run = runs_.emplace_back();
+    run.path = path_ + ".run"s + std::to_string(runs_.size() - 1) + ".tmp"s;
+    std::ofstream out(run.path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("Cannot create run "s + run.path);
+
+    std::string block;
+    std::vector<uint32_t> ordinals;
+    std::vector<double> term_freqs;
+    uint64_t offset = 0;
+    uint64_t next_indexed_offset = 0;
+    for (auto term_begin = buffer_.begin(); term_begin != buffer_.end();)
+    {
+        const int term_id = term_begin->term_id;
+        const auto term_end = std::find_if(term_begin, buffer_.end(),
+            [term_id](const Posting& posting) { return posting.term_id != term_id; });
+        if (offset >= next_indexed_offset)
+        {
+            run.block_offsets.emplace_back(term_id, offset);
+            next_indexed_offset = offset + RUN_INDEX_INTERVAL;
+        }
+
+        ordinals.clear();
+        term_freqs.clear();
+        for (auto it = term_begin; it != term_end; ++it)
+        {
+            ordinals.push_back(it->ordinal);
+            term_freqs.push_back(it->term_freq);
+        }
+        block.clear();
+        AppendVarint(block, term_id);
+        AppendPostings(block, ordinals, term_freqs);
+        out.write(block.data(), block.size());
+        offset += block.size();
+        term_begin = term_end;
+    }
+    out.close();
+    if (!out)
+        throw std::runtime_error("Cannot write run "s + run.path);
+
+    buffer_.clear();
+}
+
+void IndexBuilder::MergeRuns(const std::vector<int>& partition_bounds) const
+{
+    if (partition_bounds.size() < 2)
+        return;
+    // an exception escaping a parallel algorithm terminates the program, so it is carried out
+    std::vector<size_t> partitions(partition_bounds.size() - 1);
+    std::iota(partitions.begin(), partitions.end(), 0);
+    std::vector<std::exception_ptr> errors(partitions.size());
+    std::for_each(std::execution::par, partitions.begin(), partitions.end(),
+        [&](size_t partition)
+        {
+            try
+            {
+                MergePartition(partition_bounds[partition], partition_bounds[partition + 1], GetPartitionPath(partition));
+            }
+            catch (...)
+            {
+                errors[partition] = std::current_exception();
+            }
+        });
+    for (const std::exception_ptr& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+void IndexBuilder::MergePartition(int first_term_id, int end_term_id, const std::string& output_path) const
+{
+    std::vector<RunReader> readers;
+    readers.reserve(runs_.size());
+    for (const Run& run : runs_)
+    {
+        // start from the last indexed block that does not begin after first_term_id
+        const auto block = std::upper_bound(run.block_offsets.begin(), run.block_offsets.end(), first_term_id,
+            [](int term_id, const std::pair<int, uint64_t>& entry) { return term_id < entry.first; });
+        readers.emplace_back(run.path, block == run.block_offsets.begin() ? 0 : std::prev(block)->second, first_term_id);
+    }
+
+    // runs cover increasing ordinal ranges, so the runs holding a term are read in run order
+    using HeapEntry = std::pair<int, size_t>;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<>> heap;
+    for (size_t i = 0; i < readers.size(); ++i)
+        if (!readers[i].AtEnd() && readers[i].GetTermId() < end_term_id)
+            heap.emplace(readers[i].GetTermId(), i);
+
+    std::ofstream out(output_path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("Cannot create "s + output_path);
+    std::string block;
+    std::vector<uint32_t> ordinals;
+    std::vector<double> term_freqs;
+    for (int term_id = first_term_id; term_id < end_term_id; ++term_id)
+    {
+        // every dictionary term has postings
+        if (heap.empty() || heap.top().first != term_id)
+            throw std::runtime_error("Damaged run files for "s + path_);
+        ordinals.clear();
+        term_freqs.clear();
+        while (!heap.empty() && heap.top().first == term_id)
+        {
+            RunReader& reader = readers[heap.top().second];
+            heap.pop();
+            reader.ReadTerm(ordinals, term_freqs);
+            if (!reader.AtEnd() && reader.GetTermId() < end_term_id)
+                heap.emplace(reader.GetTermId(), &reader - readers.data());
+        }
+        block.clear();
+        AppendPostings(block, ordinals, term_freqs);
+        out.write(block.data(), block.size());
+    }
+    out.close();
+    if (!out)
+        throw std::runtime_error("Cannot write "s + output_path);
+}
+
+void IndexBuilder::RemoveTemporaryFiles()
+{
+    documents_out_.close();
+    std::remove(GetDocumentsPath().c_str());
+    for (const Run& run : runs_)
+        std::remove(run.path.c_str());
+    for (size_t partition = 0; std::remove(GetPartitionPath(partition).c_str()) == 0; ++partition) {}
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "term_dictionary.h"
+#include "text_analysis.h"
+
+class SearchServer;
+
+struct IndexBuildOptions
+{
+    size_t memory_limit = 256 << 20;    // bytes of buffered postings before a run is spilled
+    size_t merge_partitions = 0;        // term ranges merged in parallel, 0 for one per hardware thread
+    TextAnalysis text_analysis = TextAnalysis::EXACT;   // must match the server the index is opened in
+};
+
+struct IndexBuildReport
+{
+    size_t document_count = 0;
+    size_t term_count = 0;
+    size_t posting_count = 0;
+    size_t run_count = 0;
+    size_t peak_buffer_bytes = 0;       // largest posting buffer held before a spill
+    size_t index_bytes = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, const IndexBuildReport& report);
+
+// Offline builder for corpora that do not fit in memory.
+//
+// Documents are streamed in: their records go straight to a temporary file and
+// their (term, ordinal, frequency) postings to a buffer that is sorted and
+// spilled as a run file once it reaches memory_limit. Finish() merges the runs
+// k-way, with the term ID space split into ranges of similar posting counts that
+// are merged in parallel, and writes one index file. Open() loads that file into
+// an empty server, which then answers every query exactly like a server that
+// got the same AddDocument calls, with DocumentStorage::TERM_IDS.
+//
+// Besides the buffer, the builder keeps the term dictionary, a posting count
+// per term and the set of document IDs in memory. Save() writes the live
+// documents of a server in the same format, which WriteAheadLog checkpoints use.
+//
+//   IndexBuilder builder(stop_words, "corpus.index");
+//   for (...) builder.AddDocument(id, text, status, ratings);
+//   builder.Finish();
+//   SearchServer server(stop_words);
+//   IndexBuilder::Open("corpus.index", server);
+class IndexBuilder
+{
+public:
+    IndexBuilder(const std::string& stop_words_text, const std::string& path, IndexBuildOptions options = IndexBuildOptions());
+
+    IndexBuilder(const IndexBuilder&) = delete;
+    IndexBuilder& operator=(const IndexBuilder&) = delete;
+
+    // Removes the temporary files
+    ~IndexBuilder();
+
+    // Same validation as SearchServer::AddDocument
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+
+    // Spills the last run, merges every run and writes the index. No documents may be added afterwards.
+    IndexBuildReport Finish();
+
+    // Loads the index at path into server, which must be empty and use the stop words and text analysis the index was built with
+    static void Open(const std::string& path, SearchServer& server);
+
+    // Same as above, reading the index from in; name only appears in errors
+    static void Open(std::istream& in, const std::string& name, SearchServer& server);
+
+    // Writes the live documents of server as an index, renumbered in ordinal order, with the
+    // whole term dictionary and the raw texts of a DocumentStorage::RAW_TEXT server, whose
+    // storage Open restores. Must be called from the thread that mutates the server.
+    static void Save(const SearchServer& server, std::ostream& out);
+
+private:
+    struct Posting
+    {
+        int term_id;
+        uint32_t ordinal;
+        double term_freq;
+    };
+
+    // Spilled run: every term block sorted by term ID, postings of a term by ordinal
+    struct Run
+    {
+        std::string path;
+        std::vector<std::pair<int, uint64_t>> block_offsets;   // term ID and file offset of every RUN_INDEX_INTERVAL bytes
+    };
+
+    const std::set<std::string, std::less<>> stop_words_;
+    const std::string path_;
+    const IndexBuildOptions options_;
+    TermDictionary terms_;
+    std::vector<uint32_t> term_posting_counts_;     // indexed by term ID
+    std::set<int> document_ids_;
+    std::ofstream documents_out_;
+    std::string analyzed_text_;         // reused by every AddDocument
+    std::vector<std::string_view> words_;
+    std::vector<Posting> buffer_;
+    std::vector<Run> runs_;
+    IndexBuildReport report_;
+    bool finished_ = false;
+
+    std::string GetDocumentsPath() const;
+    std::string GetPartitionPath(size_t partition) const;
+    void SpillRun();
+    void MergeRuns(const std::vector<int>& partition_bounds) const;
+    void MergePartition(int first_term_id, int end_term_id, const std::string& output_path) const;
+    void RemoveTemporaryFiles();
+};
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "line_protocol.h"
+
+#include <charconv>
+#include <stdexcept>
+
+using namespace std::literals;
+
+namespace
+{
+    std::string_view NextToken(std::string_view& text)
+    {
+        const size_t begin = text.find_first_not_of(' ');
+        if (begin == std::string_view::npos)
+        {
+            text = {};
+            return {};
+        }
+        const size_t end = text.find(' ', begin);
+        const std::string_view token = text.substr(begin, end - begin);
+        text = end == std::string_view::npos ? std::string_view{} : text.substr(end + 1);
+        return token;
+    }
+
+    template <typename Number>
+    Number ParseNumber(std::string_view token, const char* what)
+    {
+        Number value{};
+        const auto [ptr, error] = std::from_chars(token.data(), token.data() + token.size(), value);
+        if (token.empty() || error != std::errc() || ptr != token.data() + token.size())
+            throw std::invalid_argument("Bad "s + what + ": "s + std::string(token));
+        return value;
+    }
+
+    template <typename Number>
+    void AppendNumber(std::string& out, Number value)
+    {
+        char buffer[32];
+        const auto [ptr, _] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, ptr);
+    }
+}
+
+ProtocolRequest ParseRequest(std::string_view line)
+{
+    ProtocolRequest request;
+    request.id = ParseNumber<uint64_t>(NextToken(line), "request id");
+    const std::string_view command = NextToken(line);
+    if (command.size() != 1)
+        throw std::invalid_argument("Bad command: "s + std::string(command));
+    request.command = command.front();
+
+    switch (request.command)
+    {
+    case 'S':
+        request.text = line;
+        break;
+    case 'M':
+        request.document_id = ParseNumber<int>(NextToken(line), "document id");
+        request.text = line;
+        break;
+    case 'A':
+    {
+        request.document_id = ParseNumber<int>(NextToken(line), "document id");
+        const int status = ParseNumber<int>(NextToken(line), "status");
+        if (status < static_cast<int>(DocumentStatus::ACTUAL) || status > static_cast<int>(DocumentStatus::REMOVED))
+            throw std::invalid_argument("Bad status: "s + std::to_string(status));
+        request.status = static_cast<DocumentStatus>(status);
+        std::string_view ratings = NextToken(line);
+        if (ratings != "-")
+        {
+            while (!ratings.empty())
+            {
+                const size_t comma = ratings.find(',');
+                request.ratings.push_back(ParseNumber<int>(ratings.substr(0, comma), "rating"));
+                ratings = comma == std::string_view::npos ? std::string_view{} : ratings.substr(comma + 1);
+            }
+        }
+        request.text = line;
+        break;
+    }
+    case 'R':
+        request.document_id = ParseNumber<int>(NextToken(line), "document id");
+        break;
+    default:
+        throw std::invalid_argument("Unknown command: "s + std::string(command));
+    }
+    return request;
+}
+
+uint64_t ParseRequestId(std::string_view line)
+{
+    std::string_view rest = line;
+    return ParseNumber<uint64_t>(NextToken(rest), "request id");
+}
+
+void AppendSearchResponse(std::string& out, uint64_t id, const std::vector<Document>& documents)
+{
+    AppendNumber(out, id);
+    out += " OK "sv;
+    AppendNumber(out, documents.size());
+    for (const Document& document : documents)
+    {
+        out.push_back(' ');
+        AppendNumber(out, document.id);
+        out.push_back(':');
+        AppendNumber(out, document.relevance);
+        out.push_back(':');
+        AppendNumber(out, document.rating);
+    }
+    out.push_back('\n');
+}
+
+void AppendMatchResponse(std::string& out, uint64_t id, const std::vector<std::string_view>& words, DocumentStatus status)
+{
+    AppendNumber(out, id);
+    out += " OK "sv;
+    AppendNumber(out, static_cast<int>(status));
+    for (const std::string_view word : words)
+    {
+        out.push_back(' ');
+        out += word;
+    }
+    out.push_back('\n');
+}
+
+void AppendOkResponse(std::string& out, uint64_t id)
+{
+    AppendNumber(out, id);
+    out += " OK\n"sv;
+}
+
+void AppendErrorResponse(std::string& out, uint64_t id, std::string_view message)
+{
+    AppendNumber(out, id);
+    out += " ERR "sv;
+    // the message must not break the framing
+    for (const char ch : message)
+        out.push_back(ch == '\n' ? ' ' : ch);
+    out.push_back('\n');
+}
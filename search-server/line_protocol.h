@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+
+// Line protocol of the query server. Every request and response is one line
+// terminated by '\n' and starts with a client-chosen request id, so requests
+// can be pipelined and answered out of order:
+//
+//   <id> S <query>                                 FindTopDocuments
+//   <id> M <document id> <query>                   MatchDocument
+//   <id> A <document id> <status> <ratings> <text> AddDocument; ratings are comma separated or "-"
+//   <id> R <document id>                           RemoveDocument
+//
+//   <id> OK <count> <document id>:<relevance>:<rating> ...    search results
+//   <id> OK <status> <word> ...                               matched words
+//   <id> OK                                                   add, remove
+//   <id> ERR <message>
+struct ProtocolRequest
+{
+    uint64_t id = 0;
+    char command = 0;
+    int document_id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+    std::string_view text;      // query or document text, points into the parsed line
+};
+
+// Parses a line without its '\n'; throws std::invalid_argument if it is malformed
+ProtocolRequest ParseRequest(std::string_view line);
+
+// Request id at the start of a line, without parsing the rest
+uint64_t ParseRequestId(std::string_view line);
+
+void AppendSearchResponse(std::string& out, uint64_t id, const std::vector<Document>& documents);
+
+void AppendMatchResponse(std::string& out, uint64_t id, const std::vector<std::string_view>& words, DocumentStatus status);
+
+void AppendOkResponse(std::string& out, uint64_t id);
+
+void AppendErrorResponse(std::string& out, uint64_t id, std::string_view message);
+
+// Cuts complete lines off the front of buffer and passes each to on_line without its '\n'
+template <typename OnLine>
+size_t ConsumeLines(std::string_view buffer, OnLine on_line)
+{
+    size_t consumed = 0;
+    for (size_t end = buffer.find('\n'); end != std::string_view::npos; end = buffer.find('\n', consumed))
+    {
+        on_line(buffer.substr(consumed, end - consumed));
+        consumed = end + 1;
+    }
+    return consumed;
+}
@@ -59,10 +59,13 @@ int main() {
 #include "search_server.h"
 #include "process_queries.h"
 #include "log_duration.h"
+#include "request_queue.h"
+#include "tenant_host.h"
 
 #include <execution>
 #include <iostream>
 #include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -111,12 +114,13 @@ vector<string> GenerateQueries(mt19937& generator, const vector<string>& diction
     return queries;
 }
 
-template <typename ExecutionPolicy>
-void Test(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
+// Without a policy the server picks the query plan itself
+template <typename... ExecutionPolicy>
+void Test(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&&... policy) {
     LOG_DURATION(mark);
     double total_relevance = 0;
     for (const string_view query : queries) {
-        for (const auto& document : search_server.FindTopDocuments(policy, query)) {
+        for (const auto& document : search_server.FindTopDocuments(policy..., query)) {
             total_relevance += document.relevance;
         }
     }
@@ -141,6 +145,226 @@ int main()
 
     TEST(seq);
     TEST(par);
+    Test("auto"sv, search_server, queries);
+    for (const SimdLevel level : { SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2 }) {
+        if (level > GetSupportedSimdLevel()) {
+            break;
+        }
+        SetSimdLevel(level);
+        ostringstream mark;
+        mark << "seq, "s << level << " kernels"s;
+        Test(mark.str(), search_server, queries, execution::seq);
+    }
+    SetSimdLevel(GetSupportedSimdLevel());
+
+    {
+        LOG_DURATION("auto, 1 ms budget"s);
+        double total_relevance = 0;
+        size_t incomplete = 0;
+        for (const string& query : queries) {
+            const BoundedSearchResult result = search_server.FindTopDocuments(query, SearchBudget::Timeout(1ms));
+            for (const auto& document : result.documents) {
+                total_relevance += document.relevance;
+            }
+            incomplete += !result.is_complete;
+        }
+        cout << total_relevance << ", "s << incomplete << " incomplete"s << endl;
+    }
+
+    {
+        LOG_DURATION("external build, 1 MB runs"s);
+        IndexBuildOptions options;
+        options.memory_limit = 1 << 20;
+        IndexBuilder builder(dictionary[0], "benchmark.index"s, options);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            builder.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        cout << builder.Finish();
+    }
+    SearchServer opened_server(dictionary[0]);
+    IndexBuilder::Open("benchmark.index"s, opened_server);
+    remove("benchmark.index");
+    Test("opened index"sv, opened_server, queries);
+
+    opened_server.SetImpactScoring(true);
+    Test("impact scoring"sv, opened_server, queries);
+    {
+        // a word in every document weighs 0 under TF-IDF, yet still matches
+        SearchServer common_word_server(dictionary[0]);
+        common_word_server.AddDocument(0, dictionary[1] + " "s + dictionary[2], DocumentStatus::ACTUAL, { 1 });
+        common_word_server.AddDocument(1, dictionary[1] + " "s + dictionary[3], DocumentStatus::ACTUAL, { 2 });
+        const size_t exact_found = common_word_server.FindTopDocuments(dictionary[1]).size();
+        common_word_server.SetImpactScoring(true);
+        cout << "common word: "s << exact_found << " found exactly, "s
+            << common_word_server.FindTopDocuments(dictionary[1]).size() << " by impact"s << endl;
+    }
+    opened_server.SetRelevanceModel(RelevanceModel::BM25);
+    Test("BM25, impact scoring"sv, opened_server, queries);
+    opened_server.SetImpactScoring(false);
+    Test("BM25"sv, opened_server, queries);
+
+    opened_server.SetPositionalIndex(true);
+    Test("BM25, positional index"sv, opened_server, queries);
+    {
+        LOG_DURATION("phrases of two words"s);
+        size_t found = 0;
+        for (size_t i = 0; i < 1'000; ++i) {
+            const size_t second_space = documents[i].find(' ', documents[i].find(' ') + 1);
+            found += opened_server.FindTopDocuments('"' + documents[i].substr(0, second_space) + '"').size();
+        }
+        cout << found << ", positions take "s << opened_server.GetPositionalIndexMemoryUsage() << " bytes"s << endl;
+    }
+
+    {
+        AdmissionOptions options;
+        options.latency_target = 20ms;
+        RequestQueue request_queue(search_server, options);
+        vector<future<SearchResponse>> responses;
+        for (const string& query : queries) {
+            responses.push_back(request_queue.Submit(query));
+        }
+        for (auto& response : responses) {
+            response.wait();
+        }
+        cout << "all at once, 20 ms target: "s << request_queue.GetAdmissionStats() << endl;
+    }
+
+    StageProfiler profiler;
+    search_server.SetStageProfiler(&profiler);
+    for (const string& query : queries) {
+        search_server.FindTopDocuments(execution::seq, query);
+    }
+    cout << "seq stages:"s << endl;
+    profiler.Print(cout);
+    profiler.Reset();
+    for (const string& query : queries) {
+        search_server.FindTopDocuments(query);
+    }
+    cout << "auto stages:"s << endl;
+    profiler.Print(cout);
+    search_server.SetStageProfiler(nullptr);
+
+    const auto short_queries = GenerateQueries(generator, dictionary, 1'000, 3);
+    {
+        LOG_DURATION("3 words, any"s);
+        size_t found = 0;
+        for (const string& query : short_queries) {
+            found += search_server.FindTopDocuments(execution::seq, query).size();
+        }
+        cout << found << endl;
+    }
+    {
+        LOG_DURATION("3 words, all"s);
+        size_t found = 0;
+        for (const string& query : short_queries) {
+            found += search_server.FindTopDocuments(execution::seq, query, QueryMode::ALL_WORDS).size();
+        }
+        cout << found << endl;
+    }
+    {
+        QueryLog query_log("benchmark.queries"s);
+        search_server.SetQueryLog(&query_log);
+        LOG_DURATION("3 words, any, logged"s);
+        size_t found = 0;
+        for (const string& query : short_queries) {
+            found += search_server.FindTopDocuments(execution::seq, query).size();
+        }
+        search_server.SetQueryLog(nullptr);
+        cout << found << endl;
+    }
+    cout << ReadQueryLog("benchmark.queries"s).size() << " queries logged"s << endl;
+    remove("benchmark.queries");
+
+    QueryStats stats;
+    search_server.FindTopDocuments(short_queries.front(), stats);
+    cout << "query \""s << short_queries.front() << "\", explained as "s << search_server.Explain(short_queries.front()).plan << ":"s << endl;
+    cout << stats;
+
+    const size_t raw_text_bytes = search_server.GetDocumentStoreMemoryUsage();
+    search_server.SetDocumentStorage(DocumentStorage::TERM_IDS);
+    cout << "document store: "s << raw_text_bytes << " bytes as text, "s
+        << search_server.GetDocumentStoreMemoryUsage() << " bytes as term IDs"s << endl;
+    {
+        SearchServer logged_server(dictionary[0]);
+        const vector<string> texts = { dictionary[1] + "  "s + dictionary[0] + " "s + dictionary[2],
+            " "s + dictionary[3] + " "s + dictionary[0] + "   "s + dictionary[4] + " "s };
+        {
+            WriteAheadLog wal("benchmark.wal"s);
+            logged_server.SetWriteAheadLog(&wal);
+            logged_server.AddDocument(0, texts[0], DocumentStatus::ACTUAL, { 1, 2, 3 });
+            wal.Checkpoint(logged_server);
+            logged_server.AddDocument(1, texts[1], DocumentStatus::ACTUAL, { 1, 2, 3 });
+            wal.Sync();
+            logged_server.SetWriteAheadLog(nullptr);
+        }
+        SearchServer recovered_server(dictionary[0]);
+        WriteAheadLog("benchmark.wal"s).Recover(recovered_server);
+        remove("benchmark.wal");
+        remove("benchmark.wal.snapshot");
+        const bool same_texts = recovered_server.GetDocumentStorage() == DocumentStorage::RAW_TEXT
+            && recovered_server.GetDocumentText(0) == texts[0] && recovered_server.GetDocumentText(1) == texts[1];
+        cout << "raw texts "s << (same_texts ? "kept"s : "lost"s) << " across a checkpoint"s << endl;
+    }
+
+    cout << search_server.GetMemoryStats();
+    vector<vector<Document>> double_results;
+    for (const string& query : short_queries) {
+        double_results.push_back(search_server.FindTopDocuments(query));
+    }
+    for (const TermFreqPrecision precision : { TermFreqPrecision::FLOAT, TermFreqPrecision::QUANTIZED_16 }) {
+        search_server.SetTermFreqPrecision(precision);
+        size_t reordered = 0;
+        double max_relative_error = 0;
+        for (size_t i = 0; i < short_queries.size(); ++i) {
+            const vector<Document> result = search_server.FindTopDocuments(short_queries[i]);
+            bool same_order = result.size() == double_results[i].size();
+            for (size_t j = 0; same_order && j < result.size(); ++j) {
+                same_order = result[j].id == double_results[i][j].id;
+                max_relative_error = max(max_relative_error, abs(result[j].relevance / double_results[i][j].relevance - 1));
+            }
+            reordered += !same_order;
+        }
+        const MemoryStats stats = search_server.GetMemoryStats();
+        cout << (precision == TermFreqPrecision::FLOAT ? "float"s : "16 bit"s) << " frequencies: index "s << stats.inverted_index
+            << " bytes, forward index "s << stats.forward_index << " bytes, "s << reordered << " of "s << short_queries.size()
+            << " results reordered, relevance off by "s << max_relative_error << " at most"s << endl;
+    }
+
+    // small indexes, on their own and in a host
+    const auto tenant_documents = GenerateQueries(generator, dictionary, 10'000, 20);
+    {
+        LOG_DURATION("1000 servers of 10 documents"s);
+        vector<unique_ptr<SearchServer>> servers;
+        size_t bytes = 0;
+        for (size_t i = 0; i < tenant_documents.size(); ++i) {
+            if (i % 10 == 0) {
+                servers.push_back(make_unique<SearchServer>(dictionary[0]));
+            }
+            servers.back()->AddDocument(i % 10, tenant_documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        for (const auto& server : servers) {
+            bytes += server->GetMemoryStats().GetTotal() + sizeof(SearchServer);
+        }
+        cout << bytes / servers.size() << " bytes per server"s << endl;
+    }
+    {
+        LOG_DURATION("1000 tenants of 10 documents"s);
+        TenantHost host(dictionary[0]);
+        host.AddTenant("empty"s);
+        const size_t empty_bytes = host.GetTenantMemoryUsage("empty"s);
+        size_t bytes = 0;
+        for (size_t i = 0; i < tenant_documents.size(); ++i) {
+            const string tenant_id = "tenant"s + to_string(i / 10);
+            SearchServer& tenant = i % 10 == 0 ? host.AddTenant(tenant_id) : host.GetTenant(tenant_id);
+            tenant.AddDocument(i % 10, tenant_documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        host.RemoveTenant("empty"s);
+        for (const string& tenant_id : host.GetTenantIds()) {
+            bytes += host.GetTenantMemoryUsage(tenant_id);
+        }
+        cout << empty_bytes << " bytes per empty tenant, "s << bytes / host.GetTenantCount() << " bytes per tenant, "s
+            << host.GetSharedMemoryUsage() << " bytes shared"s << endl;
+    }
 
     return 0;
 }
@@ -0,0 +1,22 @@
+#include "memory_stats.h"
+
+size_t MemoryStats::GetTotal() const
+{
+    return term_dictionary + inverted_index + positions + forward_index + documents
+        + document_texts + document_ids + ordinal_tables + champion_lists + fuzzy_index;
+}
+
+std::ostream& operator<<(std::ostream& os, const MemoryStats& stats)
+{
+    return os << "term dictionary: " << stats.term_dictionary << '\n'
+        << "inverted index: " << stats.inverted_index << '\n'
+        << "positions: " << stats.positions << '\n'
+        << "forward index: " << stats.forward_index << '\n'
+        << "documents: " << stats.documents << '\n'
+        << "document texts: " << stats.document_texts << '\n'
+        << "document ids: " << stats.document_ids << '\n'
+        << "ordinal tables: " << stats.ordinal_tables << '\n'
+        << "champion lists: " << stats.champion_lists << '\n'
+        << "fuzzy index: " << stats.fuzzy_index << '\n'
+        << "total: " << stats.GetTotal() << " bytes\n";
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Heap bytes a block of size bytes takes with glibc malloc: an 8 byte header, rounded up
+// to 16 bytes and at least 32. Sizes this side of the mmap threshold are all that matter here.
+inline size_t HeapBlockBytes(size_t size)
+{
+    if (size == 0)
+        return 0;
+    return std::max<size_t>(32, (size + 8 + 15) & ~size_t{ 15 });
+}
+
+template <typename T>
+size_t HeapBytes(const std::vector<T>& values)
+{
+    return HeapBlockBytes(values.capacity() * sizeof(T));
+}
+
+inline size_t HeapBytes(const std::vector<bool>& values)
+{
+    return HeapBlockBytes((values.capacity() + 63) / 64 * sizeof(uint64_t));
+}
+
+// Short strings live inside the std::string itself
+inline size_t HeapBytes(const std::string& text)
+{
+    return text.capacity() > std::string().capacity() ? HeapBlockBytes(text.capacity() + 1) : 0;
+}
+
+// Nodes of a std::map: colour, parent and two children ahead of the value
+template <typename Key, typename Value, typename Compare>
+size_t HeapBytes(const std::map<Key, Value, Compare>& map)
+{
+    return map.size() * HeapBlockBytes(4 * sizeof(void*) + sizeof(std::pair<const Key, Value>));
+}
+
+template <typename Compare>
+size_t HeapBytes(const std::set<std::string, Compare>& words)
+{
+    size_t result = words.size() * HeapBlockBytes(4 * sizeof(void*) + sizeof(std::string));
+    for (const std::string& word : words)
+        result += HeapBytes(word);
+    return result;
+}
+
+// Nodes of a std::unordered_map with a key whose hash is not cached, and the bucket array
+template <typename Key, typename Value>
+size_t HeapBytes(const std::unordered_map<Key, Value>& map)
+{
+    return map.size() * HeapBlockBytes(sizeof(void*) + sizeof(std::pair<const Key, Value>))
+        + HeapBlockBytes(map.bucket_count() * sizeof(void*));
+}
+
+// Heap bytes held by each part of a SearchServer, allocator overhead included. Counts what
+// the containers have allocated, used or not, and not the SearchServer object itself.
+struct MemoryStats
+{
+    size_t term_dictionary = 0;     // words and their lookup tables
+    size_t inverted_index = 0;      // postings of every segment: ordinals, frequencies, impacts
+    size_t positions = 0;           // of the positional index
+    size_t forward_index = 0;       // term IDs and frequencies per document
+    size_t documents = 0;           // document entries, without their texts
+    size_t document_texts = 0;
+    size_t document_ids = 0;
+    size_t ordinal_tables = 0;      // document slots and lengths by ordinal, document frequencies by term
+    size_t champion_lists = 0;
+    size_t fuzzy_index = 0;
+
+    size_t GetTotal() const;
+};
+
+std::ostream& operator<<(std::ostream& os, const MemoryStats& stats);
\ No newline at end of file
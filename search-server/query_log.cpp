@@ -0,0 +1,235 @@
+#include "query_log.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include "varint.h"
+
+using namespace std::string_literals;
+
+// The file is the "SSQRYLOG" magic followed by records, each a varint payload size and the payload:
+// u8 search | u8 mode | u8 status, NO_STATUS for a custom predicate | varint time ns | varint latency ns
+// | varint result count | u64 result hash | u8 is complete | varint query size | query, then for BUDGETED:
+// varint time budget ns, max postings and max documents, each plus one so that 0 stands for no limit,
+// and for QUEUED: u8 priority | u8 decision. Fixed size integers are little endian.
+namespace
+{
+    const std::string_view LOG_MAGIC = "SSQRYLOG";
+    const unsigned char NO_STATUS = 0xFF;
+
+    void AppendFixed64(std::string& out, uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+
+    uint64_t ReadFixed64(std::string_view& in)
+    {
+        if (in.size() < 8)
+            throw std::out_of_range("Truncated integer"s);
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i)
+            value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+        in.remove_prefix(8);
+        return value;
+    }
+
+    unsigned char ReadByte(std::string_view& in)
+    {
+        if (in.empty())
+            throw std::out_of_range("Truncated record"s);
+        const auto byte = static_cast<unsigned char>(in.front());
+        in.remove_prefix(1);
+        return byte;
+    }
+
+    void AppendDuration(std::string& out, std::chrono::nanoseconds duration)
+    {
+        AppendVarint(out, static_cast<uint64_t>(std::max<int64_t>(0, duration.count())));
+    }
+
+    std::string EncodeQuery(const LoggedQuery& query)
+    {
+        std::string payload;
+        payload.push_back(static_cast<char>(query.search));
+        payload.push_back(static_cast<char>(query.mode));
+        payload.push_back(static_cast<char>(query.status ? static_cast<unsigned char>(*query.status) : NO_STATUS));
+        AppendDuration(payload, query.time);
+        AppendDuration(payload, query.latency);
+        AppendVarint(payload, query.result_count);
+        AppendFixed64(payload, query.result_hash);
+        payload.push_back(static_cast<char>(query.is_complete));
+        AppendVarint(payload, query.raw_query.size());
+        payload += query.raw_query;
+        if (query.search == LoggedSearch::BUDGETED)
+        {
+            AppendVarint(payload, query.time_budget ? static_cast<uint64_t>(query.time_budget->count()) + 1 : 0);
+            AppendVarint(payload, static_cast<uint64_t>(query.max_postings) + 1);
+            AppendVarint(payload, static_cast<uint64_t>(query.max_documents) + 1);
+        }
+        else if (query.search == LoggedSearch::QUEUED)
+        {
+            payload.push_back(static_cast<char>(query.priority));
+            payload.push_back(static_cast<char>(query.decision));
+        }
+        return payload;
+    }
+
+    LoggedQuery DecodeQuery(std::string_view payload)
+    {
+        LoggedQuery query;
+        query.search = static_cast<LoggedSearch>(ReadByte(payload));
+        query.mode = static_cast<QueryMode>(ReadByte(payload));
+        if (const unsigned char status = ReadByte(payload); status != NO_STATUS)
+            query.status = static_cast<DocumentStatus>(status);
+        query.time = std::chrono::nanoseconds(ReadVarint(payload));
+        query.latency = std::chrono::nanoseconds(ReadVarint(payload));
+        query.result_count = ReadVarint(payload);
+        query.result_hash = ReadFixed64(payload);
+        query.is_complete = ReadByte(payload) != 0;
+        const uint64_t query_size = ReadVarint(payload);
+        if (payload.size() < query_size)
+            throw std::out_of_range("Truncated query"s);
+        query.raw_query = std::string(payload.substr(0, query_size));
+        payload.remove_prefix(query_size);
+        if (query.search == LoggedSearch::BUDGETED)
+        {
+            if (const uint64_t time_budget = ReadVarint(payload); time_budget != 0)
+                query.time_budget = std::chrono::nanoseconds(time_budget - 1);
+            query.max_postings = static_cast<size_t>(ReadVarint(payload) - 1);
+            query.max_documents = static_cast<size_t>(ReadVarint(payload) - 1);
+        }
+        else if (query.search == LoggedSearch::QUEUED)
+        {
+            query.priority = static_cast<RequestPriority>(ReadByte(payload));
+            query.decision = static_cast<AdmissionDecision>(ReadByte(payload));
+        }
+        return query;
+    }
+}
+
+uint64_t HashResult(const std::vector<Document>& documents)
+{
+    // FNV-1a over the bytes of the ids
+    uint64_t hash = 0xCBF29CE484222325u;
+    for (const Document& document : documents)
+    {
+        const auto id = static_cast<uint32_t>(document.id);
+        for (int i = 0; i < 4; ++i)
+        {
+            hash ^= (id >> (8 * i)) & 0xFF;
+            hash *= 0x100000001B3u;
+        }
+    }
+    return hash;
+}
+
+QueryLog::QueryLog(const std::string& path, std::chrono::milliseconds flush_interval, size_t flush_bytes)
+    : start_(Clock::now()),
+    flush_interval_(flush_interval),
+    flush_bytes_(flush_bytes),
+    out_(path, std::ios::binary | std::ios::trunc)
+{
+    if (!out_ || !out_.write(LOG_MAGIC.data(), LOG_MAGIC.size()))
+        throw std::runtime_error("Cannot open query log "s + path);
+    writer_ = std::thread([this] { WriteLoop(); });
+}
+
+QueryLog::~QueryLog()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    flush_requested_.notify_one();
+    writer_.join();
+}
+
+void QueryLog::Record(const LoggedQuery& query)
+{
+    // encoded before taking the lock, so concurrent searches only contend on the append
+    const std::string payload = EncodeQuery(query);
+    std::lock_guard lock(mutex_);
+    AppendVarint(buffer_, payload.size());
+    buffer_ += payload;
+    ++record_count_;
+    if (buffer_.size() >= flush_bytes_)
+        flush_requested_.notify_one();
+}
+
+void QueryLog::Flush()
+{
+    std::unique_lock lock(mutex_);
+    const size_t record_count = record_count_;
+    flush_wanted_ = true;
+    flush_requested_.notify_one();
+    flushed_.wait(lock, [this, record_count] { return written_count_ >= record_count || failed_; });
+    if (failed_)
+        throw std::runtime_error("Query log write failed"s);
+}
+
+size_t QueryLog::GetRecordCount() const
+{
+    std::lock_guard lock(mutex_);
+    return record_count_;
+}
+
+void QueryLog::WriteLoop()
+{
+    std::unique_lock lock(mutex_);
+    while (true)
+    {
+        flush_requested_.wait_for(lock, flush_interval_,
+            [this] { return stop_ || flush_wanted_ || buffer_.size() >= flush_bytes_; });
+        if (buffer_.empty())
+        {
+            flush_wanted_ = false;
+            flushed_.notify_all();
+            if (stop_)
+                break;
+            continue;
+        }
+
+        std::string batch;
+        batch.swap(buffer_);
+        const size_t batch_count = record_count_;
+        flush_wanted_ = false;
+
+        lock.unlock();
+        const bool written = !failed_ && out_.write(batch.data(), batch.size()) && out_.flush();
+        lock.lock();
+
+        failed_ = failed_ || !written;
+        written_count_ = batch_count;
+        flushed_.notify_all();
+    }
+}
+
+std::vector<LoggedQuery> ReadQueryLog(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    const std::string data{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+    std::string_view view = data;
+    if (view.substr(0, LOG_MAGIC.size()) != LOG_MAGIC)
+        throw std::invalid_argument("Not a query log: "s + path);
+    view.remove_prefix(LOG_MAGIC.size());
+
+    std::vector<LoggedQuery> queries;
+    try
+    {
+        while (!view.empty())
+        {
+            const uint64_t size = ReadVarint(view);
+            if (view.size() < size)
+                break;
+            queries.push_back(DecodeQuery(view.substr(0, size)));
+            view.remove_prefix(size);
+        }
+    }
+    catch (const std::out_of_range&)
+    {
+        // torn last record
+    }
+    return queries;
+}
\ No newline at end of file
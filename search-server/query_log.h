@@ -0,0 +1,120 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "admission.h"
+#include "document.h"
+#include "query_planner.h"
+
+// How a logged query was searched
+enum class LoggedSearch
+{
+    SEQUENTIAL,     // FindTopDocuments with std::execution::seq
+    PARALLEL,       // FindTopDocuments with std::execution::par
+    PLANNED,        // FindTopDocuments without a policy
+    BUDGETED,       // FindTopDocuments with a SearchBudget
+    QUEUED,         // RequestQueue::Submit
+};
+
+struct LoggedQuery
+{
+    std::chrono::nanoseconds time{};            // start, since the log was opened
+    std::chrono::nanoseconds latency{};         // of the search; for QUEUED from submission to result
+    LoggedSearch search = LoggedSearch::PLANNED;
+    QueryMode mode = QueryMode::ANY_WORD;
+    std::optional<DocumentStatus> status;       // empty when a custom predicate picked the documents
+    std::string raw_query;
+    size_t result_count = 0;
+    uint64_t result_hash = 0;                   // HashResult of the documents found
+    bool is_complete = true;                    // false for a bounded search that ran out, or a rejected request
+
+    // BUDGETED only: the budget, its deadline as the time left at the start
+    std::optional<std::chrono::nanoseconds> time_budget;
+    size_t max_postings = std::numeric_limits<size_t>::max();
+    size_t max_documents = std::numeric_limits<size_t>::max();
+
+    // QUEUED only
+    RequestPriority priority = RequestPriority::NORMAL;
+    AdmissionDecision decision = AdmissionDecision::ACCEPTED;
+};
+
+// Status a document predicate searches for, if it is a StatusFilter
+template <typename DocumentPredicate>
+std::optional<DocumentStatus> GetFilteredStatus(const DocumentPredicate& document_predicate)
+{
+    if constexpr (std::is_same_v<DocumentPredicate, StatusFilter>)
+        return document_predicate.status;
+    else
+        return std::nullopt;
+}
+
+// Hash of the document ids of a result in order, which is what the log keeps of it
+uint64_t HashResult(const std::vector<Document>& documents);
+
+// Binary log of searches for capacity testing, see tools/query_replay.cpp.
+//
+// Record() only encodes the query into a buffer under a short lock; a background
+// thread writes the buffer when it reaches flush_bytes and every flush_interval.
+// Nothing is fsynced: a crash loses the tail, and ReadQueryLog drops a torn record.
+//
+//   QueryLog query_log("queries.log");
+//   server.SetQueryLog(&query_log);
+class QueryLog
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Truncates the file at path
+    explicit QueryLog(const std::string& path, std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000),
+        size_t flush_bytes = 1 << 20);
+
+    QueryLog(const QueryLog&) = delete;
+    QueryLog& operator=(const QueryLog&) = delete;
+
+    // Writes the records still buffered
+    ~QueryLog();
+
+    // Record times count from here
+    Clock::time_point GetStartTime() const { return start_; }
+
+    // Thread safe
+    void Record(const LoggedQuery& query);
+
+    // Blocks until every record so far is written; throws runtime_error if writing failed
+    void Flush();
+
+    size_t GetRecordCount() const;
+
+private:
+    const Clock::time_point start_;
+    const std::chrono::milliseconds flush_interval_;
+    const size_t flush_bytes_;
+    std::ofstream out_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable flush_requested_;
+    std::condition_variable flushed_;
+    std::string buffer_;            // encoded records not yet handed to the writer
+    size_t record_count_ = 0;
+    size_t written_count_ = 0;      // records the writer has written
+    bool flush_wanted_ = false;
+    bool stop_ = false;
+    bool failed_ = false;
+    std::thread writer_;
+
+    void WriteLoop();
+};
+
+// Records of the log at path in the order they were recorded. A torn last record is
+// dropped; throws invalid_argument if the file is not a query log.
+std::vector<LoggedQuery> ReadQueryLog(const std::string& path);
\ No newline at end of file
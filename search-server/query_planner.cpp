@@ -0,0 +1,227 @@
+#include "query_planner.h"
+#include "scoring_kernels.h"
+#include "segmented_index.h"
+#include "sorted_intersection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <execution>
+#include <limits>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const size_t CALIBRATION_POSTINGS = 1 << 14;
+    const size_t CALIBRATION_ORDINALS = 1 << 16;
+    const int CALIBRATION_ROUNDS = 5;
+    // PRUNED has to save this share of a sequential posting, smaller differences are noise
+    const double PRUNED_MIN_POSTING_SAVING = 0.25;
+    const size_t CALIBRATION_TIER_POSTINGS = CALIBRATION_POSTINGS / 16;
+    // the champion tier may cost at most this share of the sequential search it would replace
+    const double CHAMPION_MAX_COST_SHARE = 0.5;
+
+    // Best of several runs, in nanoseconds
+    template <typename Function>
+    double MeasureNs(Function function)
+    {
+        double best = std::numeric_limits<double>::max();
+        for (int round = 0; round < CALIBRATION_ROUNDS; ++round)
+        {
+            const auto start = Clock::now();
+            function();
+            best = std::min(best, std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+        }
+        return best;
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, QueryPlan plan)
+{
+    switch (plan)
+    {
+    case QueryPlan::SEQUENTIAL:
+        return os << "sequential";
+    case QueryPlan::PARALLEL:
+        return os << "parallel";
+    case QueryPlan::PRUNED:
+        return os << "pruned";
+    case QueryPlan::CONJUNCTIVE:
+        return os << "conjunctive";
+    case QueryPlan::IMPACT:
+        return os << "impact";
+    }
+    return os;
+}
+
+QueryPlannerThresholds CalibrateQueryPlanner()
+{
+    std::mt19937 generator;
+    std::vector<uint32_t> ordinals(CALIBRATION_POSTINGS);
+    for (uint32_t& ordinal : ordinals)
+        ordinal = std::uniform_int_distribution<uint32_t>(0, CALIBRATION_ORDINALS - 1)(generator);
+    std::sort(ordinals.begin(), ordinals.end());
+    TermFreqArray term_freqs;
+    for (size_t i = 0; i < CALIBRATION_POSTINGS; ++i)
+        term_freqs.push_back(0.5);
+    volatile double sink = 0;
+
+    // SEQUENTIAL adds postings into a float array with the kernels; when the array is dense
+    // it also scans and resets every ordinal
+    std::vector<float> accumulator(CALIBRATION_ORDINALS);
+    const double sequential_posting_ns = MeasureNs([&]
+        {
+            AccumulateTfIdf(ordinals.data(), term_freqs.GetView(), ordinals.size(), 1.0f, accumulator.data());
+            sink = sink + accumulator[ordinals.front()];
+        }) / CALIBRATION_POSTINGS;
+    const double sequential_ordinal_ns = MeasureNs([&]
+        {
+            sink = sink + FindAbove(accumulator.data(), 0, accumulator.size(), std::numeric_limits<float>::max());
+            std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+        }) / CALIBRATION_ORDINALS;
+
+    // PARALLEL accumulates into a map, split over the threads
+    const double map_posting_ns = MeasureNs([&]
+        {
+            std::map<int, double> relevance;
+            for (const uint32_t ordinal : ordinals)
+                relevance[ordinal] += 1.0;
+            sink = sink + relevance.size();
+        }) / CALIBRATION_POSTINGS;
+
+    // PRUNED pays per posting, checking the state of the document, and per ordinal of its arrays
+    std::vector<double> pruned_relevance(CALIBRATION_ORDINALS);
+    std::vector<uint8_t> pruned_state(CALIBRATION_ORDINALS);
+    const double pruned_posting_ns = MeasureNs([&]
+        {
+            for (const uint32_t ordinal : ordinals)
+            {
+                if (pruned_state[ordinal] == 0)
+                    pruned_relevance[ordinal] += 0.5;
+            }
+            sink = sink + pruned_relevance[ordinals.front()];
+        }) / CALIBRATION_POSTINGS;
+    const double pruned_ordinal_ns = MeasureNs([&]
+        {
+            std::vector<double> relevance(CALIBRATION_ORDINALS);
+            std::vector<uint8_t> state(CALIBRATION_ORDINALS);
+            sink = sink + *std::max_element(relevance.begin(), relevance.end()) + state.back();
+        }) / CALIBRATION_ORDINALS;
+
+    // PARALLEL pays for starting a parallel loop and gets at best half the time with two terms
+    const double parallel_overhead_ns = MeasureNs([&]
+        {
+            std::vector<int> items(2);
+            std::for_each(std::execution::par, items.begin(), items.end(), [&](int& item) { item = 1; });
+        });
+
+    // The champion tier pays per posting for sorting its candidates by ordinal and seeking
+    // the cursors of the full lists to each of them
+    std::vector<std::pair<uint32_t, double>> candidates;
+    const double tier_posting_ns = MeasureNs([&]
+        {
+            candidates.clear();
+            for (size_t i = 0; i < CALIBRATION_TIER_POSTINGS; ++i)
+                candidates.emplace_back(ordinals[i * 7919 % CALIBRATION_POSTINGS], 0.5);
+            std::sort(candidates.begin(), candidates.end());
+            auto position = ordinals.cbegin();
+            for (auto& [ordinal, relevance] : candidates)
+            {
+                position = GallopTo(position, ordinals.cend(), ordinal);
+                relevance += term_freqs[position - ordinals.cbegin()];
+            }
+            sink = sink + candidates.back().second;
+        }) / CALIBRATION_TIER_POSTINGS;
+
+    // SEQUENTIAL marks the documents of each required word in turn and resets the marks;
+    // CONJUNCTIVE seeks the cursors of the other words to the ordinals of the rarest one
+    std::vector<uint32_t> required_counts(CALIBRATION_ORDINALS);
+    const double required_posting_ns = MeasureNs([&]
+        {
+            for (const uint32_t ordinal : ordinals)
+            {
+                if (required_counts[ordinal] == 0)
+                    required_counts[ordinal] = 1;
+            }
+            sink = sink + required_counts[ordinals.front()];
+            for (const uint32_t ordinal : ordinals)
+                required_counts[ordinal] = 0;
+        }) / CALIBRATION_POSTINGS;
+    std::vector<uint32_t> other_ordinals(CALIBRATION_POSTINGS);
+    for (uint32_t& ordinal : other_ordinals)
+        ordinal = std::uniform_int_distribution<uint32_t>(0, CALIBRATION_ORDINALS - 1)(generator);
+    std::sort(other_ordinals.begin(), other_ordinals.end());
+    size_t seeks = 0;
+    const double intersection_ns = MeasureNs([&]
+        {
+            std::vector<PostingCursor> cursors;
+            cursors.emplace_back(std::vector<PostingSpan>{ PostingSpan{ ordinals.data(), {}, ordinals.size() } });
+            cursors.emplace_back(std::vector<PostingSpan>{ PostingSpan{ other_ordinals.data(), {}, other_ordinals.size() } });
+            seeks = 0;
+            sink = sink + IntersectPostings(std::move(cursors), &seeks).size();
+        });
+
+    QueryPlannerThresholds thresholds;
+    if (std::thread::hardware_concurrency() > 1 && sequential_posting_ns > map_posting_ns / 2)
+        thresholds.parallel_min_postings = static_cast<size_t>(parallel_overhead_ns / (sequential_posting_ns - map_posting_ns / 2)) + 1;
+    if (sequential_posting_ns - pruned_posting_ns > PRUNED_MIN_POSTING_SAVING * sequential_posting_ns)
+    {
+        // below 1 / DENSE_SCAN_DIVISOR postings per ordinal SEQUENTIAL has no per ordinal cost
+        const double saved_posting_ns = sequential_posting_ns - pruned_posting_ns;
+        const double sparse_ratio = pruned_ordinal_ns / saved_posting_ns;
+        thresholds.pruned_min_postings_ratio = sparse_ratio < 1.0 / DENSE_SCAN_DIVISOR ? sparse_ratio
+            : std::max(1.0 / DENSE_SCAN_DIVISOR, (pruned_ordinal_ns - sequential_ordinal_ns) / saved_posting_ns);
+    }
+    thresholds.champion_max_postings_ratio = CHAMPION_MAX_COST_SHARE * sequential_posting_ns / tier_posting_ns;
+    thresholds.sequential_posting_ns = sequential_posting_ns;
+    thresholds.sequential_ordinal_ns = sequential_ordinal_ns;
+    thresholds.required_posting_ns = required_posting_ns;
+    thresholds.intersection_seek_ns = intersection_ns / std::max<size_t>(seeks, 1);
+    return thresholds;
+}
+
+const QueryPlannerThresholds& GetCalibratedQueryPlannerThresholds()
+{
+    static const QueryPlannerThresholds thresholds = CalibrateQueryPlanner();
+    return thresholds;
+}
+
+QueryPlan ChooseQueryPlan(const QueryCost& cost, const QueryPlannerThresholds& thresholds)
+{
+    // PRUNED wins once what it saves per posting pays for its arrays
+    if (thresholds.pruned_min_postings_ratio > 0 && cost.ordinal_count > 0
+        && cost.plus_postings >= thresholds.pruned_min_postings_ratio * cost.ordinal_count)
+        return QueryPlan::PRUNED;
+    if (thresholds.parallel_min_postings > 0 && cost.plus_terms > 1
+        && cost.plus_postings + cost.minus_postings >= thresholds.parallel_min_postings)
+        return QueryPlan::PARALLEL;
+    return QueryPlan::SEQUENTIAL;
+}
+
+double EstimateSequentialNs(const QueryCost& cost, const QueryPlannerThresholds& thresholds)
+{
+    if (thresholds.sequential_posting_ns == 0)
+        return std::numeric_limits<double>::infinity();
+    double ns = thresholds.sequential_posting_ns * (cost.plus_postings + cost.minus_postings);
+    if (cost.plus_postings * DENSE_SCAN_DIVISOR >= cost.ordinal_count)
+        ns += thresholds.sequential_ordinal_ns * cost.ordinal_count;
+    return ns;
+}
+
+bool ShouldIntersect(const QueryCost& cost, const QueryPlannerThresholds& thresholds)
+{
+    // the seeks that score the surviving documents are left out, as there are few of them
+    return thresholds.intersection_seek_ns * cost.intersection_seeks
+        <= EstimateSequentialNs(cost, thresholds) + thresholds.required_posting_ns * cost.required_postings;
+}
+
+bool ShouldTryChampionTier(const QueryCost& cost, const QueryPlannerThresholds& thresholds)
+{
+    // the sequential cost per ordinal is left out, which only errs towards skipping the tier
+    return cost.tier_postings > 0 && cost.tier_postings <= thresholds.champion_max_postings_ratio * cost.plus_postings;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <iostream>
+
+// Which plus words of a query a document must contain
+enum class QueryMode
+{
+    ANY_WORD,   // at least one, and every word written as "+word"
+    ALL_WORDS,  // every one
+};
+
+// A sequential search scans every ordinal of its relevance array from 1 / this many postings
+// per ordinal on, below that only the ordinals of its postings
+const size_t DENSE_SCAN_DIVISOR = 16;
+
+// How FindTopDocuments evaluates a query when the caller passes no execution policy
+enum class QueryPlan
+{
+    SEQUENTIAL,     // one thread, float relevance array scored by the SIMD kernels
+    PARALLEL,       // query terms spread over threads
+    PRUNED,         // dense relevance array, documents that cannot reach the top are dropped early
+    CONJUNCTIVE,    // the query has required words: their postings are intersected, survivors scored
+    IMPACT,         // quantized posting scores summed as integers, see SearchServer::SetImpactScoring
+};
+
+std::ostream& operator<<(std::ostream& os, QueryPlan plan);
+
+// What a query would read, known before any posting is touched
+struct QueryCost
+{
+    size_t plus_postings = 0;
+    size_t minus_postings = 0;
+    size_t plus_terms = 0;          // terms scored separately, a pattern counts once
+    size_t ordinal_count = 0;       // size of a dense relevance array
+    size_t tier_postings = 0;       // champion lists of the tiered plus terms and full lists of the others, 0 without a tiered term
+    size_t required_postings = 0;   // postings of the required words
+    size_t intersection_seeks = 0;  // postings of the rarest required word times the required words
+};
+
+struct QueryPlannerThresholds
+{
+    size_t parallel_min_postings = 0;       // PARALLEL from this many plus postings on, 0 disables it
+    double pruned_min_postings_ratio = 0;   // PRUNED once plus postings reach this share of ordinals, 0 disables it
+    double champion_max_postings_ratio = 0; // champion tier tried up to this share of plus postings, 0 disables it
+    double sequential_posting_ns = 0;       // one posting on the SEQUENTIAL plan, 0 keeps bounded searches interruptible
+    double sequential_ordinal_ns = 0;       // one ordinal scanned and reset by a dense SEQUENTIAL search
+    double required_posting_ns = 0;         // one posting of a required word marked and reset by a SEQUENTIAL search
+    double intersection_seek_ns = 0;        // one cursor seek of a CONJUNCTIVE intersection, 0 always intersects
+};
+
+// Measures the costs the plans differ in on synthetic data and derives the
+// thresholds from them. Takes a few milliseconds.
+QueryPlannerThresholds CalibrateQueryPlanner();
+
+// Result of CalibrateQueryPlanner computed once per process
+const QueryPlannerThresholds& GetCalibratedQueryPlannerThresholds();
+
+QueryPlan ChooseQueryPlan(const QueryCost& cost, const QueryPlannerThresholds& thresholds);
+
+// Expected time of the SEQUENTIAL plan, infinite without a measured posting time
+double EstimateSequentialNs(const QueryCost& cost, const QueryPlannerThresholds& thresholds);
+
+// Whether a query with required words is cheaper to intersect than to search sequentially,
+// scoring every plus posting and keeping the documents marked by all the required words
+bool ShouldIntersect(const QueryCost& cost, const QueryPlannerThresholds& thresholds);
+
+// Whether the champion tier should be tried before the plan. A tier that cannot prove the top
+// leaves the plan to run after it, so it is tried only while it costs a fraction of a
+// sequential search.
+bool ShouldTryChampionTier(const QueryCost& cost, const QueryPlannerThresholds& thresholds);
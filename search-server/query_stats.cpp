@@ -0,0 +1,38 @@
+#include "query_stats.h"
+
+#include <iomanip>
+
+namespace
+{
+    void PrintTerms(std::ostream& os, const char* name, const std::vector<std::string_view>& terms, const std::vector<size_t>& posting_lengths)
+    {
+        os << name << ':';
+        for (size_t i = 0; i < terms.size(); ++i)
+        {
+            os << ' ' << terms[i];
+            if (i < posting_lengths.size())
+                os << " (" << posting_lengths[i] << ')';
+        }
+        os << '\n';
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, const QueryStats& stats)
+{
+    os << "plan: " << stats.plan << (stats.champion_tier ? ", answered by champion lists" : "") << '\n';
+    PrintTerms(os, "plus terms", stats.plus_terms, stats.plus_posting_lengths);
+    PrintTerms(os, "minus terms", stats.minus_terms, stats.minus_posting_lengths);
+    os << "postings scanned: " << stats.postings_scanned << '\n'
+        << "documents scored: " << stats.documents_scored << '\n'
+        << "filtered by predicate: " << stats.filtered_by_predicate << '\n'
+        << "removed by minus words: " << stats.removed_by_minus_words << '\n'
+        << "results: " << stats.result_count << '\n';
+    const auto flags = os.flags();
+    for (size_t i = 0; i < SEARCH_STAGE_COUNT; ++i)
+    {
+        os << static_cast<SearchStage>(i) << ": " << std::fixed << std::setprecision(3)
+            << std::chrono::duration<double, std::milli>(stats.stage_times[i]).count() << " ms\n";
+    }
+    os.flags(flags);
+    return os;
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "query_planner.h"
+#include "stage_profiler.h"
+
+// What one search did. Terms view the server's dictionary and stay valid until its next
+// modification. Explain fills only the plan, the terms and the posting lengths.
+struct QueryStats
+{
+    QueryPlan plan = QueryPlan::SEQUENTIAL;
+    bool champion_tier = false;                     // answered from the champion lists
+    std::vector<std::string_view> plus_terms;       // after pattern and fuzzy expansion
+    std::vector<std::string_view> minus_terms;
+    std::vector<size_t> plus_posting_lengths;       // per plus term, removed documents included
+    std::vector<size_t> minus_posting_lengths;
+    size_t postings_scanned = 0;                    // read, or sought to by an intersection
+    size_t documents_scored = 0;
+    size_t filtered_by_predicate = 0;               // postings whose document the predicate rejected
+    size_t removed_by_minus_words = 0;              // scored documents dropped for a minus word
+    size_t result_count = 0;
+    std::array<std::chrono::nanoseconds, SEARCH_STAGE_COUNT> stage_times{};
+};
+
+// Takes the place of QueryStats in searches that collect nothing; every update compiles away
+struct NoQueryStats {};
+
+template <typename Stats>
+inline constexpr bool COLLECTS_QUERY_STATS = std::is_same_v<Stats, QueryStats>;
+
+template <typename Stats>
+std::chrono::nanoseconds* GetStageTime(Stats& stats, SearchStage stage)
+{
+    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+        return &stats.stage_times[static_cast<size_t>(stage)];
+    else
+        return nullptr;
+}
+
+// Times a stage for the server's profiler and for stats
+#define PROFILE_QUERY_STAGE(profiler, stats, stage) PROFILE_STAGE(profiler, stage, GetStageTime(stats, stage))
+
+std::ostream& operator<<(std::ostream& os, const QueryStats& stats);
\ No newline at end of file
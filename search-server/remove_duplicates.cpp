@@ -23,12 +23,11 @@ void RemoveDuplicates(SearchServer& search_server)
 
 std::set<int> FindDuplicates(SearchServer& search_server, int id)
 {
-	std::map<std::string_view, double> current_words = search_server.GetWordFrequences(id);
+	const WordFrequencies current_words = search_server.GetWordFrequences(id);
 	std::set<int> duplicates {id};
 	for (const int it_id : search_server)
 	{
-		std::map<std::string_view, double> it_words = search_server.GetWordFrequences(it_id);
-		if (MapKeysEqual(current_words, it_words))
+		if (current_words.SameWords(search_server.GetWordFrequences(it_id)))
 		{
 			duplicates.insert(it_id);
 		}
@@ -36,17 +35,4 @@ std::set<int> FindDuplicates(SearchServer& search_server, int id)
 
 	duplicates.erase(duplicates.begin());
 	return duplicates;
-}
-
-bool MapKeysEqual(const std::map<std::string_view, double>& m1,
-	const std::map<std::string_view, double>& m2)
-{
-	if (m1.size() != m2.size())
-		return false;
-
-	for (const auto& [word, _] : m1)
-		if (m2.count(word) == 0)
-			return false;
-
-	return true;
 }
\ No newline at end of file
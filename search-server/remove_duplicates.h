@@ -3,7 +3,4 @@
 
 void RemoveDuplicates(SearchServer& search_server);
 
-std::set<int> FindDuplicates(SearchServer& search_server, int id);
-
-bool MapKeysEqual(const std::map<std::string_view, double>& m1,
-	const std::map<std::string_view, double>& m2);
\ No newline at end of file
+std::set<int> FindDuplicates(SearchServer& search_server, int id);
\ No newline at end of file
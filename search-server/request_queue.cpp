@@ -1,11 +1,73 @@
 #include "request_queue.h"
 
-RequestQueue::RequestQueue(const SearchServer& search_server)
-    : server(search_server) {}
+using namespace std::string_literals;
+
+namespace
+{
+// weight of the newest accepted request in the moving averages of the posting cost
+const double POSTING_COST_SMOOTHING = 0.05;
+}
+
+std::ostream& operator<<(std::ostream& os, const AdmissionStats& stats)
+{
+    return os << "{ accepted = "s << stats.accepted << ", degraded = "s << stats.degraded
+        << ", rejected = "s << stats.rejected << ", failed = "s << stats.failed << ", queued = "s << stats.queued
+        << ", posting cost = "s << stats.posting_cost.count() << " ns }"s;
+}
+
+std::ostream& operator<<(std::ostream& os, AdmissionDecision decision)
+{
+    switch (decision)
+    {
+    case AdmissionDecision::ACCEPTED:
+        return os << "accepted";
+    case AdmissionDecision::DEGRADED:
+        return os << "degraded";
+    case AdmissionDecision::REJECTED:
+        return os << "rejected";
+    }
+    return os;
+}
+
+RequestQueue::RequestQueue(const SearchServer& search_server, AdmissionOptions options)
+    : server(search_server), options_(options)
+{
+    size_t worker_count = options_.worker_count;
+    if (worker_count == 0)
+        worker_count = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+        workers_.emplace_back([this] { RunWorker(); });
+    }
+}
+
+RequestQueue::~RequestQueue()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    request_queued_.notify_all();
+    for (std::thread& worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+std::future<SearchResponse> RequestQueue::Submit(const std::string& raw_query, DocumentStatus status, RequestPriority priority)
+{
+    return Submit(raw_query, StatusFilter{ status }, priority);
+}
+
+std::future<SearchResponse> RequestQueue::Submit(const std::string& raw_query, RequestPriority priority)
+{
+    return Submit(raw_query, DocumentStatus::ACTUAL, priority);
+}
 
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentStatus status)
 {
     auto search_results = server.FindTopDocuments(raw_query, status);
+    std::lock_guard lock(mutex_);
     RegisterRequest(search_results.empty());
     return search_results;
 }
@@ -13,13 +75,201 @@ std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query,
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query)
 {
     auto search_results = server.FindTopDocuments(raw_query);
+    std::lock_guard lock(mutex_);
     RegisterRequest(search_results.empty());
     return search_results;
 }
 
 int RequestQueue::GetNoResultRequests() const
 {
-    return no_result_count_; 
+    std::lock_guard lock(mutex_);
+    return no_result_count_;
+}
+
+AdmissionStats RequestQueue::GetAdmissionStats() const
+{
+    std::lock_guard lock(mutex_);
+    AdmissionStats stats = stats_;
+    for (const std::deque<Request>& queue : queues_)
+    {
+        stats.queued += queue.size();
+    }
+    stats.posting_cost = GetPostingCost();
+    return stats;
+}
+
+std::future<SearchResponse> RequestQueue::Admit(const std::string& raw_query, DocumentFilter document_predicate,
+    std::optional<DocumentStatus> status, RequestPriority priority)
+{
+    // parsed outside the lock, which also reports invalid queries to the caller
+    const QueryCost cost = server.GetQueryCost(raw_query);
+    const Clock::time_point now = Clock::now();
+
+    Request request{ raw_query, std::move(document_predicate), status, priority, now, AdmissionDecision::ACCEPTED,
+        now + options_.latency_target, cost.plus_postings + cost.minus_postings, {}, {} };
+    std::future<SearchResponse> result = request.promise.get_future();
+
+    std::unique_lock lock(mutex_);
+    const size_t queue_index = static_cast<size_t>(priority);
+    std::chrono::nanoseconds work_ahead = running_time_;
+    for (size_t i = 0; i <= queue_index; ++i)
+    {
+        work_ahead += queued_time_[i];
+    }
+    const std::chrono::nanoseconds wait = work_ahead / workers_.size();
+    request.estimated_time = std::chrono::duration_cast<std::chrono::nanoseconds>(GetPostingCost() * request.postings);
+
+    if (queues_[queue_index].size() >= options_.max_queued_requests || wait >= options_.latency_target)
+    {
+        ++stats_.rejected;
+        lock.unlock();
+        const SearchResponse response{ {}, AdmissionDecision::REJECTED, false };
+        if (options_.query_log)
+            LogRequest(request, response);
+        request.promise.set_value(response);
+        return result;
+    }
+    if (wait + request.estimated_time > options_.latency_target)
+    {
+        // a degraded search stops at the deadline, so it takes at most the rest of the target
+        request.decision = AdmissionDecision::DEGRADED;
+        request.estimated_time = options_.latency_target - wait;
+    }
+    queued_time_[queue_index] += request.estimated_time;
+    queues_[queue_index].push_back(std::move(request));
+    lock.unlock();
+    request_queued_.notify_one();
+    return result;
+}
+
+void RequestQueue::RunWorker()
+{
+    std::unique_lock lock(mutex_);
+    while (true)
+    {
+        auto queue = std::find_if(queues_.begin(), queues_.end(), [](const std::deque<Request>& queue) { return !queue.empty(); });
+        if (queue == queues_.end())
+        {
+            if (stopping_)
+                return;
+            request_queued_.wait(lock);
+            continue;
+        }
+        Request request = std::move(queue->front());
+        queue->pop_front();
+        queued_time_[queue - queues_.begin()] -= request.estimated_time;
+        running_time_ += request.estimated_time;
+        lock.unlock();
+
+        // the estimates were off and the request has waited out its target
+        const Clock::time_point start = Clock::now();
+        if (start >= request.deadline)
+        {
+            request.decision = AdmissionDecision::REJECTED;
+        }
+        SearchResponse response{ {}, request.decision, false };
+        std::exception_ptr error;
+        try
+        {
+            if (request.decision != AdmissionDecision::REJECTED)
+                response = Run(request);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        const std::chrono::nanoseconds run_time = Clock::now() - start;
+
+        lock.lock();
+        running_time_ -= request.estimated_time;
+        // a failed search says nothing about the cost of a posting
+        if (error)
+        {
+            ++stats_.failed;
+        }
+        else
+        {
+            switch (response.decision)
+            {
+            case AdmissionDecision::ACCEPTED:
+                ++stats_.accepted;
+                if (measured_postings_ == 0)
+                {
+                    measured_time_ = static_cast<double>(run_time.count());
+                    measured_postings_ = static_cast<double>(request.postings);
+                }
+                else
+                {
+                    measured_time_ += (run_time.count() - measured_time_) * POSTING_COST_SMOOTHING;
+                    measured_postings_ += (request.postings - measured_postings_) * POSTING_COST_SMOOTHING;
+                }
+                break;
+            case AdmissionDecision::DEGRADED:
+                ++stats_.degraded;
+                break;
+            case AdmissionDecision::REJECTED:
+                ++stats_.rejected;
+                break;
+            }
+        }
+        lock.unlock();
+
+        if (error)
+        {
+            request.promise.set_exception(error);
+        }
+        else
+        {
+            if (options_.query_log)
+                LogRequest(request, response);
+            request.promise.set_value(std::move(response));
+        }
+        lock.lock();
+    }
+}
+
+SearchResponse RequestQueue::Run(const Request& request) const
+{
+    SearchResponse response;
+    response.decision = request.decision;
+    if (request.decision == AdmissionDecision::DEGRADED)
+    {
+        SearchBudget budget;
+        budget.deadline = request.deadline;
+        budget.max_documents = options_.degraded_document_count;
+        BoundedSearchResult result = server.FindTopDocuments(request.raw_query, budget, request.document_predicate);
+        response.documents = std::move(result.documents);
+        response.is_complete = result.is_complete;
+    }
+    else
+    {
+        response.documents = server.FindTopDocuments(request.raw_query, request.document_predicate);
+    }
+    return response;
+}
+
+void RequestQueue::LogRequest(const Request& request, const SearchResponse& response) const
+{
+    LoggedQuery query;
+    query.time = request.submitted - options_.query_log->GetStartTime();
+    query.latency = Clock::now() - request.submitted;
+    query.search = LoggedSearch::QUEUED;
+    query.status = request.status;
+    query.raw_query = request.raw_query;
+    query.result_count = response.documents.size();
+    query.result_hash = HashResult(response.documents);
+    query.is_complete = response.decision != AdmissionDecision::REJECTED && response.is_complete;
+    query.priority = request.priority;
+    query.decision = response.decision;
+    options_.query_log->Record(query);
+}
+
+PostingCost RequestQueue::GetPostingCost() const
+{
+    // averages of time and postings rather than of their ratio, which tiny queries would dominate
+    if (measured_postings_ < 1)
+        return options_.initial_posting_cost;
+    return PostingCost(measured_time_ / measured_postings_);
 }
 
 void RequestQueue::RegisterRequest(bool no_results)
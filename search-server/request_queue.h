@@ -1,37 +1,156 @@
 #pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <optional>
 #include <queue>
 #include <vector>
 #include <string>
+#include <thread>
+#include "admission.h"
 #include "search_server.h"
 
+// a posting takes a few nanoseconds, so whole ones are too coarse
+using PostingCost = std::chrono::duration<double, std::nano>;
+
+struct AdmissionOptions
+{
+    std::chrono::microseconds latency_target{ 100'000 };    // from submission to result
+    size_t worker_count = 0;                                // 0 for one per hardware thread
+    size_t max_queued_requests = 1024;                      // per priority
+    size_t degraded_document_count = 2;
+    PostingCost initial_posting_cost{ 5.0 };                // run time per posting until some are measured
+    QueryLog* query_log = nullptr;                          // records every request with its decision and latency
+};
+
+struct SearchResponse
+{
+    std::vector<Document> documents;
+    AdmissionDecision decision = AdmissionDecision::ACCEPTED;
+    bool is_complete = true;    // false when a degraded search ran out of time
+};
+
+struct AdmissionStats
+{
+    size_t accepted = 0;
+    size_t degraded = 0;
+    size_t rejected = 0;
+    size_t failed = 0;                          // admitted, but the search threw; in none of the above
+    size_t queued = 0;                          // waiting right now
+    PostingCost posting_cost{};                 // current estimate of the run time per posting
+};
+
+std::ostream& operator<<(std::ostream& os, const AdmissionStats& stats);
+
+// Admission-control front end of a server. Every request is priced before it is
+// queued: its postings, from the posting lengths, times the measured run time per
+// posting. If the estimated wait behind the requests of its priority or higher
+// plus its own run time fits the latency target it is accepted; if only the wait
+// fits it is degraded; otherwise, or when its queue is full, it is rejected at
+// once. A request still queued at its deadline is rejected when dequeued.
+//
+// Workers search the server concurrently, so it must not be modified while
+// requests are in flight. A query log goes to the queue or to its server, not
+// both, or every run request is logged twice.
 class RequestQueue {
 public:
-    explicit RequestQueue(const SearchServer& search_server);
+    explicit RequestQueue(const SearchServer& search_server, AdmissionOptions options = AdmissionOptions());
+
+    RequestQueue(const RequestQueue&) = delete;
+    RequestQueue& operator=(const RequestQueue&) = delete;
+
+    // Runs the requests still queued, then stops the workers
+    ~RequestQueue();
+
+    // Invalid queries throw here, search errors come out of the future
+    template <typename DocumentPredicate>
+    std::future<SearchResponse> Submit(const std::string& raw_query, DocumentPredicate document_predicate,
+        RequestPriority priority = RequestPriority::NORMAL);
 
+    std::future<SearchResponse> Submit(const std::string& raw_query, DocumentStatus status, RequestPriority priority = RequestPriority::NORMAL);
+    std::future<SearchResponse> Submit(const std::string& raw_query, RequestPriority priority = RequestPriority::NORMAL);
+
+    // Searches the server in the calling thread, bypassing admission, so the documents are
+    // always the complete answer; Submit is the way to have a request priced and scheduled
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
 
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status);
     std::vector<Document> AddFindRequest(const std::string& raw_query);
+
+    // AddFindRequest calls among the last 1440 that found no documents
     int GetNoResultRequests() const;
+
+    AdmissionStats GetAdmissionStats() const;
 private:
+    using Clock = std::chrono::steady_clock;
+    using DocumentFilter = std::function<bool(int, DocumentStatus, int)>;
+
     struct QueryResult
     {
         bool no_results;
     };
+
+    struct Request
+    {
+        std::string raw_query;
+        DocumentFilter document_predicate;
+        std::optional<DocumentStatus> status;   // of a StatusFilter predicate, for the query log
+        RequestPriority priority;
+        Clock::time_point submitted;
+        AdmissionDecision decision;
+        Clock::time_point deadline;
+        size_t postings;
+        std::chrono::nanoseconds estimated_time;
+        std::promise<SearchResponse> promise;
+    };
+
+    const SearchServer& server;
+    const AdmissionOptions options_;
+
+    mutable std::mutex mutex_;      // guards everything below
+    std::condition_variable request_queued_;
+    std::array<std::deque<Request>, REQUEST_PRIORITY_COUNT> queues_;
+    std::array<std::chrono::nanoseconds, REQUEST_PRIORITY_COUNT> queued_time_{};    // estimated, per priority
+    std::chrono::nanoseconds running_time_{};       // estimated, of the requests being run
+    double measured_time_ = 0;                      // moving averages over accepted requests, in ns
+    double measured_postings_ = 0;
+    AdmissionStats stats_;
+    bool stopping_ = false;
     std::deque<QueryResult> requests_;
     const static int min_in_day_ = 1440;
-    const SearchServer& server;
     int minute_count_ = 0;
     int no_result_count_ = 0;
 
+    std::vector<std::thread> workers_;
+
+    std::future<SearchResponse> Admit(const std::string& raw_query, DocumentFilter document_predicate,
+        std::optional<DocumentStatus> status, RequestPriority priority);
+    void RunWorker();
+    SearchResponse Run(const Request& request) const;
+    void LogRequest(const Request& request, const SearchResponse& response) const;
+    PostingCost GetPostingCost() const;
     void RegisterRequest(bool no_results);
 };
 
+template <typename DocumentPredicate>
+std::future<SearchResponse> RequestQueue::Submit(const std::string& raw_query, DocumentPredicate document_predicate,
+    RequestPriority priority)
+{
+    const std::optional<DocumentStatus> status = GetFilteredStatus(document_predicate);
+    return Admit(raw_query, DocumentFilter(std::move(document_predicate)), status, priority);
+}
+
 template <typename DocumentPredicate>
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate)
 {
     auto search_results = server.FindTopDocuments(raw_query, document_predicate);
+    std::lock_guard lock(mutex_);
     RegisterRequest(search_results.empty());
     return search_results;
 }
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "scoring_kernels.h"
+
+// How the relevance of a document to a query is computed
+enum class RelevanceModel
+{
+    TF_IDF,
+    BM25,
+};
+
+// What a scorer needs to know about the index, taken once per query
+struct CorpusStats
+{
+    size_t document_count = 0;              // live documents
+    double average_document_length = 0;     // indexed words per live document
+    const uint32_t* document_lengths = nullptr;     // indexed words, by ordinal
+};
+
+// Relevance models are policies of the search paths. The relevance of a document is
+// the sum over the query terms of GetTermWeight(document freq) * ScorePosting(ordinal,
+// term freq), and pruning relies on GetMaxPostingScore(term_freq) bounding ScorePosting
+// for any document whose frequency of the term is at most term_freq.
+// MAX_POSTING_SCORE bounds every posting score. AccumulatePostings adds the weighted
+// posting scores of a list to a dense accumulator with the float32 kernels.
+
+// log(N / df) times the share of the document's words that are the term
+class TfIdfScorer
+{
+public:
+    static constexpr double MAX_POSTING_SCORE = 1.0;
+
+    explicit TfIdfScorer(const CorpusStats& corpus)
+        : document_count_(corpus.document_count) {}
+
+    double GetTermWeight(size_t document_freq) const { return std::log(document_count_ * 1.0 / document_freq); }
+
+    double ScorePosting(uint32_t, double term_freq) const { return term_freq; }
+
+    double GetMaxPostingScore(double term_freq) const { return term_freq; }
+
+    void AccumulatePostings(const uint32_t* ordinals, TermFreqView term_freqs, size_t count, double term_weight, float* accumulator) const
+    {
+        AccumulateTfIdf(ordinals, term_freqs, count, static_cast<float>(term_weight), accumulator);
+    }
+
+    // Bound for the terms of one query word in one document; their frequencies sum to at most 1
+    double CapGroupScore(double posting_score_sum) const { return std::min(posting_score_sum, 1.0); }
+
+private:
+    size_t document_count_;
+};
+
+// Okapi BM25: repeated words saturate and long documents are normalized to the average length
+class Bm25Scorer
+{
+public:
+    static constexpr double K1 = 1.2;
+    static constexpr double B = 0.75;
+    static constexpr double MAX_POSTING_SCORE = K1 + 1;
+
+    explicit Bm25Scorer(const CorpusStats& corpus)
+        : document_count_(corpus.document_count),
+        average_document_length_(std::max(corpus.average_document_length, 1.0)),
+        document_lengths_(corpus.document_lengths) {}
+
+    double GetTermWeight(size_t document_freq) const
+    {
+        return std::log(1.0 + (document_count_ * 1.0 - document_freq + 0.5) / (document_freq + 0.5));
+    }
+
+    double ScorePosting(uint32_t ordinal, double term_freq) const
+    {
+        const double length = document_lengths_[ordinal];
+        const double count = term_freq * length;
+        return count * (K1 + 1) / (count + K1 * (1 - B + B * length / average_document_length_));
+    }
+
+    // count / length is term_freq, and the score grows with the length at a fixed share
+    double GetMaxPostingScore(double term_freq) const
+    {
+        return term_freq * (K1 + 1) / (term_freq + K1 * B / average_document_length_);
+    }
+
+    void AccumulatePostings(const uint32_t* ordinals, TermFreqView term_freqs, size_t count, double term_weight, float* accumulator) const
+    {
+        AccumulateBm25(ordinals, term_freqs, count, static_cast<float>(term_weight), document_lengths_,
+            static_cast<float>(K1), static_cast<float>(B), static_cast<float>(average_document_length_), accumulator);
+    }
+
+    double CapGroupScore(double posting_score_sum) const { return posting_score_sum; }
+
+private:
+    size_t document_count_;
+    double average_document_length_;
+    const uint32_t* document_lengths_;
+};
+
+// Posting scores stored in one byte on a log scale: level 255 is max_score and every
+// IMPACT_LEVELS_PER_OCTAVE levels below halve it, so the relative error stays under 2.2%
+const double IMPACT_LEVELS_PER_OCTAVE = 16;
+
+inline uint8_t QuantizeImpact(double score, double max_score)
+{
+    if (score <= 0)
+        return 0;
+    const double level = 255 + std::round(std::log2(score / max_score) * IMPACT_LEVELS_PER_OCTAVE);
+    return static_cast<uint8_t>(std::clamp(level, 1.0, 255.0));
+}
+
+inline double DequantizeImpact(uint8_t level, double max_score)
+{
+    return level == 0 ? 0.0 : max_score * std::exp2((level - 255) / IMPACT_LEVELS_PER_OCTAVE);
+}
\ No newline at end of file
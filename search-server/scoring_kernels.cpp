@@ -0,0 +1,342 @@
+#include "scoring_kernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCORING_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+using namespace std::string_literals;
+
+namespace
+{
+// postings scored into the buffer at a time
+const size_t BLOCK_SIZE = 256;
+
+// The length norm k1 (1 - b + b length / average) of BM25 as base + slope * length
+struct Bm25Params
+{
+    float k1_plus_one;
+    float norm_base;
+    float norm_slope;
+};
+
+void ScatterAdd(const uint32_t* ordinals, const float* scores, size_t count, float* accumulator)
+{
+    for (size_t i = 0; i < count; ++i)
+        accumulator[ordinals[i]] += scores[i];
+}
+
+// Frequencies [begin, end) of term_freqs as floats
+void LoadTermFreqsScalar(TermFreqView term_freqs, size_t begin, size_t end, float* out)
+{
+    for (size_t i = begin; i < end; ++i)
+        out[i] = static_cast<float>(term_freqs[i]);
+}
+
+void ScoreTfIdfScalar(TermFreqView term_freqs, size_t count, float term_weight, float* scores)
+{
+    LoadTermFreqsScalar(term_freqs, 0, count, scores);
+    for (size_t i = 0; i < count; ++i)
+        scores[i] *= term_weight;
+}
+
+float ScoreBm25Posting(float term_freq, float length, float term_weight, const Bm25Params& params)
+{
+    const float posting_count = term_freq * length;
+    return posting_count * params.k1_plus_one / (posting_count + (params.norm_base + params.norm_slope * length)) * term_weight;
+}
+
+void ScoreBm25Scalar(const uint32_t* ordinals, TermFreqView term_freqs, size_t count, float term_weight,
+    const uint32_t* document_lengths, const Bm25Params& params, float* scores)
+{
+    LoadTermFreqsScalar(term_freqs, 0, count, scores);
+    for (size_t i = 0; i < count; ++i)
+        scores[i] = ScoreBm25Posting(scores[i], static_cast<float>(document_lengths[ordinals[i]]), term_weight, params);
+}
+
+size_t FindAboveScalar(const float* values, size_t begin, size_t end, float threshold)
+{
+    while (begin < end && !(values[begin] > threshold))
+        ++begin;
+    return begin;
+}
+
+#ifdef SCORING_KERNELS_X86
+__attribute__((target("sse2")))
+void LoadTermFreqsSse2(TermFreqView term_freqs, size_t count, float* out)
+{
+    size_t i = 0;
+    if (term_freqs.GetPrecision() == TermFreqPrecision::FLOAT)
+    {
+        std::memcpy(out, term_freqs.GetData(), count * sizeof(float));
+        return;
+    }
+    if (term_freqs.GetPrecision() == TermFreqPrecision::DOUBLE)
+    {
+        const auto* data = reinterpret_cast<const double*>(term_freqs.GetData());
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(data + i));
+            const __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(data + i + 2));
+            _mm_storeu_ps(out + i, _mm_movelh_ps(low, high));
+        }
+    }
+    LoadTermFreqsScalar(term_freqs, i, count, out);
+}
+
+__attribute__((target("sse2")))
+void ScoreTfIdfSse2(TermFreqView term_freqs, size_t count, float term_weight, float* scores)
+{
+    LoadTermFreqsSse2(term_freqs, count, scores);
+    const __m128 weight = _mm_set1_ps(term_weight);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(scores + i, _mm_mul_ps(_mm_loadu_ps(scores + i), weight));
+    for (; i < count; ++i)
+        scores[i] *= term_weight;
+}
+
+__attribute__((target("sse2")))
+void ScoreBm25Sse2(const uint32_t* ordinals, TermFreqView term_freqs, size_t count, float term_weight,
+    const uint32_t* document_lengths, const Bm25Params& params, float* scores)
+{
+    LoadTermFreqsSse2(term_freqs, count, scores);
+    const __m128 weight = _mm_set1_ps(term_weight);
+    const __m128 k1_plus_one = _mm_set1_ps(params.k1_plus_one);
+    const __m128 norm_base = _mm_set1_ps(params.norm_base);
+    const __m128 norm_slope = _mm_set1_ps(params.norm_slope);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        // no gather before AVX2
+        const __m128 length = _mm_cvtepi32_ps(_mm_set_epi32(document_lengths[ordinals[i + 3]], document_lengths[ordinals[i + 2]],
+            document_lengths[ordinals[i + 1]], document_lengths[ordinals[i]]));
+        const __m128 posting_count = _mm_mul_ps(_mm_loadu_ps(scores + i), length);
+        const __m128 norm = _mm_add_ps(posting_count, _mm_add_ps(norm_base, _mm_mul_ps(norm_slope, length)));
+        _mm_storeu_ps(scores + i, _mm_mul_ps(_mm_div_ps(_mm_mul_ps(posting_count, k1_plus_one), norm), weight));
+    }
+    for (; i < count; ++i)
+        scores[i] = ScoreBm25Posting(scores[i], static_cast<float>(document_lengths[ordinals[i]]), term_weight, params);
+}
+
+__attribute__((target("sse2")))
+size_t FindAboveSse2(const float* values, size_t begin, size_t end, float threshold)
+{
+    const __m128 limit = _mm_set1_ps(threshold);
+    for (; begin + 4 <= end; begin += 4)
+    {
+        const int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(values + begin), limit));
+        if (mask != 0)
+            return begin + __builtin_ctz(mask);
+    }
+    return FindAboveScalar(values, begin, end, threshold);
+}
+
+__attribute__((target("avx2")))
+void LoadTermFreqsAvx2(TermFreqView term_freqs, size_t count, float* out)
+{
+    size_t i = 0;
+    switch (term_freqs.GetPrecision())
+    {
+    case TermFreqPrecision::FLOAT:
+        std::memcpy(out, term_freqs.GetData(), count * sizeof(float));
+        return;
+    case TermFreqPrecision::QUANTIZED_16:
+    {
+        // the bits of DecodeTermFreq16, eight codes at a time
+        const auto* data = term_freqs.GetData();
+        const __m256i bias = _mm256_set1_epi32(127);
+        const __m256i mantissa_mask = _mm256_set1_epi32(0x7FF);
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256i codes = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * sizeof(uint16_t))));
+            const __m256i exponent = _mm256_slli_epi32(_mm256_sub_epi32(bias, _mm256_srli_epi32(codes, 11)), 23);
+            const __m256i mantissa = _mm256_slli_epi32(_mm256_and_si256(codes, mantissa_mask), 12);
+            _mm256_storeu_ps(out + i, _mm256_castsi256_ps(_mm256_or_si256(exponent, mantissa)));
+        }
+        break;
+    }
+    default:
+    {
+        const auto* data = reinterpret_cast<const double*>(term_freqs.GetData());
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m128 low = _mm256_cvtpd_ps(_mm256_loadu_pd(data + i));
+            const __m128 high = _mm256_cvtpd_ps(_mm256_loadu_pd(data + i + 4));
+            _mm256_storeu_ps(out + i, _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1));
+        }
+        break;
+    }
+    }
+    LoadTermFreqsScalar(term_freqs, i, count, out);
+}
+
+__attribute__((target("avx2")))
+void ScoreTfIdfAvx2(TermFreqView term_freqs, size_t count, float term_weight, float* scores)
+{
+    LoadTermFreqsAvx2(term_freqs, count, scores);
+    const __m256 weight = _mm256_set1_ps(term_weight);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(scores + i, _mm256_mul_ps(_mm256_loadu_ps(scores + i), weight));
+    for (; i < count; ++i)
+        scores[i] *= term_weight;
+}
+
+__attribute__((target("avx2")))
+void ScoreBm25Avx2(const uint32_t* ordinals, TermFreqView term_freqs, size_t count, float term_weight,
+    const uint32_t* document_lengths, const Bm25Params& params, float* scores)
+{
+    LoadTermFreqsAvx2(term_freqs, count, scores);
+    const __m256 weight = _mm256_set1_ps(term_weight);
+    const __m256 k1_plus_one = _mm256_set1_ps(params.k1_plus_one);
+    const __m256 norm_base = _mm256_set1_ps(params.norm_base);
+    const __m256 norm_slope = _mm256_set1_ps(params.norm_slope);
+    const auto* lengths = reinterpret_cast<const int*>(document_lengths);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ordinals + i));
+        const __m256 length = _mm256_cvtepi32_ps(_mm256_i32gather_epi32(lengths, indices, sizeof(uint32_t)));
+        const __m256 posting_count = _mm256_mul_ps(_mm256_loadu_ps(scores + i), length);
+        const __m256 norm = _mm256_add_ps(posting_count, _mm256_add_ps(norm_base, _mm256_mul_ps(norm_slope, length)));
+        _mm256_storeu_ps(scores + i, _mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(posting_count, k1_plus_one), norm), weight));
+    }
+    for (; i < count; ++i)
+        scores[i] = ScoreBm25Posting(scores[i], static_cast<float>(document_lengths[ordinals[i]]), term_weight, params);
+}
+
+__attribute__((target("avx2")))
+size_t FindAboveAvx2(const float* values, size_t begin, size_t end, float threshold)
+{
+    const __m256 limit = _mm256_set1_ps(threshold);
+    for (; begin + 8 <= end; begin += 8)
+    {
+        const int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(values + begin), limit, _CMP_GT_OQ));
+        if (mask != 0)
+            return begin + __builtin_ctz(mask);
+    }
+    return FindAboveScalar(values, begin, end, threshold);
+}
+#endif
+
+SimdLevel& GetActiveSimdLevel()
+{
+    static SimdLevel level = GetSupportedSimdLevel();
+    return level;
+}
+}
+
+std::ostream& operator<<(std::ostream& os, SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::SCALAR:
+        return os << "scalar";
+    case SimdLevel::SSE2:
+        return os << "SSE2";
+    case SimdLevel::AVX2:
+        return os << "AVX2";
+    }
+    return os;
+}
+
+SimdLevel GetSupportedSimdLevel()
+{
+    static const SimdLevel level = []
+    {
+#ifdef SCORING_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return SimdLevel::AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return SimdLevel::SSE2;
+#endif
+        return SimdLevel::SCALAR;
+    }();
+    return level;
+}
+
+SimdLevel GetSimdLevel()
+{
+    return GetActiveSimdLevel();
+}
+
+void SetSimdLevel(SimdLevel level)
+{
+    if (level > GetSupportedSimdLevel())
+        throw std::invalid_argument("The CPU does not support the scoring kernels of this level"s);
+    GetActiveSimdLevel() = level;
+}
+
+void AccumulateTfIdf(const uint32_t* ordinals, TermFreqView term_freqs, size_t count, float term_weight, float* accumulator)
+{
+    float scores[BLOCK_SIZE];
+    const SimdLevel level = GetSimdLevel();
+    for (size_t begin = 0; begin < count; begin += BLOCK_SIZE)
+    {
+        const size_t size = std::min(BLOCK_SIZE, count - begin);
+        switch (level)
+        {
+#ifdef SCORING_KERNELS_X86
+        case SimdLevel::AVX2:
+            ScoreTfIdfAvx2(term_freqs + begin, size, term_weight, scores);
+            break;
+        case SimdLevel::SSE2:
+            ScoreTfIdfSse2(term_freqs + begin, size, term_weight, scores);
+            break;
+#endif
+        default:
+            ScoreTfIdfScalar(term_freqs + begin, size, term_weight, scores);
+            break;
+        }
+        ScatterAdd(ordinals + begin, scores, size, accumulator);
+    }
+}
+
+void AccumulateBm25(const uint32_t* ordinals, TermFreqView term_freqs, size_t count, float term_weight,
+    const uint32_t* document_lengths, float k1, float b, float average_document_length, float* accumulator)
+{
+    const Bm25Params params{ k1 + 1, k1 * (1 - b), k1 * b / average_document_length };
+    float scores[BLOCK_SIZE];
+    const SimdLevel level = GetSimdLevel();
+    for (size_t begin = 0; begin < count; begin += BLOCK_SIZE)
+    {
+        const size_t size = std::min(BLOCK_SIZE, count - begin);
+        switch (level)
+        {
+#ifdef SCORING_KERNELS_X86
+        case SimdLevel::AVX2:
+            ScoreBm25Avx2(ordinals + begin, term_freqs + begin, size, term_weight, document_lengths, params, scores);
+            break;
+        case SimdLevel::SSE2:
+            ScoreBm25Sse2(ordinals + begin, term_freqs + begin, size, term_weight, document_lengths, params, scores);
+            break;
+#endif
+        default:
+            ScoreBm25Scalar(ordinals + begin, term_freqs + begin, size, term_weight, document_lengths, params, scores);
+            break;
+        }
+        ScatterAdd(ordinals + begin, scores, size, accumulator);
+    }
+}
+
+size_t FindAbove(const float* values, size_t begin, size_t end, float threshold)
+{
+    switch (GetSimdLevel())
+    {
+#ifdef SCORING_KERNELS_X86
+    case SimdLevel::AVX2:
+        return FindAboveAvx2(values, begin, end, threshold);
+    case SimdLevel::SSE2:
+        return FindAboveSse2(values, begin, end, threshold);
+#endif
+    default:
+        return FindAboveScalar(values, begin, end, threshold);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include "term_freqs.h"
+
+// Instruction sets of the scoring kernels
+enum class SimdLevel
+{
+    SCALAR,
+    SSE2,
+    AVX2,
+};
+
+std::ostream& operator<<(std::ostream& os, SimdLevel level);
+
+// Widest level the CPU supports, detected once
+SimdLevel GetSupportedSimdLevel();
+
+// Level the kernels run at, the supported one unless set
+SimdLevel GetSimdLevel();
+
+// Throws invalid_argument if the CPU does not support level. Not thread safe: set it
+// before searching.
+void SetSimdLevel(SimdLevel level);
+
+// Bound of the relative error of one posting score computed by a kernel, against the
+// same score computed in double. Every float addition adds FLT_EPSILON to it.
+const double KERNEL_SCORE_ERROR = 16 * FLT_EPSILON;
+
+// Kernels score a block of postings into a buffer with the vector units, then add each
+// score to accumulator[ordinal]. Ordinals of one posting list are distinct, so the adds
+// do not conflict, but x86 has no scatter below AVX-512 and they stay scalar. Every
+// level computes the same operations in the same order.
+
+// accumulator[ordinals[i]] += term_weight * term_freqs[i]
+void AccumulateTfIdf(const uint32_t* ordinals, TermFreqView term_freqs, size_t count, float term_weight, float* accumulator);
+
+// accumulator[ordinals[i]] += term_weight * the Okapi BM25 score of the posting, as Bm25Scorer computes it
+void AccumulateBm25(const uint32_t* ordinals, TermFreqView term_freqs, size_t count, float term_weight,
+    const uint32_t* document_lengths, float k1, float b, float average_document_length, float* accumulator);
+
+// First index in [begin, end) of a value above threshold, or end
+size_t FindAbove(const float* values, size_t begin, size_t end, float threshold);
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "document.h"
+
+// Limits of a bounded search: a deadline, a number of postings to read, or both.
+// Asking for fewer documents than MAX_RESULT_DOCUMENT_COUNT also makes it prune sooner.
+struct SearchBudget
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    size_t max_postings = std::numeric_limits<size_t>::max();
+    size_t max_documents = std::numeric_limits<size_t>::max();
+
+    static SearchBudget Timeout(std::chrono::steady_clock::duration timeout)
+    {
+        SearchBudget budget;
+        budget.deadline = std::chrono::steady_clock::now() + timeout;
+        return budget;
+    }
+
+    bool IsExhausted(size_t postings_read) const
+    {
+        return postings_read >= max_postings
+            || (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline);
+    }
+};
+
+struct BoundedSearchResult
+{
+    std::vector<Document> documents;
+    bool is_complete = true;    // false when the budget ran out and documents are the best found so far
+};
\ No newline at end of file
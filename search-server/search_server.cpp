@@ -1,11 +1,16 @@
 #include "search_server.h"
 
-SearchServer::SearchServer(const std::string& stop_words_text)
-    : SearchServer(SplitIntoWords(stop_words_text))  // Invoke delegating constructor from string container
+SearchServer::SearchServer(const std::string& stop_words_text, TextAnalysis text_analysis)
+    : SearchServer(SplitIntoWords(stop_words_text), text_analysis)  // Invoke delegating constructor from string container
 {}
 
-SearchServer::SearchServer(const std::string_view& stop_words_text)
-    : SearchServer(SplitIntoWords(stop_words_text))  // Invoke delegating constructor from string container
+SearchServer::SearchServer(const std::string_view& stop_words_text, TextAnalysis text_analysis)
+    : SearchServer(SplitIntoWords(stop_words_text), text_analysis)  // Invoke delegating constructor from string container
+{}
+
+SearchServer::SearchServer(std::shared_ptr<const StopWords> stop_words, std::shared_ptr<TermPool> term_pool, TextAnalysis text_analysis)
+    : stop_words_(std::move(stop_words)), text_analysis_(text_analysis), terms_(std::move(term_pool)),
+    index_(TENANT_MUTABLE_SEGMENT_DOCUMENTS, SEGMENT_MERGE_FACTOR, false)
 {}
 
 void SearchServer::AddDocument
@@ -17,24 +22,61 @@ void SearchServer::AddDocument
     if (documents_.count(document_id) > 0)
         throw std::invalid_argument("ID "s + std::to_string(document_id) + " is already used"s);
 
-    const auto [it, _] = documents_.emplace(document_id,
-        DocumentData{ ComputeAverageRating(ratings), std::string(document), status });
-    std::vector<std::string_view> words = SplitIntoWordsNoStop(it->second.doc_text);
+    std::string analyzed_text;
+    std::vector<std::string_view> words;
+    AnalyzeText(document, analyzed_text, words);
 
-    const double inv_word_count = 1.0 / words.size();
+    std::vector<int> word_ids;
+    word_ids.reserve(words.size());
     for (std::string_view word : words)
     {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][word] += inv_word_count;
+        const size_t term_count = terms_.GetTermCount();
+        const int term_id = terms_.Add(word);
+        if (GetExtras().fuzzy_index && terms_.GetTermCount() != term_count)
+        {
+            extras_->fuzzy_index->AddTerm(term_id, word);
+        }
+        word_ids.push_back(term_id);
+    }
+    const DocumentPositions positions = positional_index_ ? ComputePositions(word_ids) : DocumentPositions();
+
+    const int rating = ComputeAverageRating(ratings);
+    const uint32_t ordinal = static_cast<uint32_t>(document_slots_.size());
+    std::string doc_text = document_storage_ == DocumentStorage::TERM_IDS ? EncodeTermSequence(word_ids) : std::string(document);
+    documents_.emplace(document_id, DocumentData{ rating, std::move(doc_text), status, ordinal });
+
+    document_freqs_.resize(terms_.GetTermCount());
+    const DocumentTerms& doc_terms = document_to_word_freqs_[document_id] = ComputeDocumentTerms(std::move(word_ids));
+    for (const int term_id : doc_terms.term_ids)
+    {
+        ++document_freqs_[term_id];
     }
+    document_lengths_.push_back(static_cast<uint32_t>(words.size()));
+    total_document_length_ += words.size();
+    index_.AddDocument(ordinal, doc_terms.term_ids, doc_terms.freqs, document_lengths_.back(), positions);
+    document_slots_.push_back(DocumentSlot{ document_id, rating, status });
     document_ids_.push_back(document_id);
+
+    if (documents_.size() >= CHAMPION_MIN_DOCUMENTS && documents_.size() >= 2 * GetExtras().champions_built_for)
+    {
+        RebuildChampionLists();
+    }
+    else if (!GetExtras().champions.IsEmpty())
+    {
+        for (size_t i = 0; i < doc_terms.term_ids.size(); ++i)
+        {
+            extras_->champions.AddPosting(doc_terms.term_ids[i], ordinal, doc_terms.freqs[i]);
+        }
+    }
+    RequantizeDriftedImpacts();
+
+    if (GetExtras().wal)
+        GetExtras().wal->LogAdd(document_id, document, status, ratings);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, DocumentStatus status) const
 {
-    return FindTopDocuments(raw_query,
-        [status](int document_id, DocumentStatus document_status, int rating)
-        { return document_status == status; });
+    return FindTopDocuments(raw_query, StatusFilter{ status });
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query) const
@@ -42,149 +84,509 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw
     return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
-const std::map<std::string_view, double>& SearchServer::GetWordFrequences(int document_id) const
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, QueryMode mode) const
+{
+    return FindTopDocuments(raw_query, mode, StatusFilter{ DocumentStatus::ACTUAL });
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, QueryStats& stats) const
+{
+    return FindTopDocuments(raw_query, QueryMode::ANY_WORD, StatusFilter{ DocumentStatus::ACTUAL }, stats);
+}
+
+BoundedSearchResult SearchServer::FindTopDocuments(const std::string_view& raw_query, const SearchBudget& budget) const
+{
+    return FindTopDocuments(raw_query, budget, StatusFilter{ DocumentStatus::ACTUAL });
+}
+
+void SearchServer::LogQuery(LoggedSearch search, const std::string_view& raw_query, QueryMode mode, std::optional<DocumentStatus> status,
+    std::chrono::steady_clock::time_point start, const std::vector<Document>& documents, const SearchBudget* budget, bool is_complete) const
+{
+    LoggedQuery query;
+    query.time = start - GetExtras().query_log->GetStartTime();
+    query.latency = std::chrono::steady_clock::now() - start;
+    query.search = search;
+    query.mode = mode;
+    query.status = status;
+    query.raw_query = std::string(raw_query);
+    query.result_count = documents.size();
+    query.result_hash = HashResult(documents);
+    query.is_complete = is_complete;
+    if (budget)
+    {
+        if (budget->deadline != std::chrono::steady_clock::time_point::max())
+            query.time_budget = std::max(std::chrono::nanoseconds(0), budget->deadline - start);
+        query.max_postings = budget->max_postings;
+        query.max_documents = budget->max_documents;
+    }
+    GetExtras().query_log->Record(query);
+}
+
+QueryPlan SearchServer::GetQueryPlan(const std::string_view& raw_query) const
+{
+    return Explain(raw_query).plan;
+}
+
+QueryCost SearchServer::GetQueryCost(const std::string_view& raw_query, QueryMode mode) const
+{
+    Query query = ParseQuery(raw_query, mode);
+    query.SortQuery(std::execution::seq);
+    return EstimateQueryCost(ResolveQuery(query));
+}
+
+QueryStats SearchServer::Explain(const std::string_view& raw_query, QueryMode mode) const
+{
+    Query query = ParseQuery(raw_query, mode);
+    query.SortQuery(std::execution::seq);
+    const TermQuery term_query = ResolveQuery(query);
+    const IndexSnapshot snapshot = index_.GetSnapshot();
+
+    QueryStats stats;
+    DescribeQuery(snapshot, term_query, stats);
+    if (!term_query.required_term_ids.empty())
+        stats.plan = IntersectsRequiredWords(term_query) ? QueryPlan::CONJUNCTIVE : QueryPlan::SEQUENTIAL;
+    else if (impact_scoring_)
+        stats.plan = QueryPlan::IMPACT;
+    else
+        stats.plan = ChooseQueryPlan(EstimateQueryCost(term_query), GetExtras().planner_thresholds);
+    return stats;
+}
+
+WordFrequencies SearchServer::GetWordFrequences(int document_id) const
+{
+    const auto it = document_to_word_freqs_.find(document_id);
+    if (it == document_to_word_freqs_.end())
+        return {};
+    const DocumentTerms& doc_terms = it->second;
+    return WordFrequencies{ terms_.GetTermsData(), doc_terms.term_ids.data(), doc_terms.freqs.GetView(), doc_terms.term_ids.size() };
+}
+
+void SearchServer::SetDocumentStorage(DocumentStorage storage)
+{
+    if (storage == document_storage_)
+        return;
+    for (auto& [document_id, document_data] : documents_)
+    {
+        if (storage == DocumentStorage::TERM_IDS)
+        {
+            document_data.doc_text = EncodeTermSequence(GetTermSequence(document_data));
+        }
+        else
+        {
+            document_data.doc_text = DecodeTermSequence(document_data.doc_text);
+        }
+    }
+    document_storage_ = storage;
+}
+
+std::string SearchServer::GetDocumentText(int document_id) const
+{
+    const auto it = documents_.find(document_id);
+    if (it == documents_.end())
+    {
+        throw std::out_of_range("id not found in SearchServer::GetDocumentText"s);
+    }
+    if (document_storage_ == DocumentStorage::RAW_TEXT)
+        return it->second.doc_text;
+    return DecodeTermSequence(it->second.doc_text);
+}
+
+size_t SearchServer::GetDocumentStoreMemoryUsage() const
 {
-    if (document_to_word_freqs_.count(document_id) > 0)
-        return document_to_word_freqs_.at(document_id);
-    static std::map<std::string_view, double> result;
+    size_t result = 0;
+    for (const auto& [document_id, document_data] : documents_)
+    {
+        result += HeapBytes(document_data.doc_text);
+    }
     return result;
 }
 
+MemoryStats SearchServer::GetMemoryStats() const
+{
+    MemoryStats stats;
+    // shared stop words are counted by whoever shares them
+    stats.term_dictionary = terms_.GetMemoryUsage() + (stop_words_.use_count() == 1 ? HeapBytes(*stop_words_) : 0);
+    stats.inverted_index = index_.GetMemoryUsage();
+    stats.positions = GetPositionalIndexMemoryUsage();
+    stats.forward_index = HeapBytes(document_to_word_freqs_);
+    for (const auto& [document_id, doc_terms] : document_to_word_freqs_)
+    {
+        stats.forward_index += HeapBytes(doc_terms.term_ids) + doc_terms.freqs.GetMemoryUsage();
+    }
+    stats.documents = HeapBytes(documents_);
+    stats.document_texts = GetDocumentStoreMemoryUsage();
+    stats.document_ids = HeapBytes(document_ids_);
+    stats.ordinal_tables = HeapBytes(document_slots_) + HeapBytes(document_lengths_) + HeapBytes(document_freqs_);
+    // the extras block is counted with the champion tier, its largest part
+    if (extras_)
+    {
+        stats.champion_lists = HeapBlockBytes(sizeof(Extras)) + extras_->champions.GetMemoryUsage();
+        if (extras_->fuzzy_index)
+            stats.fuzzy_index = HeapBlockBytes(sizeof(DeletionIndex)) + extras_->fuzzy_index->GetMemoryUsage();
+    }
+    return stats;
+}
+
 void SearchServer::RemoveDocument(int document_id)
 {
     if (document_to_word_freqs_.count(document_id) == 0)
         return;
 
-    
-    for (const auto& [word, _] : document_to_word_freqs_.at(document_id))
+    for (int term_id : document_to_word_freqs_.at(document_id).term_ids)
     {
-        word_to_document_freqs_[word].erase(document_id);
+        --document_freqs_[term_id];
     }
 
+    const uint32_t ordinal = documents_.at(document_id).ordinal;
+    document_slots_[ordinal].document_id = -1;
+    total_document_length_ -= document_lengths_[ordinal];
+    index_.RemoveDocument(ordinal);
+
     document_to_word_freqs_.erase(document_id);
 
     documents_.erase(document_id);
 
     const auto it = std::find(document_ids_.begin(), document_ids_.end(), document_id);
     document_ids_.erase(it);
+    RequantizeDriftedImpacts();
+
+    if (GetExtras().wal)
+        GetExtras().wal->LogRemove(document_id);
 }
 
-std::vector<int>::const_iterator SearchServer::begin() const
+void SearchServer::EnableFuzzySearch(int max_distance, double penalty)
 {
-    return document_ids_.begin(); 
+    if (max_distance < 1 || max_distance > 2)
+        throw std::invalid_argument("Fuzzy search supports edit distance 1 or 2"s);
+    Extras& extras = GetMutableExtras();
+    extras.fuzzy_index = std::make_unique<DeletionIndex>(max_distance);
+    extras.fuzzy_penalty = penalty;
+    for (size_t term_id = 0; term_id < terms_.GetTermCount(); ++term_id)
+    {
+        extras.fuzzy_index->AddTerm(static_cast<int>(term_id), terms_.GetTerm(static_cast<int>(term_id)));
+    }
 }
 
-std::vector<int>::const_iterator SearchServer::end() const
+void SearchServer::DisableFuzzySearch()
 {
-    return document_ids_.end();
+    if (extras_)
+        extras_->fuzzy_index.reset();
 }
 
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument
-(const std::string_view& raw_query, int document_id) const
+void SearchServer::FlushIndex()
 {
-    if (document_to_word_freqs_.count(document_id) == 0)
+    index_.Seal();
+    index_.WaitForMerges();
+    RebuildChampionLists();
+}
+
+void SearchServer::RebuildChampionLists()
+{
+    if (documents_.size() < CHAMPION_MIN_DOCUMENTS)
     {
-        throw std::out_of_range("id not found in SearchServer::MatchDocument"s);
+        if (extras_)
+            extras_->champions.Clear();
+        return;
     }
+    Extras& extras = GetMutableExtras();
+    extras.champions.Build(index_.GetSnapshot(), document_freqs_, documents_.size(),
+        [this](uint32_t ordinal) { return document_slots_[ordinal].document_id >= 0; });
+    extras.champions_built_for = documents_.size();
+}
 
-    Query query = ParseQuery(raw_query);
-    query.SortQuery(std::execution::seq);
+SearchServer::Extras& SearchServer::GetMutableExtras()
+{
+    if (!extras_)
+        extras_ = std::make_unique<Extras>();
+    return *extras_;
+}
 
-    std::vector<std::string_view> matched_words;
-    const std::map<std::string_view, double>& doc_ref = document_to_word_freqs_.at(document_id);
-    bool bMinusWordsFound = false;
+const SearchServer::Extras& SearchServer::GetDefaultExtras()
+{
+    static const Extras extras;
+    return extras;
+}
 
-    for (const std::string_view& m_word : query.minus_words)
+ChampionStats SearchServer::GetChampionStats() const
+{
+    ChampionStats stats;
+    for (const auto& [term_id, list] : GetExtras().champions.GetLists())
     {
-        if (doc_ref.count(m_word))
+        stats.terms.push_back({ terms_.GetTerm(term_id), list.document_freq, list.postings.size(), list.max_other_term_freq });
+        stats.champion_postings += list.postings.size();
+    }
+    std::sort(stats.terms.begin(), stats.terms.end(),
+        [](const TieredTermStats& lhs, const TieredTermStats& rhs)
         {
-            bMinusWordsFound = true;
-            break;
-        }
+            return std::tie(rhs.document_freq, lhs.word) < std::tie(lhs.document_freq, rhs.word);
+        });
+    stats.built_for_documents = GetExtras().champions_built_for;
+    stats.answered_queries = GetExtras().champion_answered_queries;
+    stats.fallback_queries = GetExtras().champion_fallback_queries;
+    return stats;
+}
+
+ReorderReport SearchServer::ReorderDocuments(const std::vector<std::string>& sample_queries)
+{
+    ReorderReport report;
+    report.document_count = documents_.size();
+    index_.MergeAll();
+    report.posting_bytes_before = ComputePostingGapBytes(index_.GetSnapshot(), terms_.GetTermCount());
+    report.query_time_before = TimeQueries(sample_queries);
+
+    std::vector<const std::vector<int>*> document_terms;
+    document_terms.reserve(document_ids_.size());
+    for (const int document_id : document_ids_)
+    {
+        document_terms.push_back(&document_to_word_freqs_.at(document_id).term_ids);
     }
+    const std::vector<uint32_t> order = ComputeBisectionOrder(document_terms, terms_.GetTermCount());
 
-    if (!bMinusWordsFound)
+    std::vector<int> ordered_ids;
+    ordered_ids.reserve(order.size());
+    for (const uint32_t index : order)
     {
-        for (std::string_view p_word : query.plus_words)
-        {
-            if (doc_ref.count(p_word))
-            {
-                matched_words.push_back(p_word);
-            }
-        }
+        ordered_ids.push_back(document_ids_[index]);
     }
+    RebuildIndex(ordered_ids);
 
-    return std::tuple<std::vector<std::string_view>, DocumentStatus>{ matched_words, documents_.at(document_id).status };
+    report.posting_bytes_after = ComputePostingGapBytes(index_.GetSnapshot(), terms_.GetTermCount());
+    report.query_time_after = TimeQueries(sample_queries);
+    return report;
 }
 
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument
-(std::execution::sequenced_policy, const std::string_view& raw_query, int document_id) const
+std::vector<int>::const_iterator SearchServer::begin() const
 {
-    return MatchDocument(raw_query, document_id);
+    return document_ids_.begin(); 
+}
+
+std::vector<int>::const_iterator SearchServer::end() const
+{
+    return document_ids_.end();
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument
-(std::execution::parallel_policy, const std::string_view& raw_query, int document_id) const
+(const std::string_view& raw_query, int document_id) const
 {
     if (document_to_word_freqs_.count(document_id) == 0)
     {
         throw std::out_of_range("id not found in SearchServer::MatchDocument"s);
     }
 
-    Query query = ParseQuery(raw_query);
-    std::vector<std::string_view> matched_words;
+    const TermQuery query = ResolveQuery(ParseQuery(raw_query));
+    return MatchResolved(query, document_id, query.phrases.empty()
+        || PhraseMatcher(index_.GetSnapshot(), query.phrases).Matches(documents_.at(document_id).ordinal));
+}
 
-    const std::map<std::string_view, double>& doc_ref = document_to_word_freqs_.at(document_id);
-    bool bMinusWordsFound = false;
-    bMinusWordsFound = std::any_of(query.minus_words.begin(), query.minus_words.end(),
-        [&](const std::string_view& m_word) { return doc_ref.count(m_word); });
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument
+(std::execution::sequenced_policy, const std::string_view& raw_query, int document_id) const
+{
+    return MatchDocument(raw_query, document_id);
+}
 
-    if (!bMinusWordsFound)
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument
+(std::execution::parallel_policy, const std::string_view& raw_query, int document_id) const
+{
+    // a single document is matched by a merge of two short sorted arrays, nothing to parallelize
+    return MatchDocument(raw_query, document_id);
+}
+
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> SearchServer::MatchDocuments
+(const std::string_view& raw_query, const std::vector<int>& document_ids) const
+{
+    return MatchDocuments(std::execution::seq, raw_query, document_ids);
+}
+
+SearchServer::TermQuery SearchServer::ResolveQuery(const Query& query) const
+{
+    TermQuery result;
+    for (const std::string_view& word : query.plus_words)
+    {
+        const int term_id = terms_.Find(word);
+        if (term_id != TermDictionary::NOT_FOUND)
+        {
+            result.plus_groups.push_back({ { term_id }, 1.0 });
+            result.plus_term_ids.push_back(term_id);
+        }
+    }
+    if (GetExtras().fuzzy_index)
+    {
+        // a word reached from several query words counts once, at its closest distance
+        std::map<int, int> fuzzy_distances;
+        for (const std::string_view& word : query.plus_words)
+        {
+            for (const auto& [term_id, distance] : GetExtras().fuzzy_index->Lookup(word, terms_))
+            {
+                if (distance == 0 || std::find(query.plus_words.begin(), query.plus_words.end(), terms_.GetTerm(term_id)) != query.plus_words.end())
+                {
+                    continue;
+                }
+                const auto [it, inserted] = fuzzy_distances.emplace(term_id, distance);
+                if (!inserted)
+                {
+                    it->second = std::min(it->second, distance);
+                }
+            }
+        }
+        for (const auto [term_id, distance] : fuzzy_distances)
+        {
+            result.plus_groups.push_back({ { term_id }, std::pow(GetExtras().fuzzy_penalty, distance) });
+            result.plus_term_ids.push_back(term_id);
+        }
+    }
+    for (const std::string_view& pattern : query.plus_patterns)
     {
+        std::vector<int> expansion = terms_.ExpandWildcard(pattern, GetExtras().max_pattern_expansion);
+        if (!expansion.empty())
+        {
+            result.plus_term_ids.insert(result.plus_term_ids.end(), expansion.begin(), expansion.end());
+            result.plus_groups.push_back({ std::move(expansion), 1.0 });
+        }
+    }
+    for (const std::string_view& word : query.minus_words)
+    {
+        const int term_id = terms_.Find(word);
+        if (term_id != TermDictionary::NOT_FOUND)
+        {
+            result.minus_term_ids.push_back(term_id);
+        }
+    }
+    for (const std::string_view& pattern : query.minus_patterns)
+    {
+        const std::vector<int> expansion = terms_.ExpandWildcard(pattern, GetExtras().max_pattern_expansion);
+        result.minus_term_ids.insert(result.minus_term_ids.end(), expansion.begin(), expansion.end());
+    }
 
-        for (std::string_view p_word : query.plus_words)
+    // a required word is also satisfied by its fuzzy matches; an unknown one by nothing
+    for (const std::string_view& word : query.required_words)
+    {
+        std::vector<int>& term_ids = result.required_term_ids.emplace_back();
+        const int term_id = terms_.Find(word);
+        if (term_id != TermDictionary::NOT_FOUND)
         {
-            if (doc_ref.count(p_word))
+            term_ids.push_back(term_id);
+        }
+        if (GetExtras().fuzzy_index)
+        {
+            for (const auto& [fuzzy_term_id, distance] : GetExtras().fuzzy_index->Lookup(word, terms_))
             {
-                matched_words.push_back(p_word);
+                term_ids.push_back(fuzzy_term_id);
             }
         }
+    }
+    for (const std::string_view& pattern : query.required_patterns)
+    {
+        result.required_term_ids.push_back(terms_.ExpandWildcard(pattern, GetExtras().max_pattern_expansion));
+    }
+
+    // fuzzy matches do not extend to phrases; a phrase with an unknown word is left out,
+    // as that word, being required, already matches nothing
+    if (!query.phrases.empty() && !positional_index_)
+        throw std::invalid_argument("Phrase queries need the positional index"s);
+    for (const std::vector<std::string_view>& phrase : query.phrases)
+    {
+        std::vector<int> term_ids;
+        for (const std::string_view& word : phrase)
+        {
+            const int term_id = terms_.Find(word);
+            if (term_id == TermDictionary::NOT_FOUND)
+                break;
+            term_ids.push_back(term_id);
+        }
+        if (term_ids.size() == phrase.size())
+            result.phrases.push_back(std::move(term_ids));
+    }
+    for (std::vector<int>& term_ids : result.required_term_ids)
+    {
+        std::sort(term_ids.begin(), term_ids.end());
+        term_ids.erase(std::unique(term_ids.begin(), term_ids.end()), term_ids.end());
+    }
 
-        std::sort(std::execution::par, matched_words.begin(), matched_words.end());
-        auto it = std::unique(matched_words.begin(), matched_words.end());
-        matched_words.resize(it - matched_words.begin());
+    for (std::vector<int>* term_ids : { &result.plus_term_ids, &result.minus_term_ids })
+    {
+        std::sort(term_ids->begin(), term_ids->end());
+        term_ids->erase(std::unique(term_ids->begin(), term_ids->end()), term_ids->end());
+    }
+    return result;
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchResolved
+(const TermQuery& query, int document_id, bool matches_phrases) const
+{
+    const std::vector<int>& doc_terms = document_to_word_freqs_.at(document_id).term_ids;
+    std::vector<std::string_view> matched_words;
+
+    const bool has_required_words = std::all_of(query.required_term_ids.begin(), query.required_term_ids.end(),
+        [&doc_terms](const std::vector<int>& term_ids) { return HasCommon(term_ids.begin(), term_ids.end(), doc_terms.begin(), doc_terms.end()); });
+    if (has_required_words && !HasCommon(query.minus_term_ids.begin(), query.minus_term_ids.end(), doc_terms.begin(), doc_terms.end())
+        && matches_phrases)
+    {
+        ForEachCommon(query.plus_term_ids.begin(), query.plus_term_ids.end(), doc_terms.begin(), doc_terms.end(),
+            [this, &matched_words](auto it_query, auto) { matched_words.push_back(terms_.GetTerm(*it_query)); });
+        std::sort(matched_words.begin(), matched_words.end());
     }
 
     return std::tuple<std::vector<std::string_view>, DocumentStatus>{ matched_words, documents_.at(document_id).status };
 }
 
-bool SearchServer::IsStopWord(const std::string_view& word) const
+std::string SearchServer::EncodeTermSequence(const std::vector<int>& term_ids)
 {
-    return stop_words_.count(word) > 0;
+    std::string result;
+    for (const int term_id : term_ids)
+    {
+        AppendVarint(result, term_id);
+    }
+    result.shrink_to_fit();
+    return result;
 }
 
-bool SearchServer::IsValidWord(const std::string_view& word)
+std::string SearchServer::DecodeTermSequence(std::string_view encoded) const
 {
-    return std::none_of(word.begin(), word.end(), [](char c) {
-        return c >= '\0' && c < ' ';
-        });
+    std::string text;
+    while (!encoded.empty())
+    {
+        if (!text.empty())
+            text.push_back(' ');
+        text += terms_.GetTerm(static_cast<int>(ReadVarint(encoded)));
+    }
+    return text;
 }
 
-std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(std::string_view text)
+std::vector<int> SearchServer::GetTermSequence(const DocumentData& document_data) const
 {
-    std::vector<std::string_view> result;
-    for (const std::string_view& word : SplitIntoWords(text))
+    std::vector<int> term_ids;
+    if (document_storage_ == DocumentStorage::TERM_IDS)
     {
-        if (!IsValidWord(word))
-        {
-            throw std::invalid_argument("Invalid word: "s + static_cast<std::string>(word));
-        }
-        if (!IsStopWord(word))
+        for (std::string_view encoded = document_data.doc_text; !encoded.empty();)
         {
-            result.push_back(word);
+            term_ids.push_back(static_cast<int>(ReadVarint(encoded)));
         }
+        return term_ids;
     }
-    return result;
+    std::string analyzed_text;
+    std::vector<std::string_view> words;
+    AnalyzeText(document_data.doc_text, analyzed_text, words);
+    term_ids.reserve(words.size());
+    for (std::string_view word : words)
+    {
+        term_ids.push_back(terms_.Find(word));
+    }
+    return term_ids;
+}
+
+bool SearchServer::IsStopWord(const std::string_view& word) const
+{
+    return WithAnalyzer([&](auto analyzer) { return !analyzer.IsKeptWord(word, *stop_words_); });
+}
+
+bool SearchServer::IsValidWord(const std::string_view& word) const
+{
+    return WithAnalyzer([&](auto analyzer) { return analyzer.IsValidWord(word); });
+}
+
+void SearchServer::AnalyzeText(std::string_view text, std::string& buffer, std::vector<std::string_view>& words) const
+{
+    WithAnalyzer([&](auto analyzer) { analyzer.Analyze(text, *stop_words_, buffer, words); });
 }
 
 int SearchServer::ComputeAverageRating(const std::vector<int>& ratings)
@@ -205,44 +607,359 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) cons
 
     bool is_stop_word = IsStopWord(text);
     bool is_minus = false;
+    bool is_required = false;
     if (text[0] == '-')
     {
         is_minus = true;
         text = text.substr(1);
     }
+    else if (text[0] == '+')
+    {
+        is_required = true;
+        text = text.substr(1);
+        is_stop_word = IsStopWord(text);
+    }
     if (text.empty())
         throw std::invalid_argument("Empty word"s);
-    if (text[0] == '-')
+    if (text[0] == '-' || text[0] == '+')
         throw std::invalid_argument("Invalid word: "s + static_cast<std::string>(text));
     if (!IsValidWord(text))
         throw std::invalid_argument("Invalid symbols in word: "s + static_cast<std::string>(text));
 
-    return QueryWord{ std::move(text), is_minus, is_stop_word };
+    const bool is_pattern = text.find('*') != text.npos;
+    if (is_pattern && text.find_first_not_of('*') == text.npos)
+        throw std::invalid_argument("Empty pattern: "s + static_cast<std::string>(text));
+
+    return QueryWord{ std::move(text), is_minus, is_required, is_stop_word, is_pattern };
 }
 
-SearchServer::Query SearchServer::ParseQuery(const std::string_view& text) const
+SearchServer::Query SearchServer::ParseQuery(const std::string_view& text, QueryMode mode) const
 {
     Query query;
-    std::vector<std::string_view> splitted_words = SplitIntoWords(text);
-    for (std::string_view& word : splitted_words)
+    std::string buffer;
+    std::vector<std::string_view> splitted_words;
+    WithAnalyzer([&](auto analyzer)
+        {
+            // the markers -, + and * are left alone by every rewrite
+            const std::string_view rewritten = analyzer.Rewrite(text, buffer);
+            if (rewritten.data() == buffer.data())
+            {
+                query.rewritten_text = std::make_unique<std::string>(std::move(buffer));
+                analyzer.Split(*query.rewritten_text, splitted_words);
+            }
+            else
+            {
+                analyzer.Split(rewritten, splitted_words);
+            }
+        });
+    std::vector<std::string_view>* phrase = nullptr;   // while inside quotes
+    for (std::string_view word : splitted_words)
     {
+        if (!phrase && word.front() == '"')
+        {
+            phrase = &query.phrases.emplace_back();
+            word.remove_prefix(1);
+        }
+        if (phrase)
+        {
+            const bool closes_phrase = !word.empty() && word.back() == '"';
+            if (closes_phrase)
+                word.remove_suffix(1);
+            if (!word.empty())
+            {
+                const QueryWord query_word = ParseQueryWord(word);
+                if (query_word.is_minus || query_word.is_required || query_word.is_pattern)
+                    throw std::invalid_argument("Invalid word in phrase: "s + static_cast<std::string>(word));
+                if (!query_word.is_stop)
+                {
+                    query.plus_words.push_back(query_word.data);
+                    query.required_words.push_back(query_word.data);
+                    phrase->push_back(query_word.data);
+                }
+            }
+            if (closes_phrase)
+                phrase = nullptr;
+            continue;
+        }
+
         QueryWord query_word = ParseQueryWord(word);
         if (!query_word.is_stop)
         {
-            if (query_word.is_minus)
+            const bool is_required = !query_word.is_minus && (query_word.is_required || mode == QueryMode::ALL_WORDS);
+            if (query_word.is_pattern)
+            {
+                (query_word.is_minus ? query.minus_patterns : query.plus_patterns).push_back(query_word.data);
+                if (is_required)
+                {
+                    query.required_patterns.push_back(query_word.data);
+                }
+            }
+            else if (query_word.is_minus)
             {
                 query.minus_words.push_back(query_word.data);
             }
             else
             {
                 query.plus_words.push_back(query_word.data);
+                if (is_required)
+                {
+                    query.required_words.push_back(query_word.data);
+                }
             }
         }
     }
+    if (phrase)
+        throw std::invalid_argument("Unterminated phrase"s);
+    // a phrase of one word is just that word, required
+    query.phrases.erase(std::remove_if(query.phrases.begin(), query.phrases.end(),
+        [](const std::vector<std::string_view>& words) { return words.size() < 2; }), query.phrases.end());
     return query;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const std::string_view& word) const
+size_t SearchServer::ComputeDocumentFreq(const IndexSnapshot& snapshot, const std::vector<int>& term_ids) const
 {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+    if (term_ids.size() == 1)
+    {
+        return document_freqs_[term_ids.front()];
+    }
+    std::vector<uint32_t> ordinals;
+    for (const int term_id : term_ids)
+    {
+        snapshot.ForEachPosting(term_id, [this, &ordinals](uint32_t ordinal, double)
+            {
+                if (document_slots_[ordinal].document_id >= 0)
+                {
+                    ordinals.push_back(ordinal);
+                }
+            });
+    }
+    std::sort(ordinals.begin(), ordinals.end());
+    return std::unique(ordinals.begin(), ordinals.end()) - ordinals.begin();
+}
+
+void SearchServer::DescribeQuery(const IndexSnapshot& snapshot, const TermQuery& query, QueryStats& stats) const
+{
+    const auto describe = [this, &snapshot](const std::vector<int>& term_ids, std::vector<std::string_view>& terms, std::vector<size_t>& posting_lengths)
+    {
+        for (const int term_id : term_ids)
+        {
+            size_t posting_length = 0;
+            for (const PostingSpan& span : snapshot.GetPostings(term_id))
+            {
+                posting_length += span.size;
+            }
+            terms.push_back(terms_.GetTerm(term_id));
+            posting_lengths.push_back(posting_length);
+        }
+    };
+    describe(query.plus_term_ids, stats.plus_terms, stats.plus_posting_lengths);
+    describe(query.minus_term_ids, stats.minus_terms, stats.minus_posting_lengths);
+}
+
+std::chrono::nanoseconds SearchServer::TimeQueries(const std::vector<std::string>& queries) const
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (const std::string& query : queries)
+    {
+        FindTopDocuments(std::execution::seq, query);
+    }
+    return std::chrono::steady_clock::now() - start;
+}
+
+QueryCost SearchServer::EstimateQueryCost(const TermQuery& query) const
+{
+    // from the live documents of every term, which leaves out removed documents a merge has
+    // not yet dropped but costs no lookup in the segments
+    QueryCost cost;
+    bool has_tiered_term = false;
+    for (const int term_id : query.plus_term_ids)
+    {
+        const size_t postings = document_freqs_[term_id];
+        cost.plus_postings += postings;
+        const ChampionList* list = GetExtras().champions.Find(term_id);
+        has_tiered_term = has_tiered_term || list;
+        cost.tier_postings += list ? list->postings.size() : postings;
+    }
+    if (!has_tiered_term)
+    {
+        cost.tier_postings = 0;
+    }
+    for (const int term_id : query.minus_term_ids)
+    {
+        cost.minus_postings += document_freqs_[term_id];
+    }
+    size_t rarest_required_postings = std::numeric_limits<size_t>::max();
+    for (const std::vector<int>& term_ids : query.required_term_ids)
+    {
+        size_t postings = 0;
+        for (const int term_id : term_ids)
+        {
+            postings += document_freqs_[term_id];
+        }
+        cost.required_postings += postings;
+        rarest_required_postings = std::min(rarest_required_postings, postings);
+    }
+    if (!query.required_term_ids.empty())
+    {
+        cost.intersection_seeks = rarest_required_postings * query.required_term_ids.size();
+    }
+    cost.plus_terms = query.plus_groups.size();
+    cost.ordinal_count = document_slots_.size();
+    return cost;
+}
+
+bool SearchServer::IntersectsRequiredWords(const TermQuery& query) const
+{
+    // phrases are checked in ordinal order, which only the intersection keeps
+    return !query.phrases.empty() || ShouldIntersect(EstimateQueryCost(query), GetExtras().planner_thresholds);
+}
+
+CorpusStats SearchServer::GetCorpusStats() const
+{
+    CorpusStats corpus;
+    corpus.document_count = documents_.size();
+    corpus.average_document_length = documents_.empty() ? 0.0 : total_document_length_ * 1.0 / documents_.size();
+    corpus.document_lengths = document_lengths_.data();
+    return corpus;
+}
+
+ImpactFunction SearchServer::MakeImpactFunction() const
+{
+    if (!impact_scoring_)
+        return {};
+    // the term weight is left out: it changes with every added document, the posting score
+    // only through the average length under BM25, which the index tracks per segment
+    return WithScorer(CorpusStats{}, [](const auto& scorer)
+        {
+            using Scorer = std::decay_t<decltype(scorer)>;
+            return ImpactFunction([](double term_freq, uint32_t document_length, double average_length)
+                {
+                    const Scorer scorer(CorpusStats{ 0, average_length, &document_length });
+                    return QuantizeImpact(scorer.ScorePosting(0, term_freq), Scorer::MAX_POSTING_SCORE);
+                });
+        });
+}
+
+void SearchServer::RequantizeDriftedImpacts()
+{
+    if (!impact_scoring_ || relevance_model_ != RelevanceModel::BM25 || documents_.empty())
+        return;
+    const double average_length = GetCorpusStats().average_document_length;
+    if (std::abs(average_length - impact_average_length_) <= IMPACT_LENGTH_DRIFT * impact_average_length_)
+        return;
+    // the merge thread rewrites the segments quantized with the old average one at a time
+    impact_average_length_ = average_length;
+    index_.SetImpactAverageLength(average_length);
+}
+
+DocumentPositions SearchServer::ComputePositions(const std::vector<int>& term_sequence)
+{
+    std::vector<std::pair<int, uint32_t>> occurrences;
+    occurrences.reserve(term_sequence.size());
+    for (uint32_t position = 0; position < term_sequence.size(); ++position)
+    {
+        occurrences.emplace_back(term_sequence[position], position);
+    }
+    std::sort(occurrences.begin(), occurrences.end());
+
+    // runs of one term ID are the forward index entries, in the same order
+    DocumentPositions positions;
+    positions.offsets.push_back(0);
+    for (size_t i = 0; i < occurrences.size(); ++i)
+    {
+        const bool starts_run = i == 0 || occurrences[i].first != occurrences[i - 1].first;
+        AppendVarint(positions.bytes, occurrences[i].second - (starts_run ? 0 : occurrences[i - 1].second));
+        if (i + 1 == occurrences.size() || occurrences[i + 1].first != occurrences[i].first)
+        {
+            positions.offsets.push_back(static_cast<uint32_t>(positions.bytes.size()));
+        }
+    }
+    return positions;
+}
+
+SearchServer::DocumentTerms SearchServer::ComputeDocumentTerms(std::vector<int> term_sequence) const
+{
+    std::sort(term_sequence.begin(), term_sequence.end());
+
+    // every run of equal IDs becomes one forward index entry
+    const double inv_word_count = 1.0 / term_sequence.size();
+    size_t term_count = term_sequence.empty() ? 0 : 1;
+    for (size_t i = 1; i < term_sequence.size(); ++i)
+    {
+        term_count += term_sequence[i] != term_sequence[i - 1];
+    }
+    DocumentTerms doc_terms{ {}, TermFreqArray(term_freq_precision_) };
+    doc_terms.term_ids.reserve(term_count);
+    doc_terms.freqs.reserve(term_count);
+    for (auto run_begin = term_sequence.begin(); run_begin != term_sequence.end();)
+    {
+        const auto run_end = std::upper_bound(run_begin, term_sequence.end(), *run_begin);
+        doc_terms.term_ids.push_back(*run_begin);
+        doc_terms.freqs.push_back((run_end - run_begin) * inv_word_count);
+        run_begin = run_end;
+    }
+    return doc_terms;
+}
+
+void SearchServer::RebuildIndex(const std::vector<int>& document_ids)
+{
+    const std::vector<uint32_t> old_lengths = std::move(document_lengths_);
+    impact_average_length_ = GetCorpusStats().average_document_length;
+    // removed documents are not carried over, so the slot table shrinks to the live ones
+    index_.Clear();
+    index_.SetImpactFunction(MakeImpactFunction(), impact_average_length_);
+    document_slots_.clear();
+    document_lengths_.clear();
+    for (uint32_t ordinal = 0; ordinal < document_ids.size(); ++ordinal)
+    {
+        const int document_id = document_ids[ordinal];
+        DocumentData& document_data = documents_.at(document_id);
+        const DocumentTerms& doc_terms = document_to_word_freqs_.at(document_id);
+        document_lengths_.push_back(old_lengths[document_data.ordinal]);
+        document_data.ordinal = ordinal;
+        index_.AddDocument(ordinal, doc_terms.term_ids, doc_terms.freqs, document_lengths_.back(),
+            positional_index_ ? ComputePositions(GetTermSequence(document_data)) : DocumentPositions());
+        document_slots_.push_back(DocumentSlot{ document_id, document_data.rating, document_data.status });
+    }
+    index_.MergeAll();
+    RebuildChampionLists();
+}
+
+void SearchServer::SetRelevanceModel(RelevanceModel model)
+{
+    if (model == relevance_model_)
+        return;
+    relevance_model_ = model;
+    if (impact_scoring_)
+        RebuildIndex(document_ids_);
+}
+
+void SearchServer::SetImpactScoring(bool enabled)
+{
+    if (enabled == impact_scoring_)
+        return;
+    impact_scoring_ = enabled;
+    RebuildIndex(document_ids_);
+}
+
+void SearchServer::SetPositionalIndex(bool enabled)
+{
+    if (enabled == positional_index_)
+        return;
+    positional_index_ = enabled;
+    RebuildIndex(document_ids_);
+}
+
+void SearchServer::SetTermFreqPrecision(TermFreqPrecision precision)
+{
+    if (precision == term_freq_precision_)
+        return;
+    term_freq_precision_ = precision;
+    // from the documents rather than the old frequencies, which may have been rounded
+    for (auto& [document_id, doc_terms] : document_to_word_freqs_)
+    {
+        doc_terms = ComputeDocumentTerms(GetTermSequence(documents_.at(document_id)));
+    }
+    index_.SetTermFreqPrecision(precision);
+    RebuildIndex(document_ids_);
 }
\ No newline at end of file
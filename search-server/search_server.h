@@ -3,43 +3,106 @@
 #include <string>
 #include <set>
 #include <map>
+#include <optional>
+#include <tuple>
+#include <queue>
 #include <numeric>
 #include <algorithm>
 #include <math.h>
+#include <limits>
+#include <memory>
+#include <atomic>
+#include <array>
 #include <execution>
 #include <type_traits>
 #include "string_processing.h"
 #include <type_traits>
 
+#include "champion_lists.h"
 #include "document.h"
+#include "document_reorder.h"
+#include "index_builder.h"
 #include "concurrent_map.h"
+#include "deletion_index.h"
+#include "query_log.h"
+#include "query_planner.h"
+#include "memory_stats.h"
+#include "query_stats.h"
+#include "scoring.h"
+#include "search_budget.h"
+#include "segmented_index.h"
+#include "stage_profiler.h"
+#include "sorted_intersection.h"
+#include "term_dictionary.h"
+#include "text_analysis.h"
+#include "varint.h"
+#include "word_frequencies.h"
+#include "write_ahead_log.h"
 
 #include "log_duration.h"
 
 using namespace std::string_literals;
 
+// How SearchServer keeps the text of a document once it is indexed
+enum class DocumentStorage
+{
+    RAW_TEXT,
+    TERM_IDS,   // varint encoded term IDs of the indexed words, in text order
+};
+
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 const double EPSILON = 1e-6;
+const size_t MAX_PATTERN_EXPANSION = 64;
+const double FUZZY_MATCH_PENALTY = 0.5;
+const size_t MUTABLE_SEGMENT_DOCUMENTS = 4096;
+const size_t SEGMENT_MERGE_FACTOR = 4;
+const size_t TENANT_MUTABLE_SEGMENT_DOCUMENTS = 1;   // tenants seal every document into flat arrays
+const size_t CHAMPION_LIST_SIZE = 64;
+const double CHAMPION_MIN_DOCUMENT_SHARE = 0.05;
+const size_t CHAMPION_MIN_DOCUMENTS = 1024;
+const size_t BUDGET_CHECK_POSTINGS = 1024;
+const double BUDGET_ESTIMATE_MARGIN = 4;    // a bounded search runs its planned path uninterrupted when this many times the estimate fits
+const double IMPACT_LENGTH_DRIFT = 0.05;    // BM25 impacts are requantized in the background once the average length moves by this share
 
 class SearchServer
 {
 public:
 
+    // Documents, queries and the stop words all go through the analyzer of text_analysis
     template <typename StringContainer>
-    explicit SearchServer(const StringContainer& stop_words);
+    explicit SearchServer(const StringContainer& stop_words, TextAnalysis text_analysis = TextAnalysis::EXACT);
+
+    explicit SearchServer(const std::string& stop_words_text, TextAnalysis text_analysis = TextAnalysis::EXACT);
 
-    explicit SearchServer(const std::string& stop_words_text);
+    explicit SearchServer(const std::string_view& stop_words_text, TextAnalysis text_analysis = TextAnalysis::EXACT);
 
-    explicit SearchServer(const std::string_view& stop_words_text);
+    // Shares the stop words and the bytes of the indexed words with other servers, as
+    // TenantHost does; stop_words must come from MakeStopWords with the same text_analysis.
+    // Every document is sealed on its own and segments are merged in the adding thread.
+    SearchServer(std::shared_ptr<const StopWords> stop_words, std::shared_ptr<TermPool> term_pool,
+        TextAnalysis text_analysis = TextAnalysis::EXACT);
+
+    TextAnalysis GetTextAnalysis() const { return text_analysis_; }
 
     void AddDocument(int document_id, const std::string_view& document, DocumentStatus status, const std::vector<int>& ratings);
 
+    // Overloads without an execution policy pick a QueryPlan from the estimated cost of the query.
+    // A plus word written as "+word" is required; QueryMode::ALL_WORDS requires every plus word.
+    // Words in double quotes form a phrase: each is required, and they must follow each other in
+    // the document, stop words not counted. Phrases need SetPositionalIndex(true).
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(const std::string_view& raw_query, DocumentPredicate document_predicate) const;
 
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::string_view& raw_query, QueryMode mode, DocumentPredicate document_predicate) const;
+
     template <typename ExecutionPolicy, typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query, DocumentPredicate document_predicate) const;
 
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query,
+        QueryMode mode, DocumentPredicate document_predicate) const;
+
     std::vector<Document> FindTopDocuments(const std::string_view& raw_query, DocumentStatus status) const;
 
     template <typename ExecutionPolicy>
@@ -50,8 +113,85 @@ public:
     template <typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query) const;
 
+    std::vector<Document> FindTopDocuments(const std::string_view& raw_query, QueryMode mode) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query, QueryMode mode) const;
+
+    // Same, also filling stats with what the search did. Searches without stats count nothing.
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::string_view& raw_query, QueryMode mode,
+        DocumentPredicate document_predicate, QueryStats& stats) const;
+
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query,
+        QueryMode mode, DocumentPredicate document_predicate, QueryStats& stats) const;
+
+    std::vector<Document> FindTopDocuments(const std::string_view& raw_query, QueryStats& stats) const;
+
+    // Best documents found within budget. A query estimated to fit the budget with a margin runs
+    // the plan FindTopDocuments would choose. Otherwise terms are read from the highest possible
+    // contribution down and the budget is checked every BUDGET_CHECK_POSTINGS postings. Once it runs out, the
+    // documents seen so far are ranked by the relevance gathered until then and is_complete is
+    // false. Minus words always apply in full, and queries with required words are answered by
+    // the intersection, which the budget does not interrupt.
+    template <typename DocumentPredicate>
+    BoundedSearchResult FindTopDocuments(const std::string_view& raw_query, const SearchBudget& budget,
+        DocumentPredicate document_predicate) const;
+
+    BoundedSearchResult FindTopDocuments(const std::string_view& raw_query, const SearchBudget& budget) const;
+
+    // Relevance model of every search; the scoring loops are compiled separately for each one
+    void SetRelevanceModel(RelevanceModel model);
+
+    RelevanceModel GetRelevanceModel() const { return relevance_model_; }
+
+    // Keeps a one byte quantized score of every posting, computed when the document is added.
+    // FindTopDocuments without a policy then answers queries without required words by summing
+    // those as integers, one table lookup and add per posting, and relevance is accurate to a
+    // few percent. BM25 scores depend on the average document length; once adds or removes
+    // move it by more than IMPACT_LENGTH_DRIFT, the merge thread requantizes the segments one
+    // at a time, and until it is done their relevance is a little further off. Switching it or the relevance model while it is on rebuilds the index.
+    void SetImpactScoring(bool enabled);
+
+    bool IsImpactScoringEnabled() const { return impact_scoring_; }
+
+    // Keeps the positions of every word in the postings, as varint gaps, which phrase queries
+    // check after intersecting the documents. Other queries never read them. Switching it
+    // rebuilds the index.
+    void SetPositionalIndex(bool enabled);
+
+    bool IsPositionalIndexEnabled() const { return positional_index_; }
+
+    // Heap bytes of the word positions in the index
+    size_t GetPositionalIndexMemoryUsage() const { return index_.GetSnapshot().GetPositionMemoryUsage(); }
+
+    // Precision of the term frequencies in the forward index and the postings. FLOAT halves and
+    // QUANTIZED_16 quarters their memory, for a relative error of 6e-8 and 2.5e-4 in every score.
+    // Switching computes the frequencies anew from the stored documents and rebuilds the index.
+    void SetTermFreqPrecision(TermFreqPrecision precision);
+
+    TermFreqPrecision GetTermFreqPrecision() const { return term_freq_precision_; }
+
+    // Heap bytes held by each part of the server
+    MemoryStats GetMemoryStats() const;
+
+    // Terms, posting lengths and plan of FindTopDocuments(raw_query, mode), without running it
+    QueryStats Explain(const std::string_view& raw_query, QueryMode mode = QueryMode::ANY_WORD) const;
+
     int GetDocumentCount() const { return documents_.size(); }
 
+    // Plan FindTopDocuments(raw_query) would use on the current index
+    QueryPlan GetQueryPlan(const std::string_view& raw_query) const;
+
+    // Postings FindTopDocuments(raw_query, mode) would read, estimated from the document frequencies
+    QueryCost GetQueryCost(const std::string_view& raw_query, QueryMode mode = QueryMode::ANY_WORD) const;
+
+    // Thresholds start out from GetCalibratedQueryPlannerThresholds()
+    void SetQueryPlannerThresholds(const QueryPlannerThresholds& thresholds) { GetMutableExtras().planner_thresholds = thresholds; }
+
+    const QueryPlannerThresholds& GetQueryPlannerThresholds() const { return GetExtras().planner_thresholds; }
+
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view& raw_query, int document_id) const;
 
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument
@@ -60,23 +200,95 @@ public:
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument
         (std::execution::parallel_policy, const std::string_view& raw_query, int document_id) const;
 
-    const std::map<std::string_view, double>& GetWordFrequences(int document_id) const;
+    // Parses the query once and matches it against every listed document
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments
+        (const std::string_view& raw_query, const std::vector<int>& document_ids) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments
+        (ExecutionPolicy&& policy, const std::string_view& raw_query, const std::vector<int>& document_ids) const;
+
+    // A view into the forward index of the document, valid only until the next AddDocument,
+    // RemoveDocument or other modification of the server; copy what must outlive it
+    WordFrequencies GetWordFrequences(int document_id) const;
+
+    // With DocumentStorage::TERM_IDS documents are stored as term ID sequences and the raw text
+    // is dropped. GetDocumentText then joins the indexed words with single spaces: stop words
+    // and extra whitespace are lost, but the text indexes exactly like the original.
+    // Switching converts the documents already stored.
+    void SetDocumentStorage(DocumentStorage storage);
+
+    DocumentStorage GetDocumentStorage() const { return document_storage_; }
+
+    std::string GetDocumentText(int document_id) const;
+
+    // Heap bytes of the stored document texts
+    size_t GetDocumentStoreMemoryUsage() const;
 
     void RemoveDocument(int document_id);
 
     template <class ExecutionPolicy>
     void RemoveDocument(ExecutionPolicy&& policy, int document_id);
 
+    // Caps how many dictionary words one "cat*" style query word may expand to
+    void SetMaxPatternExpansion(size_t max_terms) { GetMutableExtras().max_pattern_expansion = max_terms; }
+
+    // Seals recently added documents into a read-optimized segment and waits for background merges
+    void FlushIndex();
+
+    size_t GetSegmentCount() const { return index_.GetSegmentCount(); }
+
+    // Renumbers internal ordinals so that documents sharing words are adjacent in the
+    // posting lists, and rebuilds the index as a single segment. Reports the posting
+    // size and the time of sample_queries before and after.
+    ReorderReport ReorderDocuments(const std::vector<std::string>& sample_queries);
+
+    // Plus words also match dictionary words within max_distance (1 or 2) edits. A match at
+    // distance d is scored as a separate term weighted by penalty to the power of d.
+    void EnableFuzzySearch(int max_distance, double penalty = FUZZY_MATCH_PENALTY);
+
+    void DisableFuzzySearch();
+
+    // Once the server holds CHAMPION_MIN_DOCUMENTS, terms found in CHAMPION_MIN_DOCUMENT_SHARE of
+    // the documents keep a champion list of their CHAMPION_LIST_SIZE highest frequency documents. FindTopDocuments without a policy answers
+    // from that tier when it can prove the full lists give the same top documents, and tries
+    // only when the query planner expects the tier to cost a fraction of a sequential search.
+    // The tier is rebuilt whenever the document count doubles and by FlushIndex.
+    ChampionStats GetChampionStats() const;
+
+    // Successful mutations are appended to wal; nullptr turns logging off
+    void SetWriteAheadLog(WriteAheadLog* wal) { GetMutableExtras().wal = wal; }
+
+    // Searches are recorded in query_log with their latency; nullptr turns logging off.
+    // Searches with a custom predicate are logged without a status and cannot be replayed.
+    void SetQueryLog(QueryLog* query_log) { GetMutableExtras().query_log = query_log; }
+
+    // Searches record their stages in profiler; nullptr turns profiling off.
+    // The profiler is not thread safe, so only search from one thread meanwhile.
+    void SetStageProfiler(StageProfiler* profiler) { GetMutableExtras().profiler = profiler; }
+
     std::vector<int>::const_iterator begin() const;
 
     std::vector<int>::const_iterator end() const;
 
 private:
 
+    friend class IndexBuilder;
+    friend class WriteAheadLog;
+
     struct DocumentData
     {
         int rating;
-        std::string doc_text;
+        std::string doc_text;   // raw text, or varint term IDs with DocumentStorage::TERM_IDS
+        DocumentStatus status;
+        uint32_t ordinal;       // position of the document in the inverted index
+    };
+
+    // What the posting loops need about a document, indexed by ordinal
+    struct DocumentSlot
+    {
+        int document_id;        // -1 once the document is removed
+        int rating;
         DocumentStatus status;
     };
 
@@ -84,13 +296,21 @@ private:
     {
         std::string_view data;
         bool is_minus;
+        bool is_required;   // written as "+word"
         bool is_stop;
+        bool is_pattern;    // contains '*', matched against the term dictionary
     };
 
     struct Query
     {
         std::vector<std::string_view> plus_words;
         std::vector<std::string_view> minus_words;
+        std::vector<std::string_view> plus_patterns;
+        std::vector<std::string_view> minus_patterns;
+        std::vector<std::string_view> required_words;       // also listed in plus_words
+        std::vector<std::string_view> required_patterns;    // also listed in plus_patterns
+        std::vector<std::vector<std::string_view>> phrases; // words in order, also listed in required_words
+        std::unique_ptr<std::string> rewritten_text;        // holds the words if the analyzer rewrote the query
 
         bool plus_words_sorted = false;
         bool minus_words_sorted = false;
@@ -99,44 +319,213 @@ private:
         void SortQuery(ExecutionPolicy&& policy);
     };
 
-    const std::set<std::string,std::less<>> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
+    // Forward index entry: term IDs sorted ascending, frequencies in the same order
+    struct DocumentTerms
+    {
+        std::vector<int> term_ids;
+        TermFreqArray freqs;
+    };
+
+    // Terms scored together as one query term: one word, or every expansion of a pattern
+    struct TermGroup
+    {
+        std::vector<int> term_ids;
+        double weight = 1.0;
+    };
+
+    // Query words resolved to term IDs; unknown words are dropped
+    struct TermQuery
+    {
+        std::vector<TermGroup> plus_groups;
+        std::vector<int> plus_term_ids;     // all plus terms, sorted and unique
+        std::vector<int> minus_term_ids;    // all minus terms including expansions, sorted and unique
+        std::vector<std::vector<int>> required_term_ids;    // per required word, the sorted terms that satisfy it
+        std::vector<std::vector<int>> phrases;              // terms in order
+    };
+
+    const std::shared_ptr<const StopWords> stop_words_;        // shared by the servers of a TenantHost
+    const TextAnalysis text_analysis_;
+    TermDictionary terms_;                                      // owns the text of every indexed word, or shares a pool
+    SegmentedIndex index_{ MUTABLE_SEGMENT_DOCUMENTS, SEGMENT_MERGE_FACTOR, true };
+    std::vector<int> document_freqs_;                           // live documents per term ID
+    std::vector<DocumentSlot> document_slots_;                  // indexed by ordinal
+    std::vector<uint32_t> document_lengths_;                    // indexed words, by ordinal
+    size_t total_document_length_ = 0;                          // of the live documents
+    RelevanceModel relevance_model_ = RelevanceModel::TF_IDF;
+    bool impact_scoring_ = false;
+    double impact_average_length_ = 0;                          // new impacts are quantized with
+    bool positional_index_ = false;
+    TermFreqPrecision term_freq_precision_ = TermFreqPrecision::DOUBLE;
+    std::map<int, DocumentTerms> document_to_word_freqs_;
     std::map<int, DocumentData> documents_; // Document ID and Data (rating, status)
     std::vector<int> document_ids_;
+    DocumentStorage document_storage_ = DocumentStorage::RAW_TEXT;
+
+    // Settings most servers leave alone and the champion tier, which only large servers build;
+    // allocated by the first setter or build, so the small servers of a TenantHost go without
+    struct Extras
+    {
+        WriteAheadLog* wal = nullptr;
+        size_t max_pattern_expansion = MAX_PATTERN_EXPANSION;
+        std::unique_ptr<DeletionIndex> fuzzy_index;     // set while fuzzy search is on
+        double fuzzy_penalty = FUZZY_MATCH_PENALTY;
+        QueryPlannerThresholds planner_thresholds = GetCalibratedQueryPlannerThresholds();
+        StageProfiler* profiler = nullptr;
+        QueryLog* query_log = nullptr;
+        ChampionLists champions{ CHAMPION_LIST_SIZE, CHAMPION_MIN_DOCUMENT_SHARE };
+        size_t champions_built_for = 0;         // document count at the last build
+        std::atomic<size_t> champion_answered_queries{ 0 };
+        std::atomic<size_t> champion_fallback_queries{ 0 };
+    };
+
+    std::unique_ptr<Extras> extras_;
+
+    // The defaults until the extras are allocated
+    const Extras& GetExtras() const { return extras_ ? *extras_ : GetDefaultExtras(); }
+
+    Extras& GetMutableExtras();
+
+    static const Extras& GetDefaultExtras();
 
     bool IsStopWord(const std::string_view& word) const;
-    static bool IsValidWord(const std::string_view& word);
-    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text);
+    bool IsValidWord(const std::string_view& word) const;
+
+    // Calls function with the analyzer of text_analysis_
+    template <typename Function>
+    decltype(auto) WithAnalyzer(Function function) const { return WithTextAnalyzer(text_analysis_, function); }
+
+    // Indexed words of text, viewing text or buffer
+    void AnalyzeText(std::string_view text, std::string& buffer, std::vector<std::string_view>& words) const;
+    static std::string EncodeTermSequence(const std::vector<int>& term_ids);
+    std::string DecodeTermSequence(std::string_view encoded) const;
+
+    // Term IDs of the indexed words of a stored document, in text order
+    std::vector<int> GetTermSequence(const DocumentData& document_data) const;
+
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
     QueryWord ParseQueryWord(std::string_view text) const;
 
-    Query ParseQuery(const std::string_view& text) const;
+    Query ParseQuery(const std::string_view& text, QueryMode mode = QueryMode::ANY_WORD) const;
 
     template <class ExecutionPolicy>
     Query ParseQuery(ExecutionPolicy&& policy, const std::string& text) const;
 
-    double ComputeWordInverseDocumentFreq(const std::string_view& word) const;
+    TermQuery ResolveQuery(const Query& query) const;
 
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments
-        (std::execution::sequenced_policy, const Query& query, DocumentPredicate document_predicate) const;
+    // matches_phrases tells whether the document holds the phrases of the query, which takes a PhraseMatcher
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchResolved(const TermQuery& query, int document_id,
+        bool matches_phrases) const;
 
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments
-        (std::execution::parallel_policy, const Query& query, DocumentPredicate document_predicate) const;
+    // Number of live documents containing at least one of the terms
+    size_t ComputeDocumentFreq(const IndexSnapshot& snapshot, const std::vector<int>& term_ids) const;
+
+    CorpusStats GetCorpusStats() const;
+
+    // Calls function with the scorer of the current relevance model
+    template <typename Function>
+    decltype(auto) WithScorer(Function function) const;
+
+    template <typename Function>
+    decltype(auto) WithScorer(const CorpusStats& corpus, Function function) const;
+
+    // Quantizer of posting scores of the current relevance model with impact scoring on, otherwise empty
+    ImpactFunction MakeImpactFunction() const;
+
+    // Hands a drifted average length to the index, which requantizes the BM25 impacts in the background
+    void RequantizeDriftedImpacts();
+
+    // Positions of the terms of a document given as its term IDs in text order
+    static DocumentPositions ComputePositions(const std::vector<int>& term_sequence);
+
+    // Forward index entry of a document given as its term IDs in text order
+    DocumentTerms ComputeDocumentTerms(std::vector<int> term_sequence) const;
+
+    // Indexes the documents again, giving them ordinals in the listed order
+    void RebuildIndex(const std::vector<int>& document_ids);
+
+    std::chrono::nanoseconds TimeQueries(const std::vector<std::string>& queries) const;
+
+    QueryCost EstimateQueryCost(const TermQuery& query) const;
+
+    // Whether a query with required words goes to FindAllDocumentsConjunctive rather than to
+    // the sequential FindAllDocuments, which filters on the required words itself
+    bool IntersectsRequiredWords(const TermQuery& query) const;
+
+    void RebuildChampionLists();
+
+    // Fills the terms and posting lengths of stats
+    void DescribeQuery(const IndexSnapshot& snapshot, const TermQuery& query, QueryStats& stats) const;
+
+    // Records a search that started at start in the query log; budget is set for bounded searches
+    void LogQuery(LoggedSearch search, const std::string_view& raw_query, QueryMode mode, std::optional<DocumentStatus> status,
+        std::chrono::steady_clock::time_point start, const std::vector<Document>& documents,
+        const SearchBudget* budget = nullptr, bool is_complete = true) const;
+
+    // Bodies of the FindTopDocuments overloads, Stats being QueryStats or NoQueryStats
+    template <typename DocumentPredicate, typename Stats>
+    std::vector<Document> RunQuery(const std::string_view& raw_query, QueryMode mode,
+        DocumentPredicate document_predicate, Stats& stats) const;
+
+    template <typename ExecutionPolicy, typename DocumentPredicate, typename Stats>
+    std::vector<Document> RunQuery(ExecutionPolicy&& policy, const std::string_view& raw_query, QueryMode mode,
+        DocumentPredicate document_predicate, Stats& stats) const;
+
+    // Matched documents that can make the top, ordered by ID. Postings are scored into a dense
+    // float accumulator by the SIMD kernels (scoring_kernels.h), a threshold scan keeps the
+    // documents near the top, and only those are scored again in double. The accumulator is
+    // per thread and reused; below DENSE_SCAN_DIVISOR ordinals per posting the scan and the
+    // reset visit only the ordinals of the postings. Documents missing a required word are
+    // skipped; phrases are left to FindAllDocumentsConjunctive.
+    template <typename Scorer, typename DocumentPredicate, typename Stats>
+    std::vector<Document> FindAllDocuments(std::execution::sequenced_policy, const IndexSnapshot& snapshot, const Scorer& scorer,
+        const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const;
+
+    template <typename Scorer, typename DocumentPredicate, typename Stats>
+    std::vector<Document> FindAllDocuments(std::execution::parallel_policy, const IndexSnapshot& snapshot, const Scorer& scorer,
+        const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const;
+
+    // Documents containing a term of every required word. The postings of the required words
+    // are intersected rarest first with galloping seeks, and only the survivors are checked
+    // for phrases and scored.
+    template <typename Scorer, typename DocumentPredicate, typename Stats>
+    std::vector<Document> FindAllDocumentsConjunctive(const IndexSnapshot& snapshot, const Scorer& scorer,
+        const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const;
+
+    // Exact top documents without keeping every match: terms are scored from the highest
+    // possible contribution down, and once the remaining terms cannot lift a document into
+    // the top, new documents are no longer admitted and hopeless ones are dropped. Scanning
+    // stops early if budget runs out, which is reported through is_complete.
+    template <typename Scorer, typename DocumentPredicate, typename Stats>
+    std::vector<Document> FindTopDocumentsPruned(const IndexSnapshot& snapshot, const Scorer& scorer,
+        const TermQuery& query, DocumentPredicate document_predicate, Stats& stats,
+        const SearchBudget& budget = SearchBudget(), bool* is_complete = nullptr) const;
+
+    // Scores every document of the champion lists and of the full lists of the untiered terms
+    // exactly, seeking through the full postings in ordinal order. Gives nullopt unless no other
+    // document can reach the top; the list metadata rule out most such queries before any
+    // posting is read. Whether to try it at all is up to the query planner.
+    template <typename Scorer, typename DocumentPredicate, typename Stats>
+    std::optional<std::vector<Document>> FindTopDocumentsTiered(const IndexSnapshot& snapshot, const Scorer& scorer,
+        const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const;
+
+    // Sums the quantized posting scores into a dense integer array. Each term gets a table from
+    // impact level to its weighted score, so a posting costs one lookup and one integer add.
+    template <typename Scorer, typename DocumentPredicate, typename Stats>
+    std::vector<Document> FindTopDocumentsByImpact(const IndexSnapshot& snapshot, const Scorer& scorer,
+        const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const;
+
+    // Sorts by relevance, then rating, and keeps the first MAX_RESULT_DOCUMENT_COUNT
+    template <typename ExecutionPolicy, typename Stats>
+    std::vector<Document> SelectTopDocuments(ExecutionPolicy&& policy, std::vector<Document> documents, Stats& stats) const;
 };
 
 //--------------------------------------TEMPLATE----METHODS-----------------------------------------------
 
 template <typename StringContainer>
-SearchServer::SearchServer(const StringContainer& stop_words)
-    : stop_words_(MakeUniqueNonEmptyStrings(stop_words))
+SearchServer::SearchServer(const StringContainer& stop_words, TextAnalysis text_analysis)
+    : stop_words_(std::make_shared<const StopWords>(MakeStopWords(stop_words, text_analysis))), text_analysis_(text_analysis)
 {
-    for (const std::string& word : stop_words_)
-        if (!IsValidWord(word))
-            throw std::invalid_argument("Invalid stop word: "s + word);
 }
 
 template <class ExecutionPolicy>
@@ -144,22 +533,62 @@ void SearchServer::RemoveDocument(ExecutionPolicy&& policy, int document_id)
 {
     if (document_to_word_freqs_.count(document_id) == 0)
         return;
-    std::map<std::string, double>& doc_ref = document_to_word_freqs_.at(document_id);
+    const std::vector<int>& doc_terms = document_to_word_freqs_.at(document_id).term_ids;
 
-    std::vector<const std::string*> doc_words;
-    doc_words.reserve(doc_ref.size());
-    for (auto& p : doc_ref)
-    {
-        doc_words.push_back(&(p.first));
-    }
-    std::for_each(policy, doc_words.begin(), doc_words.end(),
-        [&](const std::string* word_ptr) { word_to_document_freqs_.at(*word_ptr).erase(document_id); });
+    std::for_each(policy, doc_terms.begin(), doc_terms.end(),
+        [&](int term_id) { --document_freqs_[term_id]; });
+
+    const uint32_t ordinal = documents_.at(document_id).ordinal;
+    document_slots_[ordinal].document_id = -1;
+    total_document_length_ -= document_lengths_[ordinal];
+    index_.RemoveDocument(ordinal);
 
     document_to_word_freqs_.erase(document_id);
     documents_.erase(document_id);
 
     const auto it_doc = std::find(document_ids_.begin(), document_ids_.end(), document_id);
     document_ids_.erase(it_doc);
+    RequantizeDriftedImpacts();
+
+    if (GetExtras().wal)
+        GetExtras().wal->LogRemove(document_id);
+}
+
+template <typename ExecutionPolicy>
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> SearchServer::MatchDocuments
+    (ExecutionPolicy&& policy, const std::string_view& raw_query, const std::vector<int>& document_ids) const
+{
+    // checked up front: an exception escaping a parallel algorithm terminates the program
+    for (int document_id : document_ids)
+    {
+        if (document_to_word_freqs_.count(document_id) == 0)
+        {
+            throw std::out_of_range("id not found in SearchServer::MatchDocuments"s);
+        }
+    }
+
+    const TermQuery query = ResolveQuery(ParseQuery(raw_query));
+    // one matcher for all documents; it only moves forward, so they are visited in ordinal order
+    std::vector<char> phrase_matches(document_ids.size(), true);
+    if (!query.phrases.empty())
+    {
+        std::vector<std::pair<uint32_t, size_t>> ordinals;
+        ordinals.reserve(document_ids.size());
+        for (size_t i = 0; i < document_ids.size(); ++i)
+        {
+            ordinals.emplace_back(documents_.at(document_ids[i]).ordinal, i);
+        }
+        std::sort(ordinals.begin(), ordinals.end());
+        PhraseMatcher phrase_matcher(index_.GetSnapshot(), query.phrases);
+        for (const auto& [ordinal, index] : ordinals)
+        {
+            phrase_matches[index] = phrase_matcher.Matches(ordinal);
+        }
+    }
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> result(document_ids.size());
+    std::transform(policy, document_ids.begin(), document_ids.end(), phrase_matches.begin(), result.begin(),
+        [this, &query](int document_id, char matches_phrases) { return MatchResolved(query, document_id, matches_phrases); });
+    return result;
 }
 
 template <class ExecutionPolicy>
@@ -179,149 +608,1282 @@ void SearchServer::Query::SortQuery(ExecutionPolicy&& policy)
         minus_words.erase(erase_from, minus_words.end());
         minus_words_sorted = true;
     }
+    for (std::vector<std::string_view>* patterns : { &plus_patterns, &minus_patterns, &required_words, &required_patterns })
+    {
+        std::sort(patterns->begin(), patterns->end());
+        patterns->erase(std::unique(patterns->begin(), patterns->end()), patterns->end());
+    }
 }
 
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(std::execution::sequenced_policy, const Query& query, DocumentPredicate document_predicate) const
+template <typename Scorer, typename DocumentPredicate, typename Stats>
+std::vector<Document> SearchServer::FindAllDocuments(std::execution::sequenced_policy, const IndexSnapshot& snapshot, const Scorer& scorer,
+    const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const
 {
-    std::map<int, double> document_to_relevance;
-    for (const std::string_view& word : query.plus_words)
+    struct ScoredGroup
+    {
+        const TermGroup* group;
+        double term_weight;
+    };
+    std::vector<ScoredGroup> groups;
+    std::vector<PostingSpan> plus_spans;        // of the scored groups
+    std::vector<PostingSpan> minus_spans;
+    size_t plus_postings = 0;
+    size_t term_count = 0;
+    for (const TermGroup& group : query.plus_groups)
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        const size_t document_freq = ComputeDocumentFreq(snapshot, group.term_ids);
+        if (document_freq == 0)
         {
             continue;
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word))
+        groups.push_back({ &group, scorer.GetTermWeight(document_freq) * group.weight });
+        term_count += group.term_ids.size();
+        for (const int term_id : group.term_ids)
         {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating))
+            for (const PostingSpan& span : snapshot.GetPostings(term_id))
             {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+                plus_spans.push_back(span);
+                plus_postings += span.size;
             }
         }
     }
+    for (const int term_id : query.minus_term_ids)
+    {
+        for (const PostingSpan& span : snapshot.GetPostings(term_id))
+            minus_spans.push_back(span);
+    }
+
+    // Reused by the queries of a thread and zero between them. Few postings reset and scan
+    // only their own slots, so the cost follows the postings rather than the corpus.
+    static thread_local std::vector<float> accumulator;
+    const uint32_t slot_count = static_cast<uint32_t>(document_slots_.size());
+    if (accumulator.size() < slot_count)
+        accumulator.resize(slot_count, 0.0f);
+    const bool dense_scan = plus_postings * DENSE_SCAN_DIVISOR >= slot_count;
 
-    for (const std::string_view& word : query.minus_words)
+    // Each required word in turn moves the count of the documents that had all the words before
+    // it, so the documents with every required word end at the last count. Counts start above
+    // those the earlier queries of the thread left, which need no reset.
+    static thread_local std::vector<uint32_t> required_counts;
+    static thread_local uint32_t required_base = 0;     // no count is above it
+    std::vector<PostingSpan> required_spans;
+    size_t rarest_begin = 0;        // spans of the rarest required word
+    size_t rarest_end = 0;
+    const uint32_t required_word_count = static_cast<uint32_t>(query.required_term_ids.size());
+    uint32_t base = 0;
+    if (required_word_count > 0)
     {
-        if (word_to_document_freqs_.count(word) == 0)
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::POSTING_SCAN);
+        if (required_counts.size() < slot_count)
+            required_counts.resize(slot_count, 0);
+        if (required_base > std::numeric_limits<uint32_t>::max() - required_word_count)
         {
-            continue;
+            std::fill(required_counts.begin(), required_counts.end(), 0);
+            required_base = 0;
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word))
+        base = required_base;
+        required_base += required_word_count;
+        size_t rarest_postings = std::numeric_limits<size_t>::max();
+        for (uint32_t word = 0; word < required_word_count; ++word)
         {
-            document_to_relevance.erase(document_id);
+            const size_t word_begin = required_spans.size();
+            size_t word_postings = 0;
+            for (const int term_id : query.required_term_ids[word])
+            {
+                for (const PostingSpan& span : snapshot.GetPostings(term_id))
+                {
+                    // without branches, which the ordinals would make unpredictable
+                    if (word == 0)
+                    {
+                        for (size_t i = 0; i < span.size; ++i)
+                            required_counts[span.ordinals[i]] = base + 1;
+                    }
+                    else
+                    {
+                        for (size_t i = 0; i < span.size; ++i)
+                            required_counts[span.ordinals[i]] += required_counts[span.ordinals[i]] == base + word;
+                    }
+                    required_spans.push_back(span);
+                    word_postings += span.size;
+                }
+            }
+            if (word_postings < rarest_postings)
+            {
+                rarest_postings = word_postings;
+                rarest_begin = word_begin;
+                rarest_end = required_spans.size();
+            }
+            if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                stats.postings_scanned += word_postings;
         }
     }
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance)
+    const auto reset_accumulator = [&]
     {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
-    }
-    return matched_documents;
-}
+        if (dense_scan)
+        {
+            std::fill(accumulator.begin(), accumulator.begin() + slot_count, 0.0f);
+            return;
+        }
+        for (const std::vector<PostingSpan>* spans : { &plus_spans, &minus_spans })
+        {
+            for (const PostingSpan& span : *spans)
+                for (size_t i = 0; i < span.size; ++i)
+                    accumulator[span.ordinals[i]] = 0.0f;
+        }
+    };
 
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments                                                                // TODO
-    (std::execution::parallel_policy, const Query& query, DocumentPredicate document_predicate) const
-{
-    ConcurrentMap<int, double> document_to_relevance(std::thread::hardware_concurrency());
+    const auto is_eligible = [&](uint32_t ordinal)
+    {
+        const DocumentSlot& slot = document_slots_[ordinal];
+        return (required_word_count == 0 || required_counts[ordinal] == base + required_word_count)
+            && slot.document_id >= 0 && document_predicate(slot.document_id, slot.status, slot.rating);
+    };
 
-    // parsing plus words    
-    ForEach(std::execution::par, query.plus_words,
-        [this, &document_to_relevance, &document_predicate](const std::string_view& word)
+    // float sums only pick the candidates, with their float relevance; it is computed again in double
+    std::vector<std::pair<uint32_t, float>> candidates;
+    try
+    {
         {
-            if (word_to_document_freqs_.count(word) != 0)
+            PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::POSTING_SCAN);
+            std::vector<uint32_t> matched;      // with stats, ordinals of the matched documents
+            size_t span_index = 0;
+            for (const ScoredGroup& group : groups)
             {
-                const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-                for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word))
+                for (size_t term = 0; term < group.group->term_ids.size(); ++term)
                 {
-                    const auto& document_data = documents_.at(document_id);
-                    if (document_predicate(document_id, document_data.status, document_data.rating))
+                    const size_t term_span_count = snapshot.GetPostings(group.group->term_ids[term]).size();
+                    for (const size_t end = span_index + term_span_count; span_index < end; ++span_index)
                     {
-                        document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
+                        // removed and filtered documents are scored too, and skipped by the scan below
+                        const PostingSpan& span = plus_spans[span_index];
+                        scorer.AccumulatePostings(span.ordinals, span.term_freqs, span.size, group.term_weight, accumulator.data());
+                        if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                        {
+                            stats.postings_scanned += span.size;
+                            for (size_t i = 0; i < span.size; ++i)
+                            {
+                                const DocumentSlot& slot = document_slots_[span.ordinals[i]];
+                                if (slot.document_id < 0)
+                                    continue;
+                                if (document_predicate(slot.document_id, slot.status, slot.rating))
+                                    matched.push_back(span.ordinals[i]);
+                                else
+                                    ++stats.filtered_by_predicate;
+                            }
+                        }
                     }
                 }
             }
-        });
+            if constexpr (COLLECTS_QUERY_STATS<Stats>)
+            {
+                std::sort(matched.begin(), matched.end());
+                matched.erase(std::unique(matched.begin(), matched.end()), matched.end());
+                stats.documents_scored += matched.size();
+                std::vector<uint32_t> removed;
+                for (const PostingSpan& span : minus_spans)
+                    removed.insert(removed.end(), span.ordinals, span.ordinals + span.size);
+                std::sort(removed.begin(), removed.end());
+                removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
+                for (const uint32_t ordinal : removed)
+                    stats.removed_by_minus_words += std::binary_search(matched.begin(), matched.end(), ordinal);
+            }
+        }
 
-    // parsing minus words
-    ForEach(std::execution::par, query.minus_words,
-        [this, &document_to_relevance](const std::string_view& word)
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::ACCUMULATION);
+        for (const PostingSpan& span : minus_spans)
         {
-            if (word_to_document_freqs_.count(word) != 0)
+            for (size_t i = 0; i < span.size; ++i)
+                accumulator[span.ordinals[i]] = -1.0f;
+        }
+
+        // A float sum of term_count nonnegative scores is within score_error of the double one,
+        // relative to either. A document can end up in the top if its relevance is within
+        // EPSILON of one within EPSILON of the last top relevance.
+        const double score_error = (term_count + 1) * FLT_EPSILON + KERNEL_SCORE_ERROR;
+        const auto lower_bound = [&](float top_relevance)
+        {
+            return static_cast<float>(top_relevance - 2 * EPSILON - 3 * score_error * top_relevance);
+        };
+
+        std::priority_queue<float, std::vector<float>, std::greater<>> top_relevances;
+        float threshold = 0.0f;
+        const auto consider = [&](uint32_t ordinal, float relevance)
+        {
+            if (!is_eligible(ordinal))
+                return;
+            candidates.emplace_back(ordinal, relevance);
+            top_relevances.push(relevance);
+            if (top_relevances.size() > MAX_RESULT_DOCUMENT_COUNT)
+                top_relevances.pop();
+            if (top_relevances.size() == MAX_RESULT_DOCUMENT_COUNT)
+                threshold = std::max(0.0f, lower_bound(top_relevances.top()));
+        };
+        const auto consider_postings = [&](const PostingSpan& span)
+        {
+            for (size_t i = 0; i < span.size; ++i)
+            {
+                // negated once seen, so a document with several terms is considered once
+                float& relevance = accumulator[span.ordinals[i]];
+                if (relevance <= threshold)
+                    continue;
+                consider(span.ordinals[i], relevance);
+                relevance = -relevance;
+            }
+        };
+        if (required_word_count > 0)
+        {
+            // every match has the rarest required word, and few documents have them all
+            std::for_each(required_spans.begin() + rarest_begin, required_spans.begin() + rarest_end, consider_postings);
+        }
+        else if (dense_scan)
+        {
+            for (uint32_t ordinal = static_cast<uint32_t>(FindAbove(accumulator.data(), 0, slot_count, threshold)); ordinal < slot_count;
+                ordinal = static_cast<uint32_t>(FindAbove(accumulator.data(), ordinal + 1, slot_count, threshold)))
+            {
+                consider(ordinal, accumulator[ordinal]);
+            }
+        }
+        else
+        {
+            std::for_each(plus_spans.begin(), plus_spans.end(), consider_postings);
+        }
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+            [&](const std::pair<uint32_t, float>& candidate) { return candidate.second <= threshold; }), candidates.end());
+
+        // documents matched with a zero relevance can still make the top
+        if (top_relevances.size() < MAX_RESULT_DOCUMENT_COUNT || lower_bound(top_relevances.top()) <= 0.0f)
+        {
+            for (const PostingSpan& span : plus_spans)
             {
-                for (const auto [document_id, _] : word_to_document_freqs_.at(word))
+                for (size_t i = 0; i < span.size; ++i)
                 {
-                    document_to_relevance[document_id].ref_to_value = 0;
+                    float& relevance = accumulator[span.ordinals[i]];
+                    if (relevance == 0.0f && is_eligible(span.ordinals[i]))
+                    {
+                        relevance = -1.0f;
+                        candidates.emplace_back(span.ordinals[i], 0.0f);
+                    }
                 }
             }
-        });
-
-    // generating ordinary map
-    std::map<int, double> ordinary_map = document_to_relevance.BuildOrdinaryMap();
-
-    // copying it to result
-    std::vector<Document> matched_documents(document_to_relevance.Size());
-    std::transform(std::execution::par, ordinary_map.begin(), ordinary_map.end(), matched_documents.begin(),
-        [this](std::pair<const int, double> pair)
-        { return Document{ pair.first, pair.second, documents_.at(pair.first).rating }; });
+        }
+    }
+    catch (...)
+    {
+        reset_accumulator();
+        throw;
+    }
+    reset_accumulator();
 
+    PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::RESULT_CONSTRUCTION);
+    std::vector<Document> matched_documents;
+    matched_documents.reserve(candidates.size());
+    for (const auto& [ordinal, float_relevance] : candidates)
+    {
+        // summed in the order the postings used to be, so the relevance is the same to the bit
+        const int document_id = document_slots_[ordinal].document_id;
+        const DocumentTerms& doc_terms = document_to_word_freqs_.at(document_id);
+        double relevance = 0;
+        for (const ScoredGroup& group : groups)
+        {
+            for (const int term_id : group.group->term_ids)
+            {
+                const auto it = std::lower_bound(doc_terms.term_ids.begin(), doc_terms.term_ids.end(), term_id);
+                if (it != doc_terms.term_ids.end() && *it == term_id)
+                {
+                    const double term_freq = doc_terms.freqs[it - doc_terms.term_ids.begin()];
+                    relevance += scorer.ScorePosting(ordinal, term_freq) * group.term_weight;
+                }
+            }
+        }
+        matched_documents.push_back({ document_id, relevance, document_slots_[ordinal].rating });
+    }
+    std::sort(matched_documents.begin(), matched_documents.end(),
+        [](const Document& lhs, const Document& rhs) { return lhs.id < rhs.id; });
     return matched_documents;
 }
 
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, DocumentPredicate document_predicate) const
+template <typename Scorer, typename DocumentPredicate, typename Stats>
+std::vector<Document> SearchServer::FindAllDocuments(std::execution::parallel_policy, const IndexSnapshot& snapshot, const Scorer& scorer,
+    const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const
 {
-    return FindTopDocuments(std::execution::seq, raw_query, document_predicate);
-}
+    ConcurrentMap<int, double> document_to_relevance(std::thread::hardware_concurrency());
+    std::atomic<size_t> postings_scanned{ 0 };
+    std::atomic<size_t> filtered_by_predicate{ 0 };
 
-template <typename ExecutionPolicy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments                                                        // TODO
-(ExecutionPolicy&& policy, const std::string_view& raw_query, DocumentPredicate document_predicate) const
-{
-    if (std::is_same_v<ExecutionPolicy, std::execution::sequenced_policy>)
+    // parsing plus words; scanning and accumulation are one step on the worker threads
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::POSTING_SCAN);
+        ForEach(std::execution::par, query.plus_groups,
+            [&](const TermGroup& group)
+            {
+                const size_t document_freq = ComputeDocumentFreq(snapshot, group.term_ids);
+                if (document_freq != 0)
+                {
+                    const double term_weight = scorer.GetTermWeight(document_freq) * group.weight;
+                    size_t group_filtered = 0;
+                    for (const int term_id : group.term_ids)
+                    {
+                        snapshot.ForEachPosting(term_id, [&](uint32_t ordinal, double term_freq)
+                            {
+                                const DocumentSlot& slot = document_slots_[ordinal];
+                                if (slot.document_id >= 0 && document_predicate(slot.document_id, slot.status, slot.rating))
+                                {
+                                    document_to_relevance[slot.document_id].ref_to_value += scorer.ScorePosting(ordinal, term_freq) * term_weight;
+                                }
+                                else if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                                {
+                                    group_filtered += slot.document_id >= 0;
+                                }
+                            });
+                        if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                        {
+                            for (const PostingSpan& span : snapshot.GetPostings(term_id))
+                                postings_scanned += span.size;
+                        }
+                    }
+                    filtered_by_predicate += group_filtered;
+                }
+            });
+    }
+    if constexpr (COLLECTS_QUERY_STATS<Stats>)
     {
-        return FindTopDocuments(raw_query, document_predicate);
+        stats.postings_scanned += postings_scanned;
+        stats.filtered_by_predicate += filtered_by_predicate;
+        stats.documents_scored += document_to_relevance.Size();
     }
-    
-    // parsing query
-    Query query = ParseQuery(std::move(raw_query));
-    query.SortQuery(std::execution::par);
 
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
+    std::vector<std::pair<int, double>> relevances;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::ACCUMULATION);
 
-    // sortig documents
-    sort(policy, matched_documents.begin(), matched_documents.end(),
-        [](const Document& lhs, const Document& rhs)                                      
+        // parsing minus words
+        for (const int term_id : query.minus_term_ids)
         {
-            if (abs(lhs.relevance - rhs.relevance) < EPSILON)
-            {
-                return lhs.rating > rhs.rating;
-            }
-            else { return lhs.relevance > rhs.relevance; }
-        });
-
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT)
-    {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+            snapshot.ForEachPosting(term_id, [&](uint32_t ordinal, double)
+                {
+                    const bool erased = document_to_relevance.Erase(document_slots_[ordinal].document_id);
+                    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                        stats.removed_by_minus_words += erased;
+                });
+        }
 
+        // ordered by ID like the sequential version, so ties are broken the same way
+        relevances = document_to_relevance.Extract(std::execution::par);
+        std::sort(std::execution::par, relevances.begin(), relevances.end());
     }
+
+    // copying it to result
+    PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::RESULT_CONSTRUCTION);
+    std::vector<Document> matched_documents(relevances.size());
+    std::transform(std::execution::par, relevances.begin(), relevances.end(), matched_documents.begin(),
+        [this](const std::pair<int, double>& pair)
+        { return Document{ pair.first, pair.second, documents_.at(pair.first).rating }; });
+
     return matched_documents;
 }
 
-template <typename ExecutionPolicy>
-std::vector<Document> SearchServer::FindTopDocuments
-    (ExecutionPolicy&& policy, const std::string_view& raw_query, DocumentStatus status) const
+template <typename Scorer, typename DocumentPredicate, typename Stats>
+std::vector<Document> SearchServer::FindAllDocumentsConjunctive(const IndexSnapshot& snapshot, const Scorer& scorer,
+    const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const
 {
-    return FindTopDocuments(policy, raw_query,
-        [status](int document_id, DocumentStatus document_status, int rating)
-        { return document_status == status; });
-}
+    std::vector<uint32_t> ordinals;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::POSTING_SCAN);
+        std::vector<std::vector<uint32_t>> expansions;     // ordinals of words satisfied by several terms
+        std::vector<PostingCursor> cursors;
+        for (const std::vector<int>& term_ids : query.required_term_ids)
+        {
+            if (term_ids.size() == 1)
+            {
+                cursors.emplace_back(snapshot.GetPostings(term_ids.front()));
+                continue;
+            }
+            std::vector<uint32_t>& expansion = expansions.emplace_back();
+            for (const int term_id : term_ids)
+            {
+                snapshot.ForEachPosting(term_id, [&expansion](uint32_t ordinal, double) { expansion.push_back(ordinal); });
+            }
+            if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                stats.postings_scanned += expansion.size();
+            std::sort(expansion.begin(), expansion.end());
+            expansion.erase(std::unique(expansion.begin(), expansion.end()), expansion.end());
+            cursors.emplace_back(std::vector<PostingSpan>{ PostingSpan{ expansion.data(), {}, expansion.size() } });
+        }
+        size_t cursor_moves = 0;
+        ordinals = IntersectPostings(std::move(cursors), &cursor_moves);
+        if constexpr (COLLECTS_QUERY_STATS<Stats>)
+            stats.postings_scanned += cursor_moves;
+    }
 
-template <typename ExecutionPolicy>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query) const
-{
-    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+    std::vector<Document> matched_documents;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::ACCUMULATION);
+        struct ScoredTerm
+        {
+            PostingCursor cursor;
+            double term_weight;
+        };
+        std::vector<ScoredTerm> scored_terms;
+        for (const TermGroup& group : query.plus_groups)
+        {
+            const size_t document_freq = ComputeDocumentFreq(snapshot, group.term_ids);
+            if (document_freq == 0)
+            {
+                continue;
+            }
+            const double term_weight = scorer.GetTermWeight(document_freq) * group.weight;
+            for (const int term_id : group.term_ids)
+            {
+                scored_terms.push_back({ PostingCursor(snapshot.GetPostings(term_id)), term_weight });
+            }
+        }
+        std::vector<PostingCursor> minus_cursors;
+        for (const int term_id : query.minus_term_ids)
+        {
+            minus_cursors.emplace_back(snapshot.GetPostings(term_id));
+        }
+        std::optional<PhraseMatcher> phrase_matcher;
+        if (!query.phrases.empty())
+        {
+            phrase_matcher.emplace(snapshot, query.phrases);
+        }
+
+        // the ordinals ascend, so every cursor only moves forward
+        for (const uint32_t ordinal : ordinals)
+        {
+            const DocumentSlot& slot = document_slots_[ordinal];
+            if (slot.document_id < 0 || !document_predicate(slot.document_id, slot.status, slot.rating))
+            {
+                if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                    stats.filtered_by_predicate += slot.document_id >= 0;
+                continue;
+            }
+            const bool has_minus_word = std::any_of(minus_cursors.begin(), minus_cursors.end(),
+                [ordinal](PostingCursor& cursor)
+                {
+                    cursor.SeekTo(ordinal);
+                    return !cursor.AtEnd() && cursor.GetOrdinal() == ordinal;
+                });
+            if (has_minus_word)
+            {
+                if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                    ++stats.removed_by_minus_words;
+                continue;
+            }
+            if (phrase_matcher && !phrase_matcher->Matches(ordinal))
+            {
+                continue;
+            }
+            double relevance = 0;
+            for (ScoredTerm& term : scored_terms)
+            {
+                term.cursor.SeekTo(ordinal);
+                if (!term.cursor.AtEnd() && term.cursor.GetOrdinal() == ordinal)
+                {
+                    relevance += scorer.ScorePosting(ordinal, term.cursor.GetTermFreq()) * term.term_weight;
+                }
+            }
+            matched_documents.push_back({ slot.document_id, relevance, slot.rating });
+        }
+        if constexpr (COLLECTS_QUERY_STATS<Stats>)
+        {
+            stats.postings_scanned += ordinals.size() * (minus_cursors.size() + scored_terms.size());
+            stats.documents_scored += matched_documents.size();
+        }
+    }
+
+    PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::RESULT_CONSTRUCTION);
+    std::sort(matched_documents.begin(), matched_documents.end(),
+        [](const Document& lhs, const Document& rhs) { return lhs.id < rhs.id; });
+    return matched_documents;
+}
+
+template <typename Scorer, typename DocumentPredicate, typename Stats>
+std::vector<Document> SearchServer::FindTopDocumentsPruned(const IndexSnapshot& snapshot, const Scorer& scorer,
+    const TermQuery& query, DocumentPredicate document_predicate, Stats& stats,
+    const SearchBudget& budget, bool* is_complete) const
+{
+    const size_t top_count = std::min<size_t>(budget.max_documents, MAX_RESULT_DOCUMENT_COUNT);
+    if (top_count == 0)
+    {
+        return {};
+    }
+    enum : uint8_t { UNSEEN, CANDIDATE, REJECTED, EXCLUDED };     // EXCLUDED: has a minus word
+    std::vector<double> relevance(document_slots_.size());
+    std::vector<uint8_t> state(document_slots_.size(), UNSEEN);
+    size_t postings_read = 0;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::POSTING_SCAN);
+        // not interrupted: stopping here would let excluded documents through
+        for (const int term_id : query.minus_term_ids)
+        {
+            for (const PostingSpan& span : snapshot.GetPostings(term_id))
+            {
+                for (size_t i = 0; i < span.size; ++i)
+                    state[span.ordinals[i]] = EXCLUDED;
+                postings_read += span.size;
+            }
+        }
+        if constexpr (COLLECTS_QUERY_STATS<Stats>)
+            stats.postings_scanned += postings_read;
+    }
+
+    struct ScoredGroup
+    {
+        const TermGroup* group;
+        double term_weight;
+        double max_score;       // no document gets more than this from the group
+    };
+    std::vector<ScoredGroup> groups;
+    for (const TermGroup& group : query.plus_groups)
+    {
+        const size_t document_freq = ComputeDocumentFreq(snapshot, group.term_ids);
+        if (document_freq == 0)
+        {
+            continue;
+        }
+        const double term_weight = scorer.GetTermWeight(document_freq) * group.weight;
+        double max_posting_score = 0;
+        for (const int term_id : group.term_ids)
+        {
+            max_posting_score += scorer.GetMaxPostingScore(snapshot.GetMaxTermFreq(term_id));
+        }
+        groups.push_back({ &group, term_weight, std::max(0.0, term_weight * scorer.CapGroupScore(max_posting_score)) });
+    }
+    std::sort(groups.begin(), groups.end(),
+        [](const ScoredGroup& lhs, const ScoredGroup& rhs) { return lhs.max_score > rhs.max_score; });
+    double remaining_score = 0;
+    for (const ScoredGroup& group : groups)
+    {
+        remaining_score += group.max_score;
+    }
+
+    std::vector<uint32_t> candidates;
+    std::vector<double> top_scores;
+    double threshold = -std::numeric_limits<double>::infinity();   // lower bound of the last top relevance
+    size_t postings_since_threshold = 0;
+    bool out_of_budget = false;
+
+    // drops the candidates that stay out of the top even if they gain reachable more
+    const auto prune_candidates = [&](double reachable)
+    {
+        top_scores.clear();
+        for (const uint32_t ordinal : candidates)
+        {
+            top_scores.push_back(relevance[ordinal]);
+        }
+        std::nth_element(top_scores.begin(), top_scores.begin() + (top_count - 1), top_scores.end(), std::greater<>());
+        threshold = top_scores[top_count - 1];
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+            [&](uint32_t ordinal)
+            {
+                if (relevance[ordinal] + reachable + EPSILON >= threshold)
+                    return false;
+                state[ordinal] = REJECTED;
+                return true;
+            }), candidates.end());
+    };
+
+    for (const ScoredGroup& group : groups)
+    {
+        // a document first seen now ends up at most at remaining_score
+        const bool admit_new = remaining_score + EPSILON >= threshold;
+        {
+            PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::POSTING_SCAN);
+            const auto score_posting = [&](uint32_t ordinal, double term_freq)
+            {
+                if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                {
+                    ++stats.postings_scanned;
+                    if (state[ordinal] == UNSEEN || state[ordinal] == EXCLUDED)
+                    {
+                        const DocumentSlot& slot = document_slots_[ordinal];
+                        const bool accepted = slot.document_id >= 0 && document_predicate(slot.document_id, slot.status, slot.rating);
+                        if (slot.document_id >= 0 && !accepted)
+                            ++stats.filtered_by_predicate;
+                        else if (accepted && state[ordinal] == EXCLUDED)
+                            ++stats.removed_by_minus_words;
+                        if (state[ordinal] == EXCLUDED)
+                            state[ordinal] = REJECTED;
+                    }
+                }
+                if (state[ordinal] == UNSEEN)
+                {
+                    const DocumentSlot& slot = document_slots_[ordinal];
+                    if (!admit_new || slot.document_id < 0 || !document_predicate(slot.document_id, slot.status, slot.rating))
+                    {
+                        state[ordinal] = REJECTED;
+                        return;
+                    }
+                    state[ordinal] = CANDIDATE;
+                    candidates.push_back(ordinal);
+                    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                        ++stats.documents_scored;
+                }
+                if (state[ordinal] == CANDIDATE)
+                {
+                    relevance[ordinal] += scorer.ScorePosting(ordinal, term_freq) * group.term_weight;
+                }
+                ++postings_since_threshold;
+            };
+            for (const int term_id : group.group->term_ids)
+            {
+                for (const PostingSpan& span : snapshot.GetPostings(term_id))
+                {
+                    for (size_t begin = 0; begin < span.size && !out_of_budget; begin += BUDGET_CHECK_POSTINGS)
+                    {
+                        out_of_budget = budget.IsExhausted(postings_read);
+                        const size_t end = out_of_budget ? begin : std::min(span.size, begin + BUDGET_CHECK_POSTINGS);
+                        for (size_t i = begin; i < end; ++i)
+                        {
+                            score_posting(span.ordinals[i], span.term_freqs[i]);
+                        }
+                        postings_read += end - begin;
+                    }
+                }
+            }
+        }
+        if (out_of_budget)
+        {
+            // only the top is returned, so the overrun past the budget stays short
+            if (candidates.size() > top_count)
+            {
+                PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::ACCUMULATION);
+                prune_candidates(0);
+            }
+            break;
+        }
+        remaining_score -= group.max_score;
+
+        // scores only grow, so the current top scores bound the final ones from below; an
+        // older threshold is still a valid bound, so it is refreshed only as often as the
+        // scan pays for it
+        if (candidates.size() >= top_count && postings_since_threshold >= candidates.size())
+        {
+            PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::ACCUMULATION);
+            postings_since_threshold = 0;
+            prune_candidates(remaining_score);
+        }
+    }
+
+    std::vector<Document> matched_documents;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::RESULT_CONSTRUCTION);
+        matched_documents.reserve(candidates.size());
+        for (const uint32_t ordinal : candidates)
+        {
+            matched_documents.push_back({ document_slots_[ordinal].document_id, relevance[ordinal], document_slots_[ordinal].rating });
+        }
+        std::sort(matched_documents.begin(), matched_documents.end(),
+            [](const Document& lhs, const Document& rhs) { return lhs.id < rhs.id; });
+    }
+    if (is_complete)
+    {
+        *is_complete = !out_of_budget;
+    }
+    return SelectTopDocuments(std::execution::seq, std::move(matched_documents), stats);
+}
+
+template <typename Scorer, typename DocumentPredicate, typename Stats>
+std::optional<std::vector<Document>> SearchServer::FindTopDocumentsTiered(const IndexSnapshot& snapshot, const Scorer& scorer,
+    const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const
+{
+    // from the list metadata alone: no document gets more than max_list_relevance from one
+    // champion list, and none outside them more than unseen_max_relevance. Unless the first
+    // is larger, a proof needs documents in several lists at once, which is rarely worth
+    // looking for, so the postings are not touched.
+    std::vector<double> term_weights;
+    double unseen_max_relevance = 0;
+    double max_list_relevance = 0;
+    for (const TermGroup& group : query.plus_groups)
+    {
+        const size_t document_freq = ComputeDocumentFreq(snapshot, group.term_ids);
+        const double term_weight = document_freq == 0 ? 0.0 : scorer.GetTermWeight(document_freq) * group.weight;
+        term_weights.push_back(term_weight);
+        double unseen_posting_score = 0;
+        for (const int term_id : group.term_ids)
+        {
+            if (const ChampionList* list = GetExtras().champions.Find(term_id))
+            {
+                unseen_posting_score += scorer.GetMaxPostingScore(list->max_other_term_freq);
+                max_list_relevance = std::max(max_list_relevance, scorer.GetMaxPostingScore(list->max_term_freq) * term_weight);
+            }
+        }
+        unseen_max_relevance += term_weight * scorer.CapGroupScore(unseen_posting_score);
+    }
+    if (max_list_relevance <= unseen_max_relevance + EPSILON)
+    {
+        ++extras_->champion_fallback_queries;
+        return std::nullopt;
+    }
+
+    // minus words are checked with cursors, so the ordinals have to ascend
+    const auto make_minus_cursors = [&]
+    {
+        std::vector<PostingCursor> cursors;
+        for (const int term_id : query.minus_term_ids)
+        {
+            cursors.emplace_back(snapshot.GetPostings(term_id));
+        }
+        return cursors;
+    };
+    const auto has_minus_word = [](std::vector<PostingCursor>& cursors, uint32_t ordinal)
+    {
+        return std::any_of(cursors.begin(), cursors.end(),
+            [ordinal](PostingCursor& cursor)
+            {
+                cursor.SeekTo(ordinal);
+                return !cursor.AtEnd() && cursor.GetOrdinal() == ordinal;
+            });
+    };
+
+    // the champion postings alone give every listed document a lower bound of its relevance
+    struct RelevanceBound
+    {
+        uint32_t ordinal;
+        double relevance;
+    };
+    std::vector<RelevanceBound> champion_relevance;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::POSTING_SCAN);
+        for (size_t i = 0; i < query.plus_groups.size(); ++i)
+        {
+            for (const int term_id : query.plus_groups[i].term_ids)
+            {
+                if (const ChampionList* list = GetExtras().champions.Find(term_id))
+                {
+                    for (const ChampionPosting& posting : list->postings)
+                    {
+                        champion_relevance.push_back(RelevanceBound{ posting.ordinal, scorer.ScorePosting(posting.ordinal, posting.term_freq) * term_weights[i] });
+                    }
+                    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                        stats.postings_scanned += list->postings.size();
+                }
+            }
+        }
+    }
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::ACCUMULATION);
+        std::sort(champion_relevance.begin(), champion_relevance.end(),
+            [](const RelevanceBound& lhs, const RelevanceBound& rhs) { return lhs.ordinal < rhs.ordinal; });
+        std::vector<PostingCursor> minus_cursors = make_minus_cursors();
+        size_t merged = 0;
+        for (size_t i = 0; i < champion_relevance.size(); ++i)
+        {
+            if (merged > 0 && champion_relevance[merged - 1].ordinal == champion_relevance[i].ordinal)
+            {
+                champion_relevance[merged - 1].relevance += champion_relevance[i].relevance;
+                continue;
+            }
+            const DocumentSlot& slot = document_slots_[champion_relevance[i].ordinal];
+            if (slot.document_id >= 0 && document_predicate(slot.document_id, slot.status, slot.rating)
+                && !has_minus_word(minus_cursors, champion_relevance[i].ordinal))
+            {
+                champion_relevance[merged++] = champion_relevance[i];
+            }
+            else
+            {
+                // kept without a bound, so later postings of the document are merged into it
+                champion_relevance[merged++] = RelevanceBound{ champion_relevance[i].ordinal, -std::numeric_limits<double>::infinity() };
+            }
+        }
+        champion_relevance.resize(merged);
+
+        // the top can only be proven if it is out of reach of the unseen documents
+        if (champion_relevance.size() >= MAX_RESULT_DOCUMENT_COUNT)
+        {
+            std::nth_element(champion_relevance.begin(), champion_relevance.begin() + (MAX_RESULT_DOCUMENT_COUNT - 1), champion_relevance.end(),
+                [](const RelevanceBound& lhs, const RelevanceBound& rhs) { return lhs.relevance > rhs.relevance; });
+        }
+        if (champion_relevance.size() < MAX_RESULT_DOCUMENT_COUNT
+            || champion_relevance[MAX_RESULT_DOCUMENT_COUNT - 1].relevance <= unseen_max_relevance + EPSILON)
+        {
+            ++extras_->champion_fallback_queries;
+            return std::nullopt;
+        }
+    }
+
+    std::vector<uint32_t> candidates;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::POSTING_SCAN);
+        for (const RelevanceBound& bound : champion_relevance)
+        {
+            candidates.push_back(bound.ordinal);
+        }
+        for (const TermGroup& group : query.plus_groups)
+        {
+            for (const int term_id : group.term_ids)
+            {
+                if (!GetExtras().champions.Find(term_id))
+                {
+                    const size_t candidate_count = candidates.size();
+                    snapshot.ForEachPosting(term_id, [&candidates](uint32_t ordinal, double) { candidates.push_back(ordinal); });
+                    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                        stats.postings_scanned += candidates.size() - candidate_count;
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    }
+
+    std::vector<Document> matched_documents;
+    {
+        // scored from the full postings, which the cursors seek through in ordinal order
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::ACCUMULATION);
+        struct ScoredTerm
+        {
+            PostingCursor cursor;
+            double term_weight;
+        };
+        std::vector<ScoredTerm> scored_terms;
+        for (size_t i = 0; i < query.plus_groups.size(); ++i)
+        {
+            for (const int term_id : query.plus_groups[i].term_ids)
+            {
+                scored_terms.push_back({ PostingCursor(snapshot.GetPostings(term_id)), term_weights[i] });
+            }
+        }
+        std::vector<PostingCursor> minus_cursors = make_minus_cursors();
+        for (const uint32_t ordinal : candidates)
+        {
+            const DocumentSlot& slot = document_slots_[ordinal];
+            if (slot.document_id < 0 || !document_predicate(slot.document_id, slot.status, slot.rating))
+            {
+                if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                    stats.filtered_by_predicate += slot.document_id >= 0;
+                continue;
+            }
+            if (has_minus_word(minus_cursors, ordinal))
+            {
+                if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                    ++stats.removed_by_minus_words;
+                continue;
+            }
+            double relevance = 0;
+            for (ScoredTerm& term : scored_terms)
+            {
+                term.cursor.SeekTo(ordinal);
+                if (!term.cursor.AtEnd() && term.cursor.GetOrdinal() == ordinal)
+                {
+                    relevance += scorer.ScorePosting(ordinal, term.cursor.GetTermFreq()) * term.term_weight;
+                }
+            }
+            matched_documents.push_back({ slot.document_id, relevance, slot.rating });
+        }
+        if constexpr (COLLECTS_QUERY_STATS<Stats>)
+        {
+            stats.postings_scanned += candidates.size() * (minus_cursors.size() + scored_terms.size());
+            stats.documents_scored += matched_documents.size();
+        }
+        std::sort(matched_documents.begin(), matched_documents.end(),
+            [](const Document& lhs, const Document& rhs) { return lhs.id < rhs.id; });
+    }
+
+    std::vector<Document> top_documents = SelectTopDocuments(std::execution::seq, std::move(matched_documents), stats);
+    double min_top_relevance = std::numeric_limits<double>::infinity();
+    for (const Document& document : top_documents)
+    {
+        min_top_relevance = std::min(min_top_relevance, document.relevance);
+    }
+    if (top_documents.size() == MAX_RESULT_DOCUMENT_COUNT && unseen_max_relevance + EPSILON < min_top_relevance)
+    {
+        ++extras_->champion_answered_queries;
+        return top_documents;
+    }
+    ++extras_->champion_fallback_queries;
+    return std::nullopt;
+}
+
+template <typename Scorer, typename DocumentPredicate, typename Stats>
+std::vector<Document> SearchServer::FindTopDocumentsByImpact(const IndexSnapshot& snapshot, const Scorer& scorer,
+    const TermQuery& query, DocumentPredicate document_predicate, Stats& stats) const
+{
+    std::vector<uint32_t> scores(document_slots_.size(), 0);
+    double scale = 0;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::POSTING_SCAN);
+        std::vector<double> term_weights(query.plus_groups.size(), 0.0);
+        double max_relevance = 0;
+        for (size_t i = 0; i < query.plus_groups.size(); ++i)
+        {
+            const TermGroup& group = query.plus_groups[i];
+            const size_t document_freq = ComputeDocumentFreq(snapshot, group.term_ids);
+            if (document_freq > 0)
+            {
+                term_weights[i] = std::max(scorer.GetTermWeight(document_freq) * group.weight, 0.0);
+                max_relevance += term_weights[i] * Scorer::MAX_POSTING_SCORE * group.term_ids.size();
+            }
+        }
+        if (max_relevance == 0)
+        {
+            // nothing to quantize, yet every posting still matches with relevance 0
+            if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                stats.plan = QueryPlan::SEQUENTIAL;
+            return SelectTopDocuments(std::execution::seq,
+                FindAllDocuments(std::execution::seq, snapshot, scorer, query, document_predicate, stats), stats);
+        }
+        // half the range, as the tables round up by one per posting
+        scale = 0.5 * std::numeric_limits<uint32_t>::max() / max_relevance;
+
+        std::array<uint32_t, 256> table;
+        for (size_t i = 0; i < query.plus_groups.size(); ++i)
+        {
+            // every posting adds at least one, so a nonzero score marks a match even for zero weights
+            table[0] = 1;
+            for (int level = 1; level < 256; ++level)
+            {
+                table[level] = 1 + static_cast<uint32_t>(std::llround(
+                    term_weights[i] * DequantizeImpact(static_cast<uint8_t>(level), Scorer::MAX_POSTING_SCORE) * scale));
+            }
+            for (const int term_id : query.plus_groups[i].term_ids)
+            {
+                for (const PostingSpan& span : snapshot.GetPostings(term_id))
+                {
+                    if (span.impacts)
+                    {
+                        for (size_t j = 0; j < span.size; ++j)
+                            scores[span.ordinals[j]] += table[span.impacts[j]];
+                    }
+                    else
+                    {
+                        for (size_t j = 0; j < span.size; ++j)
+                            scores[span.ordinals[j]] += table[QuantizeImpact(
+                                scorer.ScorePosting(span.ordinals[j], span.term_freqs[j]), Scorer::MAX_POSTING_SCORE)];
+                    }
+                    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                        stats.postings_scanned += span.size;
+                }
+            }
+        }
+    }
+
+    PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::ACCUMULATION);
+    for (const int term_id : query.minus_term_ids)
+    {
+        snapshot.ForEachPosting(term_id, [&](uint32_t ordinal, double)
+            {
+                if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                    stats.removed_by_minus_words += scores[ordinal] != 0 && document_slots_[ordinal].document_id >= 0;
+                scores[ordinal] = 0;
+            });
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> matched;     // score and ordinal
+    for (uint32_t ordinal = 0; ordinal < scores.size(); ++ordinal)
+    {
+        if (scores[ordinal] == 0)
+        {
+            continue;
+        }
+        const DocumentSlot& slot = document_slots_[ordinal];
+        if (slot.document_id >= 0 && document_predicate(slot.document_id, slot.status, slot.rating))
+        {
+            matched.emplace_back(scores[ordinal], ordinal);
+        }
+        else if constexpr (COLLECTS_QUERY_STATS<Stats>)
+        {
+            stats.filtered_by_predicate += slot.document_id >= 0;
+        }
+    }
+    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+        stats.documents_scored += matched.size();
+
+    // documents tied with the last one on relevance may still win on rating
+    if (matched.size() > MAX_RESULT_DOCUMENT_COUNT)
+    {
+        std::nth_element(matched.begin(), matched.begin() + (MAX_RESULT_DOCUMENT_COUNT - 1), matched.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
+        const double min_score = matched[MAX_RESULT_DOCUMENT_COUNT - 1].first - EPSILON * scale;
+        matched.erase(std::remove_if(matched.begin(), matched.end(),
+            [min_score](const auto& entry) { return entry.first < min_score; }), matched.end());
+    }
+
+    std::vector<Document> matched_documents;
+    matched_documents.reserve(matched.size());
+    for (const auto& [score, ordinal] : matched)
+    {
+        const DocumentSlot& slot = document_slots_[ordinal];
+        matched_documents.push_back({ slot.document_id, score / scale, slot.rating });
+    }
+    return SelectTopDocuments(std::execution::seq, std::move(matched_documents), stats);
+}
+
+template <typename Function>
+decltype(auto) SearchServer::WithScorer(Function function) const
+{
+    return WithScorer(GetCorpusStats(), function);
+}
+
+template <typename Function>
+decltype(auto) SearchServer::WithScorer(const CorpusStats& corpus, Function function) const
+{
+    if (relevance_model_ == RelevanceModel::BM25)
+    {
+        return function(Bm25Scorer(corpus));
+    }
+    return function(TfIdfScorer(corpus));
+}
+
+template <typename ExecutionPolicy, typename Stats>
+std::vector<Document> SearchServer::SelectTopDocuments(ExecutionPolicy&& policy, std::vector<Document> documents, Stats& stats) const
+{
+    PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::SORT);
+    sort(policy, documents.begin(), documents.end(),
+        [](const Document& lhs, const Document& rhs)
+        {
+            if (abs(lhs.relevance - rhs.relevance) < EPSILON)
+            {
+                return lhs.rating > rhs.rating;
+            }
+            else { return lhs.relevance > rhs.relevance; }
+        });
+
+    if (documents.size() > MAX_RESULT_DOCUMENT_COUNT)
+    {
+        documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    }
+    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+        stats.result_count = documents.size();
+    return documents;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, DocumentPredicate document_predicate) const
+{
+    return FindTopDocuments(raw_query, QueryMode::ANY_WORD, document_predicate);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, QueryMode mode, DocumentPredicate document_predicate) const
+{
+    NoQueryStats stats;
+    return RunQuery(raw_query, mode, document_predicate, stats);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, QueryMode mode,
+    DocumentPredicate document_predicate, QueryStats& stats) const
+{
+    stats = QueryStats();
+    return RunQuery(raw_query, mode, document_predicate, stats);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments
+(ExecutionPolicy&& policy, const std::string_view& raw_query, DocumentPredicate document_predicate) const
+{
+    return FindTopDocuments(policy, raw_query, QueryMode::ANY_WORD, document_predicate);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments
+(ExecutionPolicy&& policy, const std::string_view& raw_query, QueryMode mode, DocumentPredicate document_predicate) const
+{
+    NoQueryStats stats;
+    return RunQuery(policy, raw_query, mode, document_predicate, stats);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query,
+    QueryMode mode, DocumentPredicate document_predicate, QueryStats& stats) const
+{
+    stats = QueryStats();
+    return RunQuery(policy, raw_query, mode, document_predicate, stats);
+}
+
+template <typename DocumentPredicate>
+BoundedSearchResult SearchServer::FindTopDocuments(const std::string_view& raw_query, const SearchBudget& budget,
+    DocumentPredicate document_predicate) const
+{
+    const std::chrono::steady_clock::time_point start = GetExtras().query_log ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    NoQueryStats stats;
+    TermQuery term_query;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::PARSE);
+        Query query = ParseQuery(raw_query);
+        query.SortQuery(std::execution::seq);
+        term_query = ResolveQuery(query);
+    }
+    const IndexSnapshot snapshot = index_.GetSnapshot();
+
+    // the interruptible path pays for arrays as large as the corpus, so it runs only when the budget may run out
+    const QueryCost cost = EstimateQueryCost(term_query);
+    const QueryPlannerThresholds& thresholds = GetExtras().planner_thresholds;
+    bool fits_budget = cost.plus_postings + cost.minus_postings <= budget.max_postings;
+    if (fits_budget && budget.deadline != std::chrono::steady_clock::time_point::max())
+    {
+        const double remaining_ns = std::chrono::duration<double, std::nano>(budget.deadline - std::chrono::steady_clock::now()).count();
+        fits_budget = BUDGET_ESTIMATE_MARGIN * EstimateSequentialNs(cost, thresholds) < remaining_ns;
+    }
+
+    BoundedSearchResult result;
+    WithScorer([&](const auto& scorer)
+        {
+            if (!term_query.required_term_ids.empty())
+            {
+                result.documents = SelectTopDocuments(std::execution::seq,
+                    FindAllDocumentsConjunctive(snapshot, scorer, term_query, document_predicate, stats), stats);
+                return;
+            }
+            if (!fits_budget)
+            {
+                result.documents = FindTopDocumentsPruned(snapshot, scorer, term_query, document_predicate, stats, budget, &result.is_complete);
+                return;
+            }
+            switch (ChooseQueryPlan(cost, thresholds))
+            {
+            case QueryPlan::PARALLEL:
+                result.documents = SelectTopDocuments(std::execution::par,
+                    FindAllDocuments(std::execution::par, snapshot, scorer, term_query, document_predicate, stats), stats);
+                break;
+            case QueryPlan::PRUNED:
+                result.documents = FindTopDocumentsPruned(snapshot, scorer, term_query, document_predicate, stats, budget, &result.is_complete);
+                break;
+            default:
+                result.documents = SelectTopDocuments(std::execution::seq,
+                    FindAllDocuments(std::execution::seq, snapshot, scorer, term_query, document_predicate, stats), stats);
+            }
+        });
+    if (result.documents.size() > budget.max_documents)
+    {
+        result.documents.resize(budget.max_documents);
+    }
+    if (GetExtras().query_log)
+        LogQuery(LoggedSearch::BUDGETED, raw_query, QueryMode::ANY_WORD, GetFilteredStatus(document_predicate), start, result.documents, &budget, result.is_complete);
+    return result;
+}
+
+template <typename DocumentPredicate, typename Stats>
+std::vector<Document> SearchServer::RunQuery(const std::string_view& raw_query, QueryMode mode,
+    DocumentPredicate document_predicate, Stats& stats) const
+{
+    const std::chrono::steady_clock::time_point start = GetExtras().query_log ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    TermQuery term_query;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::PARSE);
+        Query query = ParseQuery(raw_query, mode);
+        query.SortQuery(std::execution::seq);
+        term_query = ResolveQuery(query);
+    }
+    const IndexSnapshot snapshot = index_.GetSnapshot();
+    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+    {
+        DescribeQuery(snapshot, term_query, stats);
+    }
+
+    std::vector<Document> documents = WithScorer([&](const auto& scorer) -> std::vector<Document>
+        {
+            if (!term_query.required_term_ids.empty())
+            {
+                if (!IntersectsRequiredWords(term_query))
+                {
+                    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                        stats.plan = QueryPlan::SEQUENTIAL;
+                    return SelectTopDocuments(std::execution::seq,
+                        FindAllDocuments(std::execution::seq, snapshot, scorer, term_query, document_predicate, stats), stats);
+                }
+                if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                    stats.plan = QueryPlan::CONJUNCTIVE;
+                return SelectTopDocuments(std::execution::seq,
+                    FindAllDocumentsConjunctive(snapshot, scorer, term_query, document_predicate, stats), stats);
+            }
+
+            if (impact_scoring_)
+            {
+                if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                    stats.plan = QueryPlan::IMPACT;
+                return FindTopDocumentsByImpact(snapshot, scorer, term_query, document_predicate, stats);
+            }
+
+            const QueryCost cost = EstimateQueryCost(term_query);
+            if (ShouldTryChampionTier(cost, GetExtras().planner_thresholds))
+            {
+                if (std::optional<std::vector<Document>> documents = FindTopDocumentsTiered(snapshot, scorer, term_query, document_predicate, stats))
+                {
+                    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                        stats.champion_tier = true;
+                    return std::move(*documents);
+                }
+            }
+
+            const QueryPlan plan = ChooseQueryPlan(cost, GetExtras().planner_thresholds);
+            if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                stats.plan = plan;
+            switch (plan)
+            {
+            case QueryPlan::PARALLEL:
+                return SelectTopDocuments(std::execution::par,
+                    FindAllDocuments(std::execution::par, snapshot, scorer, term_query, document_predicate, stats), stats);
+            case QueryPlan::PRUNED:
+                return FindTopDocumentsPruned(snapshot, scorer, term_query, document_predicate, stats);
+            default:
+                return SelectTopDocuments(std::execution::seq,
+                    FindAllDocuments(std::execution::seq, snapshot, scorer, term_query, document_predicate, stats), stats);
+            }
+        });
+    if (GetExtras().query_log)
+        LogQuery(LoggedSearch::PLANNED, raw_query, mode, GetFilteredStatus(document_predicate), start, documents);
+    return documents;
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate, typename Stats>
+std::vector<Document> SearchServer::RunQuery(ExecutionPolicy&& policy, const std::string_view& raw_query, QueryMode mode,
+    DocumentPredicate document_predicate, Stats& stats) const
+{
+    const std::chrono::steady_clock::time_point start = GetExtras().query_log ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    // parsing query
+    TermQuery term_query;
+    {
+        PROFILE_QUERY_STAGE(GetExtras().profiler, stats, SearchStage::PARSE);
+        Query query = ParseQuery(raw_query, mode);
+        query.SortQuery(policy);
+        term_query = ResolveQuery(query);
+    }
+
+    const IndexSnapshot snapshot = index_.GetSnapshot();
+    if constexpr (COLLECTS_QUERY_STATS<Stats>)
+    {
+        DescribeQuery(snapshot, term_query, stats);
+        stats.plan = std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::parallel_policy> ? QueryPlan::PARALLEL : QueryPlan::SEQUENTIAL;
+    }
+    std::vector<Document> documents = WithScorer([&](const auto& scorer)
+        {
+            // intersecting is sequential: with the work bounded by the rarest list there is little to split;
+            // a sequential search filters on the required words itself when that is cheaper
+            if (!term_query.required_term_ids.empty()
+                && (std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::parallel_policy> || IntersectsRequiredWords(term_query)))
+            {
+                if constexpr (COLLECTS_QUERY_STATS<Stats>)
+                    stats.plan = QueryPlan::CONJUNCTIVE;
+                return SelectTopDocuments(policy, FindAllDocumentsConjunctive(snapshot, scorer, term_query, document_predicate, stats), stats);
+            }
+            return SelectTopDocuments(policy, FindAllDocuments(policy, snapshot, scorer, term_query, document_predicate, stats), stats);
+        });
+    if (GetExtras().query_log)
+    {
+        const LoggedSearch search = std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::parallel_policy> ? LoggedSearch::PARALLEL : LoggedSearch::SEQUENTIAL;
+        LogQuery(search, raw_query, mode, GetFilteredStatus(document_predicate), start, documents);
+    }
+    return documents;
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments
+    (ExecutionPolicy&& policy, const std::string_view& raw_query, DocumentStatus status) const
+{
+    return FindTopDocuments(policy, raw_query, StatusFilter{ status });
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query) const
+{
+    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query, QueryMode mode) const
+{
+    return FindTopDocuments(policy, raw_query, mode, StatusFilter{ DocumentStatus::ACTUAL });
 }
\ No newline at end of file
@@ -0,0 +1,697 @@
+#include "segmented_index.h"
+#include "sorted_intersection.h"
+#include "varint.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+IndexSegment::IndexSegment(uint32_t first_ordinal, uint32_t end_ordinal, size_t document_count,
+    std::vector<int> term_ids, std::vector<uint32_t> offsets,
+    std::vector<uint32_t> ordinals, TermFreqArray term_freqs, std::vector<uint8_t> impacts,
+    std::vector<uint32_t> position_offsets, std::string positions, double impact_average_length)
+    : first_ordinal_(first_ordinal),
+    end_ordinal_(end_ordinal),
+    document_count_(document_count),
+    term_ids_(std::move(term_ids)),
+    offsets_(std::move(offsets)),
+    ordinals_(std::move(ordinals)),
+    term_freqs_(std::move(term_freqs)),
+    impacts_(std::move(impacts)),
+    position_offsets_(std::move(position_offsets)),
+    positions_(std::move(positions)),
+    max_term_freqs_(term_ids_.size()),
+    impact_average_length_(impact_average_length)
+{
+    for (size_t i = 0; i < term_ids_.size(); ++i)
+        for (uint32_t k = offsets_[i]; k < offsets_[i + 1]; ++k)
+            max_term_freqs_[i] = std::max(max_term_freqs_[i], term_freqs_[k]);
+}
+
+PostingSpan IndexSegment::GetPostings(int term_id) const
+{
+    const auto it = std::lower_bound(term_ids_.begin(), term_ids_.end(), term_id);
+    if (it == term_ids_.end() || *it != term_id)
+        return {};
+    const size_t index = it - term_ids_.begin();
+    const uint32_t begin = offsets_[index];
+    return PostingSpan{ ordinals_.data() + begin, term_freqs_.GetView() + begin, offsets_[index + 1] - begin,
+        impacts_.empty() ? nullptr : impacts_.data() + begin,
+        position_offsets_.empty() ? nullptr : position_offsets_.data() + begin, positions_.data() };
+}
+
+size_t IndexSegment::GetPositionMemoryUsage() const
+{
+    return HeapBytes(position_offsets_) + HeapBytes(positions_);
+}
+
+size_t IndexSegment::GetMemoryUsage() const
+{
+    return HeapBytes(term_ids_) + HeapBytes(offsets_) + HeapBytes(ordinals_) + term_freqs_.GetMemoryUsage()
+        + HeapBytes(impacts_) + HeapBytes(max_term_freqs_);
+}
+
+double IndexSegment::GetMaxTermFreq(int term_id) const
+{
+    const auto it = std::lower_bound(term_ids_.begin(), term_ids_.end(), term_id);
+    if (it == term_ids_.end() || *it != term_id)
+        return 0;
+    return max_term_freqs_[it - term_ids_.begin()];
+}
+
+IndexSnapshot::IndexSnapshot(std::vector<std::shared_ptr<const IndexSegment>> segments, const MutableSegment* mutable_segment)
+    : segments_(std::move(segments)),
+    mutable_segment_(mutable_segment) {}
+
+std::vector<PostingSpan> IndexSnapshot::GetPostings(int term_id) const
+{
+    std::vector<PostingSpan> result;
+    result.reserve(segments_.size() + 1);
+    for (const auto& segment : segments_)
+    {
+        const PostingSpan span = segment->GetPostings(term_id);
+        if (span.size > 0)
+            result.push_back(span);
+    }
+    const auto it = mutable_segment_->term_postings.find(term_id);
+    if (it != mutable_segment_->term_postings.end())
+    {
+        const MutableSegment::Postings& postings = it->second;
+        result.push_back(PostingSpan{ postings.ordinals.data(), postings.term_freqs.GetView(), postings.ordinals.size(),
+            postings.impacts.empty() ? nullptr : postings.impacts.data(),
+            postings.position_offsets.empty() ? nullptr : postings.position_offsets.data(), postings.positions.data() });
+    }
+    return result;
+}
+
+size_t IndexSnapshot::GetPositionMemoryUsage() const
+{
+    size_t result = 0;
+    for (const auto& segment : segments_)
+        result += segment->GetPositionMemoryUsage();
+    for (const auto& [term_id, postings] : mutable_segment_->term_postings)
+        result += HeapBytes(postings.position_offsets) + HeapBytes(postings.positions);
+    return result;
+}
+
+size_t IndexSnapshot::GetMemoryUsage() const
+{
+    // a segment shares its block with the shared_ptr control block
+    size_t result = HeapBytes(segments_);
+    for (const auto& segment : segments_)
+        result += segment->GetMemoryUsage() + HeapBlockBytes(sizeof(IndexSegment) + 2 * sizeof(int) + sizeof(void*));
+    result += HeapBytes(mutable_segment_->term_postings);
+    for (const auto& [term_id, postings] : mutable_segment_->term_postings)
+        result += HeapBytes(postings.ordinals) + postings.term_freqs.GetMemoryUsage() + HeapBytes(postings.impacts);
+    return result;
+}
+
+double IndexSnapshot::GetMaxTermFreq(int term_id) const
+{
+    double max_term_freq = 0;
+    for (const auto& segment : segments_)
+        max_term_freq = std::max(max_term_freq, segment->GetMaxTermFreq(term_id));
+    const auto it = mutable_segment_->term_postings.find(term_id);
+    if (it != mutable_segment_->term_postings.end())
+        max_term_freq = std::max(max_term_freq, it->second.max_term_freq);
+    return max_term_freq;
+}
+
+PostingCursor::PostingCursor(std::vector<PostingSpan> spans)
+    : spans_(std::move(spans))
+{
+    for (const PostingSpan& span : spans_)
+        size_ += span.size;
+    SkipExhaustedSpans();
+}
+
+void PostingCursor::Next()
+{
+    ++position_;
+    SkipExhaustedSpans();
+}
+
+void PostingCursor::SeekTo(uint32_t ordinal)
+{
+    while (!AtEnd() && spans_[span_].ordinals[spans_[span_].size - 1] < ordinal)
+    {
+        ++span_;
+        position_ = 0;
+    }
+    if (AtEnd())
+        return;
+    const PostingSpan& span = spans_[span_];
+    position_ = GallopTo(span.ordinals + position_, span.ordinals + span.size, ordinal) - span.ordinals;
+}
+
+void PostingCursor::SkipExhaustedSpans()
+{
+    while (!AtEnd() && position_ == spans_[span_].size)
+    {
+        ++span_;
+        position_ = 0;
+    }
+}
+
+std::vector<uint32_t> IntersectPostings(std::vector<PostingCursor> cursors, size_t* moves)
+{
+    std::vector<uint32_t> result;
+    if (cursors.empty())
+        return result;
+    std::sort(cursors.begin(), cursors.end(),
+        [](const PostingCursor& lhs, const PostingCursor& rhs) { return lhs.GetSize() < rhs.GetSize(); });
+
+    PostingCursor& lead = cursors.front();
+    size_t move_count = 0;
+    while (!lead.AtEnd())
+    {
+        const uint32_t ordinal = lead.GetOrdinal();
+        uint32_t next_ordinal = ordinal;
+        bool exhausted = false;
+        for (size_t i = 1; i < cursors.size() && next_ordinal == ordinal; ++i)
+        {
+            cursors[i].SeekTo(ordinal);
+            ++move_count;
+            exhausted = cursors[i].AtEnd();
+            if (exhausted)
+                break;
+            next_ordinal = cursors[i].GetOrdinal();
+        }
+        if (exhausted)
+            break;
+        ++move_count;
+        if (next_ordinal == ordinal)
+        {
+            result.push_back(ordinal);
+            lead.Next();
+        }
+        else
+        {
+            lead.SeekTo(next_ordinal);
+        }
+    }
+    if (moves)
+        *moves += move_count;
+    return result;
+}
+
+namespace
+{
+// Walks the ascending positions written as varint gaps
+class PositionReader
+{
+public:
+    explicit PositionReader(std::string_view gaps)
+        : gaps_(gaps)
+    {
+        Next();
+    }
+
+    bool AtEnd() const { return at_end_; }
+    uint32_t GetPosition() const { return position_; }
+
+    void Next()
+    {
+        at_end_ = gaps_.empty();
+        if (!at_end_)
+            position_ += static_cast<uint32_t>(ReadVarint(gaps_));
+    }
+
+private:
+    std::string_view gaps_;
+    uint32_t position_ = 0;
+    bool at_end_ = false;
+};
+}
+
+bool HasConsecutivePositions(const std::vector<std::string_view>& positions)
+{
+    if (positions.empty())
+        return true;
+    std::vector<PositionReader> readers(positions.begin(), positions.end());
+    if (readers.front().AtEnd())
+        return false;
+    // the phrase would start at start; every list is moved up to its word of that start
+    uint32_t start = readers.front().GetPosition();
+    size_t agreeing = 0;
+    for (size_t i = 0; agreeing < readers.size(); i = (i + 1) % readers.size())
+    {
+        PositionReader& reader = readers[i];
+        while (!reader.AtEnd() && reader.GetPosition() < start + i)
+            reader.Next();
+        if (reader.AtEnd())
+            return false;
+        if (reader.GetPosition() == start + i)
+        {
+            ++agreeing;
+        }
+        else
+        {
+            start = reader.GetPosition() - static_cast<uint32_t>(i);
+            agreeing = 1;
+        }
+    }
+    return true;
+}
+
+PhraseMatcher::PhraseMatcher(const IndexSnapshot& snapshot, const std::vector<std::vector<int>>& phrases)
+{
+    for (const std::vector<int>& term_ids : phrases)
+    {
+        std::vector<PostingCursor>& cursors = phrases_.emplace_back();
+        for (const int term_id : term_ids)
+        {
+            std::vector<PostingSpan> spans = snapshot.GetPostings(term_id);
+            if (std::any_of(spans.begin(), spans.end(), [](const PostingSpan& span) { return span.position_offsets == nullptr; }))
+                throw std::logic_error("The index keeps no positions"s);
+            cursors.emplace_back(std::move(spans));
+        }
+    }
+}
+
+bool PhraseMatcher::Matches(uint32_t ordinal)
+{
+    for (std::vector<PostingCursor>& cursors : phrases_)
+    {
+        positions_.clear();
+        for (PostingCursor& cursor : cursors)
+        {
+            cursor.SeekTo(ordinal);
+            if (cursor.AtEnd() || cursor.GetOrdinal() != ordinal)
+                return false;
+            positions_.push_back(cursor.GetPositions());
+        }
+        if (!HasConsecutivePositions(positions_))
+            return false;
+    }
+    return true;
+}
+
+SegmentedIndex::SegmentedIndex(size_t mutable_segment_size, size_t merge_factor, bool background_merge)
+    : mutable_segment_size_(std::max<size_t>(mutable_segment_size, 1)),
+    merge_factor_(std::max<size_t>(merge_factor, 2)),
+    background_merge_(background_merge)
+{
+}
+
+SegmentedIndex::~SegmentedIndex()
+{
+    if (merger_)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            merger_->stop = true;
+        }
+        merger_->merge_requested.notify_one();
+        merger_->thread.join();
+    }
+}
+
+void SegmentedIndex::AddDocument(uint32_t ordinal, const std::vector<int>& term_ids, const TermFreqArray& term_freqs,
+    uint32_t document_length, const DocumentPositions& positions)
+{
+    {
+        std::lock_guard lock(mutex_);
+        removed_.resize(ordinal + 1, false);
+        if (impact_function_)
+        {
+            document_lengths_.resize(ordinal + 1, 0);
+            document_lengths_[ordinal] = document_length;
+        }
+    }
+
+    if (mutable_segment_.document_count == 0)
+        mutable_segment_.first_ordinal = ordinal;
+    mutable_segment_.end_ordinal = ordinal + 1;
+    ++mutable_segment_.document_count;
+    mutable_segment_.has_positions = !positions.offsets.empty();
+    for (size_t i = 0; i < term_ids.size(); ++i)
+    {
+        const auto [it, inserted] = mutable_segment_.term_postings.try_emplace(term_ids[i]);
+        MutableSegment::Postings& postings = it->second;
+        if (inserted)
+            postings.term_freqs = TermFreqArray(term_freq_precision_);
+        postings.ordinals.push_back(ordinal);
+        postings.term_freqs.push_back(term_freqs[i]);
+        if (impact_function_)
+            postings.impacts.push_back(impact_function_(term_freqs[i], document_length, impact_average_length_));
+        if (mutable_segment_.has_positions)
+        {
+            if (postings.position_offsets.empty())
+                postings.position_offsets.push_back(0);
+            postings.positions.append(positions.bytes, positions.offsets[i], positions.offsets[i + 1] - positions.offsets[i]);
+            postings.position_offsets.push_back(static_cast<uint32_t>(postings.positions.size()));
+        }
+        postings.max_term_freq = std::max(postings.max_term_freq, term_freqs[i]);
+    }
+
+    if (mutable_segment_.document_count >= mutable_segment_size_)
+        Seal();
+}
+
+void SegmentedIndex::RemoveDocument(uint32_t ordinal)
+{
+    std::lock_guard lock(mutex_);
+    removed_[ordinal] = true;
+}
+
+void SegmentedIndex::Seal()
+{
+    if (mutable_segment_.document_count == 0)
+        return;
+
+    // removed_ and the target average are only written by this thread, so reading them needs no lock
+    std::vector<int> term_ids;
+    term_ids.reserve(mutable_segment_.term_postings.size());
+    for (const auto& [term_id, _] : mutable_segment_.term_postings)
+        term_ids.push_back(term_id);
+    std::sort(term_ids.begin(), term_ids.end());
+
+    std::vector<int> kept_term_ids;
+    std::vector<uint32_t> offsets{ 0 };
+    std::vector<uint32_t> ordinals;
+    TermFreqArray term_freqs(term_freq_precision_);
+    std::vector<uint8_t> impacts;
+    const bool has_positions = mutable_segment_.has_positions;
+    std::vector<uint32_t> position_offsets;
+    std::string positions;
+    size_t posting_count = 0;
+    size_t position_bytes = 0;
+    for (const auto& [term_id, postings] : mutable_segment_.term_postings)
+    {
+        posting_count += postings.ordinals.size();
+        position_bytes += postings.positions.size();
+    }
+    ordinals.reserve(posting_count);
+    term_freqs.reserve(posting_count);
+    if (has_positions)
+    {
+        position_offsets.reserve(posting_count + 1);
+        position_offsets.push_back(0);
+        positions.reserve(position_bytes);
+    }
+    for (const int term_id : term_ids)
+    {
+        const MutableSegment::Postings& postings = mutable_segment_.term_postings.at(term_id);
+        for (size_t i = 0; i < postings.ordinals.size(); ++i)
+        {
+            if (!removed_[postings.ordinals[i]])
+            {
+                ordinals.push_back(postings.ordinals[i]);
+                term_freqs.push_back(postings.term_freqs[i]);
+                if (!postings.impacts.empty())
+                    impacts.push_back(postings.impacts[i]);
+                if (has_positions)
+                {
+                    positions.append(postings.positions, postings.position_offsets[i], postings.position_offsets[i + 1] - postings.position_offsets[i]);
+                    position_offsets.push_back(static_cast<uint32_t>(positions.size()));
+                }
+            }
+        }
+        if (ordinals.size() != offsets.back())
+        {
+            kept_term_ids.push_back(term_id);
+            offsets.push_back(static_cast<uint32_t>(ordinals.size()));
+        }
+    }
+
+    const uint32_t first = mutable_segment_.first_ordinal;
+    const uint32_t end = mutable_segment_.end_ordinal;
+    const size_t live_count = std::count(removed_.begin() + first, removed_.begin() + end, false);
+    auto segment = std::make_shared<const IndexSegment>(first, end, live_count, std::move(kept_term_ids), std::move(offsets),
+        std::move(ordinals), std::move(term_freqs), std::move(impacts), std::move(position_offsets), std::move(positions),
+        impact_average_length_);
+    mutable_segment_ = MutableSegment{};
+
+    std::unique_lock lock(mutex_);
+    if (live_count > 0)
+        segments_.push_back(std::move(segment));
+    RequestMerge(lock);
+}
+
+void SegmentedIndex::AddSegment(std::shared_ptr<const IndexSegment> segment)
+{
+    Seal();
+    std::unique_lock lock(mutex_);
+    removed_.resize(segment->GetEndOrdinal(), false);
+    if (segment->GetDocumentCount() > 0)
+        segments_.push_back(std::move(segment));
+    RequestMerge(lock);
+}
+
+void SegmentedIndex::SetImpactFunction(ImpactFunction function, double average_length)
+{
+    std::lock_guard lock(mutex_);
+    impact_function_ = std::move(function);
+    impact_average_length_ = average_length;
+    document_lengths_.clear();
+}
+
+void SegmentedIndex::SetImpactAverageLength(double average_length)
+{
+    // the mutable segment is bounded, so sealing it keeps one average per segment at a bounded cost
+    Seal();
+    std::unique_lock lock(mutex_);
+    impact_average_length_ = average_length;
+    RequestMerge(lock);
+}
+
+void SegmentedIndex::WaitForMerges()
+{
+    std::unique_lock lock(mutex_);
+    // without a merger no merge was ever due
+    if (!merger_)
+        return;
+    merger_->merge_done.wait(lock, [this] { return !merging_ && PickMerge().empty(); });
+}
+
+void SegmentedIndex::MergeAll()
+{
+    Seal();
+    std::unique_lock lock(mutex_);
+    WaitForMerge(lock);
+    if (segments_.size() < 2)
+        return;
+
+    const std::vector<std::shared_ptr<const IndexSegment>> inputs = segments_;
+    std::shared_ptr<const IndexSegment> merged = MergeUnlocked(inputs, lock);
+    segments_.clear();
+    if (merged->GetDocumentCount() > 0)
+        segments_.push_back(std::move(merged));
+    if (merger_)
+        merger_->merge_done.notify_all();
+}
+
+void SegmentedIndex::WaitForMerge(std::unique_lock<std::mutex>& lock)
+{
+    if (merger_)
+        merger_->merge_done.wait(lock, [this] { return !merging_; });
+}
+
+void SegmentedIndex::Clear()
+{
+    std::unique_lock lock(mutex_);
+    WaitForMerge(lock);
+    segments_.clear();
+    removed_.clear();
+    document_lengths_.clear();
+    mutable_segment_ = MutableSegment{};
+}
+
+IndexSnapshot SegmentedIndex::GetSnapshot() const
+{
+    std::lock_guard lock(mutex_);
+    return IndexSnapshot{ segments_, &mutable_segment_ };
+}
+
+size_t SegmentedIndex::GetMemoryUsage() const
+{
+    const IndexSnapshot snapshot = GetSnapshot();
+    std::lock_guard lock(mutex_);
+    return snapshot.GetMemoryUsage() + HeapBytes(removed_) + HeapBytes(document_lengths_);
+}
+
+size_t SegmentedIndex::GetTier(size_t document_count) const
+{
+    size_t tier = 0;
+    for (size_t tier_size = mutable_segment_size_; document_count > tier_size; tier_size *= merge_factor_)
+        ++tier;
+    return tier;
+}
+
+std::vector<std::shared_ptr<const IndexSegment>> SegmentedIndex::PickMerge() const
+{
+    size_t run_begin = 0;
+    for (size_t i = 1; i <= segments_.size(); ++i)
+    {
+        if (i == segments_.size() || GetTier(segments_[i]->GetDocumentCount()) != GetTier(segments_[run_begin]->GetDocumentCount()))
+        {
+            if (i - run_begin >= merge_factor_)
+                return { segments_.begin() + run_begin, segments_.begin() + run_begin + merge_factor_ };
+            run_begin = i;
+        }
+    }
+    for (const auto& segment : segments_)
+    {
+        if (segment->HasImpacts() && segment->GetImpactAverageLength() != impact_average_length_)
+            return { segment };
+    }
+    return {};
+}
+
+std::shared_ptr<const IndexSegment> SegmentedIndex::MergeUnlocked(const std::vector<std::shared_ptr<const IndexSegment>>& inputs,
+    std::unique_lock<std::mutex>& lock)
+{
+    const uint32_t first = inputs.front()->GetFirstOrdinal();
+    const uint32_t end = inputs.back()->GetEndOrdinal();
+    const std::vector<bool> removed(removed_.begin() + first, removed_.begin() + end);
+    // the lengths are copied with the removal marks, since adds may reallocate them meanwhile
+    ImpactRequantization requantization;
+    if (impact_function_)
+    {
+        requantization = ImpactRequantization{ impact_function_,
+            std::vector<uint32_t>(document_lengths_.begin() + first, document_lengths_.begin() + end), impact_average_length_ };
+    }
+    merging_ = true;
+    lock.unlock();
+    std::shared_ptr<const IndexSegment> merged = MergeSegments(inputs, removed, requantization);
+    lock.lock();
+    merging_ = false;
+    return merged;
+}
+
+bool SegmentedIndex::MergeOnce(std::unique_lock<std::mutex>& lock)
+{
+    if (merging_)
+        return false;
+    const std::vector<std::shared_ptr<const IndexSegment>> inputs = PickMerge();
+    if (inputs.empty())
+        return false;
+
+    std::shared_ptr<const IndexSegment> merged = MergeUnlocked(inputs, lock);
+
+    // only merges remove segments, so the inputs are still adjacent
+    const auto pos = std::find(segments_.begin(), segments_.end(), inputs.front());
+    const auto erase_from = segments_.erase(pos, pos + inputs.size());
+    if (merged->GetDocumentCount() > 0)
+        segments_.insert(erase_from, std::move(merged));
+    if (merger_)
+        merger_->merge_done.notify_all();
+    return true;
+}
+
+void SegmentedIndex::RequestMerge(std::unique_lock<std::mutex>& lock)
+{
+    if (!background_merge_)
+    {
+        while (MergeOnce(lock)) {}
+        return;
+    }
+    // started by the first merge due, so an index that never reaches one costs no thread
+    if (!merger_)
+    {
+        if (PickMerge().empty())
+            return;
+        merger_ = std::make_unique<Merger>();
+        merger_->thread = std::thread([this] { MergeLoop(); });
+    }
+    merger_->merge_requested.notify_one();
+}
+
+void SegmentedIndex::MergeLoop()
+{
+    std::unique_lock lock(mutex_);
+    while (!merger_->stop)
+    {
+        if (!MergeOnce(lock))
+            merger_->merge_requested.wait(lock);
+    }
+}
+
+std::shared_ptr<const IndexSegment> MergeSegments
+    (const std::vector<std::shared_ptr<const IndexSegment>>& segments, const std::vector<bool>& removed,
+    const ImpactRequantization& requantization)
+{
+    const uint32_t first = segments.front()->GetFirstOrdinal();
+    const uint32_t end = segments.back()->GetEndOrdinal();
+
+    std::vector<int> term_ids;
+    size_t posting_count = 0;
+    const bool has_impacts = std::all_of(segments.begin(), segments.end(),
+        [](const auto& segment) { return segment->HasImpacts(); });
+    const bool has_positions = std::all_of(segments.begin(), segments.end(),
+        [](const auto& segment) { return segment->HasPositions(); });
+    size_t position_bytes = 0;
+    for (const auto& segment : segments)
+    {
+        const std::vector<int>& segment_terms = segment->GetTermIds();
+        std::vector<int> merged;
+        merged.reserve(term_ids.size() + segment_terms.size());
+        std::set_union(term_ids.begin(), term_ids.end(), segment_terms.begin(), segment_terms.end(), std::back_inserter(merged));
+        term_ids.swap(merged);
+        posting_count += segment->GetPostingCount();
+        position_bytes += segment->GetPositionBytes();
+    }
+
+    std::vector<int> kept_term_ids;
+    std::vector<uint32_t> offsets{ 0 };
+    std::vector<uint32_t> ordinals;
+    TermFreqArray term_freqs(segments.front()->GetTermFreqPrecision());
+    std::vector<uint8_t> impacts;
+    ordinals.reserve(posting_count);
+    term_freqs.reserve(posting_count);
+    if (has_impacts)
+        impacts.reserve(posting_count);
+    std::vector<uint32_t> position_offsets;
+    std::string positions;
+    if (has_positions)
+    {
+        position_offsets.reserve(posting_count + 1);
+        position_offsets.push_back(0);
+        positions.reserve(position_bytes);
+    }
+    for (const int term_id : term_ids)
+    {
+        // segments cover increasing ordinal ranges, so concatenation keeps postings sorted
+        for (const auto& segment : segments)
+        {
+            const PostingSpan span = segment->GetPostings(term_id);
+            const bool requantizes = has_impacts && requantization.function
+                && segment->GetImpactAverageLength() != requantization.average_length;
+            for (size_t i = 0; i < span.size; ++i)
+            {
+                if (!removed[span.ordinals[i] - first])
+                {
+                    ordinals.push_back(span.ordinals[i]);
+                    term_freqs.push_back(span.term_freqs[i]);
+                    if (requantizes)
+                    {
+                        impacts.push_back(requantization.function(span.term_freqs[i],
+                            requantization.document_lengths[span.ordinals[i] - first], requantization.average_length));
+                    }
+                    else if (has_impacts)
+                    {
+                        impacts.push_back(span.impacts[i]);
+                    }
+                    if (has_positions)
+                    {
+                        positions.append(span.GetPositions(i));
+                        position_offsets.push_back(static_cast<uint32_t>(positions.size()));
+                    }
+                }
+            }
+        }
+        if (ordinals.size() != offsets.back())
+        {
+            kept_term_ids.push_back(term_id);
+            offsets.push_back(static_cast<uint32_t>(ordinals.size()));
+        }
+    }
+
+    const size_t live_count = std::count(removed.begin(), removed.end(), false);
+    const double impact_average_length = requantization.function ? requantization.average_length
+        : segments.front()->GetImpactAverageLength();
+    return std::make_shared<const IndexSegment>(first, end, live_count, std::move(kept_term_ids), std::move(offsets),
+        std::move(ordinals), std::move(term_freqs), std::move(impacts), std::move(position_offsets), std::move(positions),
+        impact_average_length);
+}
@@ -0,0 +1,328 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "term_freqs.h"
+
+// Postings of one term inside one segment: ordinals ascending, frequencies in the same order
+struct PostingSpan
+{
+    const uint32_t* ordinals = nullptr;
+    TermFreqView term_freqs;
+    size_t size = 0;
+    const uint8_t* impacts = nullptr;   // quantized posting scores, if the index keeps them
+    const uint32_t* position_offsets = nullptr;     // if the index keeps positions, size + 1 of them
+    const char* positions = nullptr;
+
+    // Word positions of the i-th posting as varint gaps, see DocumentPositions
+    std::string_view GetPositions(size_t i) const
+    {
+        return std::string_view(positions + position_offsets[i], position_offsets[i + 1] - position_offsets[i]);
+    }
+};
+
+// Word positions of one document, term by term in the order of its term IDs. Positions of a
+// term ascend and are written as varint gaps from the previous one, the first from zero, in
+// bytes [offsets[i], offsets[i + 1]). Empty offsets mean the document comes without positions.
+struct DocumentPositions
+{
+    std::vector<uint32_t> offsets;
+    std::string bytes;
+};
+
+// Quantized score of a posting from its term frequency, the length of its document and the
+// average document length the score is normalized to
+using ImpactFunction = std::function<uint8_t(double term_freq, uint32_t document_length, double average_length)>;
+
+// Immutable, read-optimized segment: postings of all its terms in three flat arrays
+class IndexSegment
+{
+public:
+    IndexSegment(uint32_t first_ordinal, uint32_t end_ordinal, size_t document_count,
+        std::vector<int> term_ids, std::vector<uint32_t> offsets,
+        std::vector<uint32_t> ordinals, TermFreqArray term_freqs, std::vector<uint8_t> impacts = {},
+        std::vector<uint32_t> position_offsets = {}, std::string positions = {}, double impact_average_length = 0);
+
+    PostingSpan GetPostings(int term_id) const;
+
+    // Largest frequency in the postings of term_id, 0 if there are none
+    double GetMaxTermFreq(int term_id) const;
+
+    // Documents of the segment have ordinals in [first, end)
+    uint32_t GetFirstOrdinal() const { return first_ordinal_; }
+    uint32_t GetEndOrdinal() const { return end_ordinal_; }
+
+    size_t GetDocumentCount() const { return document_count_; }
+    size_t GetPostingCount() const { return ordinals_.size(); }
+    bool HasImpacts() const { return impacts_.size() == ordinals_.size(); }
+    double GetImpactAverageLength() const { return impact_average_length_; }
+    bool HasPositions() const { return position_offsets_.size() == ordinals_.size() + 1; }
+    size_t GetPositionBytes() const { return positions_.size(); }
+    TermFreqPrecision GetTermFreqPrecision() const { return term_freqs_.GetPrecision(); }
+
+    // Heap bytes of the positions and their offsets
+    size_t GetPositionMemoryUsage() const;
+
+    // Heap bytes of everything else
+    size_t GetMemoryUsage() const;
+    const std::vector<int>& GetTermIds() const { return term_ids_; }
+
+private:
+    uint32_t first_ordinal_;
+    uint32_t end_ordinal_;
+    size_t document_count_;
+    std::vector<int> term_ids_;         // sorted
+    std::vector<uint32_t> offsets_;     // postings of term_ids_[i] are [offsets_[i], offsets_[i + 1])
+    std::vector<uint32_t> ordinals_;
+    TermFreqArray term_freqs_;
+    std::vector<uint8_t> impacts_;          // empty, or one per posting
+    std::vector<uint32_t> position_offsets_;    // empty, or one per posting and one past the end
+    std::string positions_;
+    std::vector<double> max_term_freqs_;   // per entry of term_ids_
+    double impact_average_length_;          // the impacts were quantized with
+};
+
+// Small write-optimized segment that receives new documents
+struct MutableSegment
+{
+    struct Postings
+    {
+        std::vector<uint32_t> ordinals;
+        TermFreqArray term_freqs;
+        std::vector<uint8_t> impacts;
+        std::vector<uint32_t> position_offsets;     // like in IndexSegment
+        std::string positions;
+        double max_term_freq = 0;
+    };
+
+    std::unordered_map<int, Postings> term_postings;
+    bool has_positions = false;
+    uint32_t first_ordinal = 0;
+    uint32_t end_ordinal = 0;
+    size_t document_count = 0;
+};
+
+// Consistent view of the segments for one query. Keeps the sealed segments
+// alive while a background merge replaces them.
+class IndexSnapshot
+{
+public:
+    IndexSnapshot(std::vector<std::shared_ptr<const IndexSegment>> segments, const MutableSegment* mutable_segment);
+
+    // Postings of term_id in every segment, in ordinal order
+    std::vector<PostingSpan> GetPostings(int term_id) const;
+
+    // Upper bound of the frequency of term_id in any document
+    double GetMaxTermFreq(int term_id) const;
+
+    // function(ordinal, term_freq) for every posting of term_id, removed documents included
+    template <typename Function>
+    void ForEachPosting(int term_id, Function function) const
+    {
+        for (const PostingSpan& span : GetPostings(term_id))
+            for (size_t i = 0; i < span.size; ++i)
+                function(span.ordinals[i], span.term_freqs[i]);
+    }
+
+    size_t GetSegmentCount() const { return segments_.size() + (mutable_segment_->document_count > 0 ? 1 : 0); }
+
+    // Heap bytes of the positions in every segment
+    size_t GetPositionMemoryUsage() const;
+
+    // Heap bytes of the postings in every segment, positions excluded
+    size_t GetMemoryUsage() const;
+
+private:
+    std::vector<std::shared_ptr<const IndexSegment>> segments_;
+    const MutableSegment* mutable_segment_;
+};
+
+// Forward-only walk over the postings of one term in every segment of a snapshot
+class PostingCursor
+{
+public:
+    explicit PostingCursor(std::vector<PostingSpan> spans);
+
+    bool AtEnd() const { return span_ == spans_.size(); }
+    uint32_t GetOrdinal() const { return spans_[span_].ordinals[position_]; }
+    double GetTermFreq() const { return spans_[span_].term_freqs[position_]; }
+    std::string_view GetPositions() const { return spans_[span_].GetPositions(position_); }
+
+    // Postings in all spans, including the ones already passed
+    size_t GetSize() const { return size_; }
+
+    void Next();
+
+    // Moves to the first posting whose ordinal is not less than ordinal. Whole segments are
+    // skipped by their last ordinal, then the cursor gallops inside the segment.
+    void SeekTo(uint32_t ordinal);
+
+private:
+    std::vector<PostingSpan> spans_;
+    size_t size_ = 0;
+    size_t span_ = 0;
+    size_t position_ = 0;
+
+    void SkipExhaustedSpans();
+};
+
+// Ordinals present in every cursor. The rarest list leads and the others seek to its
+// ordinals, so the work is bounded by the shortest list rather than the union.
+// The number of cursor steps and seeks is added to *moves if given.
+std::vector<uint32_t> IntersectPostings(std::vector<PostingCursor> cursors, size_t* moves = nullptr);
+
+// Whether some position p has p + i in the i-th list, for every i. The lists are varint gaps as
+// in DocumentPositions and are decoded in step, each only as far as the merge needs.
+bool HasConsecutivePositions(const std::vector<std::string_view>& positions);
+
+// Checks documents for phrases, sequences of term IDs that must occur at consecutive
+// positions, through the positions kept by the index. Ordinals must be checked in
+// increasing order, since the cursors only move forward, and the snapshot must outlive it.
+class PhraseMatcher
+{
+public:
+    // Throws logic_error if a posting list of a phrase term has no positions
+    PhraseMatcher(const IndexSnapshot& snapshot, const std::vector<std::vector<int>>& phrases);
+
+    // Whether the document contains every phrase
+    bool Matches(uint32_t ordinal);
+
+private:
+    std::vector<std::vector<PostingCursor>> phrases_;
+    std::vector<std::string_view> positions_;
+};
+
+// Inverted index split into segments, LSM style.
+//
+// New documents go to the mutable segment; once it holds mutable_segment_size
+// documents it is sealed into an IndexSegment. Whenever merge_factor adjacent
+// segments of the same size tier exist, they are merged into one segment of
+// the next tier, dropping the postings of removed documents. Merges run on a
+// background thread unless background_merge is false, so the cost of an add
+// does not grow with the index; the thread starts with the first merge.
+// Ordinals must be added in increasing order.
+//
+// With an impact function the index also keeps the quantized score of every
+// posting. Each segment records the average length its impacts were quantized
+// with; once the target average changes, the merges rewrite the segments left
+// behind one at a time, so no add ever requantizes the whole index.
+class SegmentedIndex
+{
+public:
+    SegmentedIndex(size_t mutable_segment_size, size_t merge_factor, bool background_merge);
+
+    SegmentedIndex(const SegmentedIndex&) = delete;
+    SegmentedIndex& operator=(const SegmentedIndex&) = delete;
+
+    ~SegmentedIndex();
+
+    // document_length is only read with an impact function. Positions are given or not;
+    // keep to one choice for all documents.
+    void AddDocument(uint32_t ordinal, const std::vector<int>& term_ids, const TermFreqArray& term_freqs,
+        uint32_t document_length = 0, const DocumentPositions& positions = {});
+
+    // Postings stay in place and are skipped by the caller until a merge drops them
+    void RemoveDocument(uint32_t ordinal);
+
+    // Seals the mutable segment even if it is not full
+    void Seal();
+
+    // Appends a segment built elsewhere; its ordinals must follow every document added so far
+    void AddSegment(std::shared_ptr<const IndexSegment> segment);
+
+    // Blocks until no merge is pending
+    void WaitForMerges();
+
+    // Seals the mutable segment and merges every segment into one
+    void MergeAll();
+
+    // Drops all documents; ordinals may start from zero again
+    void Clear();
+
+    // Precision of the frequencies in postings added from now on; merged segments keep the
+    // precision of their first input, so switch it on an empty index
+    void SetTermFreqPrecision(TermFreqPrecision precision) { term_freq_precision_ = precision; }
+
+    // Keeps impacts computed by function, or none if it is empty; set it on an empty index
+    void SetImpactFunction(ImpactFunction function, double average_length);
+
+    // Average length new impacts are quantized with. Seals the mutable segment and leaves
+    // the sealed ones to be requantized by the merges.
+    void SetImpactAverageLength(double average_length);
+
+    IndexSnapshot GetSnapshot() const;
+
+    size_t GetSegmentCount() const { return GetSnapshot().GetSegmentCount(); }
+
+    // Heap bytes of the postings, of the removal marks and of the document lengths, positions excluded
+    size_t GetMemoryUsage() const;
+
+private:
+    const size_t mutable_segment_size_;
+    const size_t merge_factor_;
+    const bool background_merge_;
+    TermFreqPrecision term_freq_precision_ = TermFreqPrecision::DOUBLE;
+
+    // The background thread with what only it needs, allocated by the first merge due,
+    // so the many small indexes that never reach one stay small
+    struct Merger
+    {
+        std::condition_variable merge_requested;
+        std::condition_variable merge_done;
+        bool stop = false;
+        std::thread thread;
+    };
+
+    MutableSegment mutable_segment_;            // touched only by the writer thread
+    mutable std::mutex mutex_;                  // guards everything below, and impact_function_ from the merger
+    std::unique_ptr<Merger> merger_;            // written by the writer thread only
+    std::vector<std::shared_ptr<const IndexSegment>> segments_;     // in ordinal order
+    std::vector<bool> removed_;                 // indexed by ordinal
+    ImpactFunction impact_function_;            // written by the writer thread only
+    std::vector<uint32_t> document_lengths_;    // indexed by ordinal, with an impact function
+    double impact_average_length_ = 0;          // new impacts are quantized with
+    bool merging_ = false;
+
+    size_t GetTier(size_t document_count) const;
+
+    // First run of merge_factor_ adjacent segments in one tier, else the first segment with
+    // impacts of another average length, else an empty vector
+    std::vector<std::shared_ptr<const IndexSegment>> PickMerge() const;
+
+    // Merges inputs, requantizing their impacts if need be; releases the lock meanwhile
+    std::shared_ptr<const IndexSegment> MergeUnlocked(const std::vector<std::shared_ptr<const IndexSegment>>& inputs,
+        std::unique_lock<std::mutex>& lock);
+
+    // Waits for the merge of the merger thread in progress, if any
+    void WaitForMerge(std::unique_lock<std::mutex>& lock);
+
+    // Runs one merge if the policy asks for it, releasing the lock meanwhile
+    bool MergeOnce(std::unique_lock<std::mutex>& lock);
+
+    // Runs the merges due now, or hands them to the merger thread with background_merge
+    void RequestMerge(std::unique_lock<std::mutex>& lock);
+    void MergeLoop();
+};
+
+// How MergeSegments brings impacts to one average length. document_lengths is indexed like removed.
+struct ImpactRequantization
+{
+    ImpactFunction function;                // empty to copy the impacts
+    std::vector<uint32_t> document_lengths;
+    double average_length = 0;
+};
+
+// Concatenates adjacent segments, keeping only postings of ordinals not marked in removed.
+// removed is indexed by ordinal - segments.front()->GetFirstOrdinal(). Impacts quantized with
+// another average length than requantization's are computed anew.
+std::shared_ptr<const IndexSegment> MergeSegments
+    (const std::vector<std::shared_ptr<const IndexSegment>>& segments, const std::vector<bool>& removed,
+    const ImpactRequantization& requantization = {});
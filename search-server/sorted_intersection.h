@@ -0,0 +1,79 @@
+#pragma once
+#include <algorithm>
+#include <iterator>
+
+// Smallest iterator in [first, last) whose value is not less than value.
+// Probes 1, 2, 4, ... elements ahead before a binary search, so a sequence of
+// increasing lookups costs O(log distance) each instead of O(log size).
+template <typename RandomIt, typename T>
+RandomIt GallopTo(RandomIt first, RandomIt last, const T& value)
+{
+    if (first == last || !(*first < value))
+        return first;
+    typename std::iterator_traits<RandomIt>::difference_type step = 1;
+    RandomIt lo = first;
+    while (last - lo > step && *(lo + step) < value)
+    {
+        lo += step;
+        step *= 2;
+    }
+    RandomIt hi = (last - lo > step) ? lo + step + 1 : last;
+    return std::lower_bound(lo + 1, hi, value);
+}
+
+// Calls on_match(it1, it2) for every value present in both sorted ranges.
+// The shorter range drives and gallops through the longer one; ranges of similar
+// size fall back to a linear merge.
+template <typename RandomIt1, typename RandomIt2, typename OnMatch>
+void ForEachCommon(RandomIt1 first1, RandomIt1 last1, RandomIt2 first2, RandomIt2 last2, OnMatch on_match)
+{
+    const auto size1 = last1 - first1;
+    const auto size2 = last2 - first2;
+    if (size1 == 0 || size2 == 0)
+        return;
+
+    if (size1 * 8 < size2)
+    {
+        for (; first1 != last1 && first2 != last2; ++first1)
+        {
+            first2 = GallopTo(first2, last2, *first1);
+            if (first2 != last2 && !(*first1 < *first2))
+                on_match(first1, first2);
+        }
+    }
+    else if (size2 * 8 < size1)
+    {
+        for (; first2 != last2 && first1 != last1; ++first2)
+        {
+            first1 = GallopTo(first1, last1, *first2);
+            if (first1 != last1 && !(*first2 < *first1))
+                on_match(first1, first2);
+        }
+    }
+    else
+    {
+        while (first1 != last1 && first2 != last2)
+        {
+            if (*first1 < *first2)
+                ++first1;
+            else if (*first2 < *first1)
+                ++first2;
+            else
+                on_match(first1++, first2++);
+        }
+    }
+}
+
+template <typename RandomIt1, typename RandomIt2>
+bool HasCommon(RandomIt1 first1, RandomIt1 last1, RandomIt2 first2, RandomIt2 last2)
+{
+    if (last1 - first1 > last2 - first2)
+        return HasCommon(first2, last2, first1, last1);
+    for (; first1 != last1 && first2 != last2; ++first1)
+    {
+        first2 = GallopTo(first2, last2, *first1);
+        if (first2 != last2 && !(*first1 < *first2))
+            return true;
+    }
+    return false;
+}
\ No newline at end of file
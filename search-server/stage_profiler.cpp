@@ -0,0 +1,146 @@
+#include "stage_profiler.h"
+
+#include <cstring>
+#include <iomanip>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(__linux__)
+    int OpenCounter(uint32_t type, uint64_t config, int group_fd)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group_fd < 0 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+    }
+#endif
+
+    double Ratio(uint64_t numerator, uint64_t denominator)
+    {
+        return denominator == 0 ? 0.0 : static_cast<double>(numerator) / denominator;
+    }
+}
+
+StageProfiler::StageProfiler()
+{
+#if defined(__linux__)
+    // one group, so all four counters cover the same instructions
+    const uint64_t configs[] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+    for (size_t i = 0; i < fds_.size(); ++i)
+    {
+        fds_[i] = OpenCounter(PERF_TYPE_HARDWARE, configs[i], i == 0 ? -1 : fds_[0]);
+        if (fds_[i] < 0)
+        {
+            for (size_t k = 0; k < i; ++k)
+                close(fds_[k]);
+            fds_.fill(-1);
+            return;
+        }
+    }
+    group_fd_ = fds_[0];
+    ioctl(group_fd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(group_fd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+StageProfiler::~StageProfiler()
+{
+#if defined(__linux__)
+    for (const int fd : fds_)
+        if (fd >= 0)
+            close(fd);
+#endif
+}
+
+void StageProfiler::Reset()
+{
+    stages_ = {};
+}
+
+StageProfiler::Reading StageProfiler::Read() const
+{
+    Reading reading;
+#if defined(__linux__)
+    if (group_fd_ >= 0)
+    {
+        // PERF_FORMAT_GROUP: the number of counters, then their values
+        uint64_t buffer[1 + 4] = {};
+        if (read(group_fd_, buffer, sizeof(buffer)) == static_cast<ssize_t>(sizeof(buffer)))
+            std::copy(buffer + 1, buffer + 5, reading.values.begin());
+    }
+#endif
+    reading.time = std::chrono::steady_clock::now();
+    return reading;
+}
+
+void StageProfiler::Add(SearchStage stage, const Reading& start, const Reading& end)
+{
+    StageCounters& counters = stages_[static_cast<size_t>(stage)];
+    ++counters.calls;
+    counters.time += end.time - start.time;
+    counters.cycles += end.values[0] - start.values[0];
+    counters.instructions += end.values[1] - start.values[1];
+    counters.cache_misses += end.values[2] - start.values[2];
+    counters.branch_misses += end.values[3] - start.values[3];
+}
+
+void StageProfiler::Print(std::ostream& os) const
+{
+    const auto flags = os.flags();
+    os << std::left << std::setw(22) << "stage" << std::right << std::setw(10) << "calls" << std::setw(12) << "time ms";
+    if (HasHardwareCounters())
+    {
+        os << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(7) << "IPC"
+            << std::setw(14) << "LLC misses" << std::setw(14) << "branch misses";
+    }
+    os << '\n';
+    for (size_t i = 0; i < SEARCH_STAGE_COUNT; ++i)
+    {
+        const StageCounters& counters = stages_[i];
+        os << std::left << std::setw(22) << static_cast<SearchStage>(i) << std::right << std::setw(10) << counters.calls
+            << std::setw(12) << std::fixed << std::setprecision(2)
+            << std::chrono::duration<double, std::milli>(counters.time).count();
+        if (HasHardwareCounters())
+        {
+            os << std::setw(16) << counters.cycles << std::setw(16) << counters.instructions
+                << std::setw(7) << Ratio(counters.instructions, counters.cycles)
+                << std::setw(14) << counters.cache_misses << std::setw(14) << counters.branch_misses;
+        }
+        os << '\n';
+    }
+    if (!HasHardwareCounters())
+        os << "(hardware counters unavailable, time only)\n";
+    os.flags(flags);
+}
+
+std::ostream& operator<<(std::ostream& os, SearchStage stage)
+{
+    switch (stage)
+    {
+    case SearchStage::PARSE:
+        return os << "parse";
+    case SearchStage::POSTING_SCAN:
+        return os << "posting scan";
+    case SearchStage::ACCUMULATION:
+        return os << "accumulation";
+    case SearchStage::SORT:
+        return os << "sort";
+    case SearchStage::RESULT_CONSTRUCTION:
+        return os << "result construction";
+    }
+    return os;
+}
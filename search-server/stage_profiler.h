@@ -0,0 +1,115 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#include "log_duration.h"
+
+enum class SearchStage
+{
+    PARSE,                  // query parsing and term lookup
+    POSTING_SCAN,           // reading posting lists
+    ACCUMULATION,           // adding up relevances per document
+    SORT,                   // ordering matched documents
+    RESULT_CONSTRUCTION,    // building the returned documents
+};
+
+const size_t SEARCH_STAGE_COUNT = 5;
+
+struct StageCounters
+{
+    uint64_t calls = 0;
+    std::chrono::nanoseconds time{ 0 };
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t cache_misses = 0;      // last level cache
+    uint64_t branch_misses = 0;
+};
+
+// Sums hardware counters (Linux perf_event_open) and wall time per search stage
+// across queries. Counters follow the thread that created the profiler only, and
+// the profiler must not be used by several threads at once. Where perf events
+// are not available only time and calls are collected.
+class StageProfiler
+{
+public:
+    StageProfiler();
+    ~StageProfiler();
+
+    StageProfiler(const StageProfiler&) = delete;
+    StageProfiler& operator=(const StageProfiler&) = delete;
+
+    bool HasHardwareCounters() const { return group_fd_ >= 0; }
+
+    const StageCounters& GetCounters(SearchStage stage) const { return stages_[static_cast<size_t>(stage)]; }
+
+    void Reset();
+
+    // Per stage table: calls, time and counters with instructions per cycle
+    void Print(std::ostream& os) const;
+
+private:
+    friend class StageScope;
+
+    struct Reading
+    {
+        std::chrono::steady_clock::time_point time;
+        std::array<uint64_t, 4> values{};
+    };
+
+    int group_fd_ = -1;
+    std::array<int, 4> fds_{ -1, -1, -1, -1 };
+    std::array<StageCounters, SEARCH_STAGE_COUNT> stages_;
+
+    Reading Read() const;
+    void Add(SearchStage stage, const Reading& start, const Reading& end);
+};
+
+// Adds the time and counters between construction and destruction to a stage of
+// profiler, and the time alone to *stage_time; null pointers are skipped
+class StageScope
+{
+public:
+    StageScope(StageProfiler* profiler, SearchStage stage, std::chrono::nanoseconds* stage_time = nullptr)
+        : profiler_(profiler),
+        stage_(stage),
+        stage_time_(stage_time)
+    {
+        if (profiler_)
+            start_ = profiler_->Read();
+        else if (stage_time_)
+            start_.time = std::chrono::steady_clock::now();
+    }
+
+    ~StageScope()
+    {
+        if (!profiler_ && !stage_time_)
+            return;
+        StageProfiler::Reading end;
+        if (profiler_)
+        {
+            end = profiler_->Read();
+            profiler_->Add(stage_, start_, end);
+        }
+        else
+        {
+            end.time = std::chrono::steady_clock::now();
+        }
+        if (stage_time_)
+            *stage_time_ += end.time - start_.time;
+    }
+
+    StageScope(const StageScope&) = delete;
+    StageScope& operator=(const StageScope&) = delete;
+
+private:
+    StageProfiler* profiler_;
+    SearchStage stage_;
+    std::chrono::nanoseconds* stage_time_;
+    StageProfiler::Reading start_;
+};
+
+#define PROFILE_STAGE(...) StageScope UNIQUE_VAR_NAME_PROFILE(__VA_ARGS__)
+
+std::ostream& operator<<(std::ostream& os, SearchStage stage);
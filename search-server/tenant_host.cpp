@@ -0,0 +1,86 @@
+#include "tenant_host.h"
+
+#include <stdexcept>
+
+#include "string_processing.h"
+
+using namespace std::string_literals;
+
+TenantHost::TenantHost(const std::string& stop_words_text, TextAnalysis text_analysis, DocumentStorage document_storage)
+    : stop_words_(std::make_shared<const StopWords>(MakeStopWords(SplitIntoWords(stop_words_text), text_analysis))),
+    term_pool_(std::make_shared<TermPool>()),
+    text_analysis_(text_analysis),
+    document_storage_(document_storage)
+{
+}
+
+SearchServer& TenantHost::AddTenant(const std::string& tenant_id)
+{
+    const auto [it, inserted] = tenants_.emplace(tenant_id, nullptr);
+    if (!inserted)
+        throw std::invalid_argument("Tenant "s + tenant_id + " already exists"s);
+    try
+    {
+        it->second = std::make_unique<SearchServer>(stop_words_, term_pool_, text_analysis_);
+        it->second->SetDocumentStorage(document_storage_);
+    }
+    catch (...)
+    {
+        tenants_.erase(it);
+        throw;
+    }
+    return *it->second;
+}
+
+bool TenantHost::RemoveTenant(std::string_view tenant_id)
+{
+    const auto it = tenants_.find(tenant_id);
+    if (it == tenants_.end())
+        return false;
+    tenants_.erase(it);
+    return true;
+}
+
+SearchServer& TenantHost::GetTenant(std::string_view tenant_id)
+{
+    const auto it = tenants_.find(tenant_id);
+    if (it == tenants_.end())
+        throw std::out_of_range("Unknown tenant "s + std::string(tenant_id));
+    return *it->second;
+}
+
+const SearchServer& TenantHost::GetTenant(std::string_view tenant_id) const
+{
+    const auto it = tenants_.find(tenant_id);
+    if (it == tenants_.end())
+        throw std::out_of_range("Unknown tenant "s + std::string(tenant_id));
+    return *it->second;
+}
+
+std::vector<std::string> TenantHost::GetTenantIds() const
+{
+    std::vector<std::string> tenant_ids;
+    tenant_ids.reserve(tenants_.size());
+    for (const auto& [tenant_id, server] : tenants_)
+        tenant_ids.push_back(tenant_id);
+    return tenant_ids;
+}
+
+MemoryStats TenantHost::GetMemoryStats(std::string_view tenant_id) const
+{
+    return GetTenant(tenant_id).GetMemoryStats();
+}
+
+size_t TenantHost::GetTenantMemoryUsage(std::string_view tenant_id) const
+{
+    const auto it = tenants_.find(tenant_id);
+    if (it == tenants_.end())
+        throw std::out_of_range("Unknown tenant "s + std::string(tenant_id));
+    return it->second->GetMemoryStats().GetTotal() + HeapBlockBytes(sizeof(SearchServer))
+        + HeapBlockBytes(4 * sizeof(void*) + sizeof(*it)) + HeapBytes(it->first);
+}
+
+size_t TenantHost::GetSharedMemoryUsage() const
+{
+    return HeapBytes(*stop_words_) + term_pool_->GetMemoryUsage();
+}
\ No newline at end of file
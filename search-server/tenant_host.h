@@ -0,0 +1,66 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "memory_stats.h"
+#include "search_server.h"
+
+// Many small indexes, one SearchServer per tenant, in one process. Each tenant keeps
+// its own postings, forward index and documents, while one stop-word table and one
+// TermPool serve them all: a tenant pays for the term IDs of its words rather than
+// their bytes and its own arena chunk, and an empty one costs little more than its
+// SearchServer object. Tenants store documents as term IDs unless told otherwise.
+// A tenant seals every document straight into flat posting arrays and merges its
+// segments in the adding thread, so it holds no per-term hash map and no merger
+// thread; settings it never changes and the champion tier cost it one null pointer.
+//
+// Adding and removing tenants is not thread safe. Different tenants may be used from
+// different threads at once, since the pool is.
+//
+//   TenantHost host("and with"s);
+//   host.AddTenant("acme"s).AddDocument(1, "white cat"s, DocumentStatus::ACTUAL, { 5 });
+//   host.GetTenant("acme"s).FindTopDocuments("cat"s);
+class TenantHost
+{
+public:
+    explicit TenantHost(const std::string& stop_words_text, TextAnalysis text_analysis = TextAnalysis::EXACT,
+        DocumentStorage document_storage = DocumentStorage::TERM_IDS);
+
+    // Throws invalid_argument if the tenant exists
+    SearchServer& AddTenant(const std::string& tenant_id);
+
+    // Drops the tenant with its documents; its words stay in the pool. Returns false for an unknown tenant
+    bool RemoveTenant(std::string_view tenant_id);
+
+    // Throw out_of_range for an unknown tenant
+    SearchServer& GetTenant(std::string_view tenant_id);
+    const SearchServer& GetTenant(std::string_view tenant_id) const;
+
+    bool HasTenant(std::string_view tenant_id) const { return tenants_.count(tenant_id) > 0; }
+
+    size_t GetTenantCount() const { return tenants_.size(); }
+
+    // In ascending order
+    std::vector<std::string> GetTenantIds() const;
+
+    // Heap bytes of the tenant's own containers; throws out_of_range for an unknown tenant
+    MemoryStats GetMemoryStats(std::string_view tenant_id) const;
+
+    // Bytes the tenant adds to the host: its containers, its SearchServer and its entry in the host
+    size_t GetTenantMemoryUsage(std::string_view tenant_id) const;
+
+    // Heap bytes of the stop words and the pooled words, held once for every tenant
+    size_t GetSharedMemoryUsage() const;
+
+    const TermPool& GetTermPool() const { return *term_pool_; }
+
+private:
+    const std::shared_ptr<const StopWords> stop_words_;
+    const std::shared_ptr<TermPool> term_pool_;
+    const TextAnalysis text_analysis_;
+    const DocumentStorage document_storage_;
+    std::map<std::string, std::unique_ptr<SearchServer>, std::less<>> tenants_;
+};
\ No newline at end of file
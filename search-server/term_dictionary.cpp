@@ -0,0 +1,195 @@
+#include "term_dictionary.h"
+#include "memory_stats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+int TermDictionary::Add(std::string_view word)
+{
+    const int found = Find(word);
+    if (found != NOT_FOUND)
+        return found;
+
+    const int term_id = static_cast<int>(terms_.size());
+    terms_.push_back(pool_ ? pool_->Intern(word) : arena_.Store(word));
+    const auto pos = std::lower_bound(recent_ids_.begin(), recent_ids_.end(), word,
+        [this](int id, std::string_view value) { return terms_[id] < value; });
+    recent_ids_.insert(pos, term_id);
+
+    // keeps inserts into recent_ids_ cheap while merges stay rare
+    const size_t merge_threshold = std::clamp<size_t>(sorted_ids_.size() / 16, 64, 4096);
+    if (recent_ids_.size() >= merge_threshold)
+        MergeRecent();
+    return term_id;
+}
+
+int TermDictionary::Find(std::string_view word) const
+{
+    const auto less = [this](int id, std::string_view value) { return terms_[id] < value; };
+    for (const std::vector<int>* ids : { &sorted_ids_, &recent_ids_ })
+    {
+        const auto it = std::lower_bound(ids->begin(), ids->end(), word, less);
+        if (it != ids->end() && terms_[*it] == word)
+            return *it;
+    }
+    return NOT_FOUND;
+}
+
+template <typename Visitor>
+void TermDictionary::ForEachWithPrefix(std::string_view prefix, Visitor visit) const
+{
+    const auto less = [this](int id, std::string_view value) { return terms_[id] < value; };
+    const auto has_prefix = [this, prefix](int id) { return terms_[id].substr(0, prefix.size()) == prefix; };
+    auto sorted = std::lower_bound(sorted_ids_.begin(), sorted_ids_.end(), prefix, less);
+    auto recent = std::lower_bound(recent_ids_.begin(), recent_ids_.end(), prefix, less);
+    const auto sorted_end = std::partition_point(sorted, sorted_ids_.end(), has_prefix);
+    const auto recent_end = std::partition_point(recent, recent_ids_.end(), has_prefix);
+    // merges the two ranges lazily, so visiting stops without touching the rest
+    while (sorted != sorted_end || recent != recent_end)
+    {
+        const bool from_recent = sorted == sorted_end || (recent != recent_end && terms_[*recent] < terms_[*sorted]);
+        if (!visit(from_recent ? *recent++ : *sorted++))
+            return;
+    }
+}
+
+std::vector<int> TermDictionary::ExpandPrefix(std::string_view prefix, size_t limit) const
+{
+    std::vector<int> result;
+    if (limit == 0)
+        return result;
+    ForEachWithPrefix(prefix, [&](int term_id)
+        {
+            result.push_back(term_id);
+            return result.size() < limit;
+        });
+    return result;
+}
+
+std::vector<int> TermDictionary::ExpandWildcard(std::string_view pattern, size_t limit) const
+{
+    const size_t star = pattern.find('*');
+    if (star == std::string_view::npos)
+    {
+        const int term_id = Find(pattern);
+        return term_id == NOT_FOUND || limit == 0 ? std::vector<int>{} : std::vector<int>{ term_id };
+    }
+
+    // the literal part before the first '*' narrows the scan to one range
+    std::vector<int> result;
+    if (limit == 0)
+        return result;
+    ForEachWithPrefix(pattern.substr(0, star), [&](int term_id)
+        {
+            if (MatchesWildcard(pattern, terms_[term_id]))
+                result.push_back(term_id);
+            return result.size() < limit;
+        });
+    return result;
+}
+
+size_t TermDictionary::GetMemoryUsage() const
+{
+    return arena_.GetMemoryUsage() + HeapBytes(terms_) + HeapBytes(sorted_ids_) + HeapBytes(recent_ids_);
+}
+
+std::string_view WordArena::Store(std::string_view word)
+{
+    char* data;
+    if (word.size() > CHUNK_SIZE / 4)
+    {
+        // oversized words get a chunk of their own and leave the current one open
+        chunks_.push_back(std::make_unique<char[]>(word.size()));
+        arena_size_ += HeapBlockBytes(word.size());
+        data = chunks_.back().get();
+    }
+    else
+    {
+        if (word.size() > CHUNK_SIZE - chunk_used_)
+        {
+            chunks_.push_back(std::make_unique<char[]>(CHUNK_SIZE));
+            arena_size_ += HeapBlockBytes(CHUNK_SIZE);
+            current_chunk_ = chunks_.back().get();
+            chunk_used_ = 0;
+        }
+        data = current_chunk_ + chunk_used_;
+        chunk_used_ += word.size();
+    }
+    std::memcpy(data, word.data(), word.size());
+    return std::string_view(data, word.size());
+}
+
+size_t WordArena::GetMemoryUsage() const
+{
+    return arena_size_ + HeapBytes(chunks_);
+}
+
+std::string_view TermPool::Intern(std::string_view word)
+{
+    std::lock_guard lock(mutex_);
+    const auto it = words_.find(word);
+    if (it != words_.end())
+        return *it;
+    const std::string_view stored = arena_.Store(word);
+    words_.insert(stored);
+    return stored;
+}
+
+size_t TermPool::GetTermCount() const
+{
+    std::lock_guard lock(mutex_);
+    return words_.size();
+}
+
+size_t TermPool::GetMemoryUsage() const
+{
+    std::lock_guard lock(mutex_);
+    // nodes hold the next pointer, the view and its cached hash
+    return arena_.GetMemoryUsage() + words_.size() * HeapBlockBytes(sizeof(void*) + sizeof(std::string_view) + sizeof(size_t))
+        + HeapBlockBytes(words_.bucket_count() * sizeof(void*));
+}
+
+void TermDictionary::MergeRecent()
+{
+    std::vector<int> merged;
+    merged.reserve(sorted_ids_.size() + recent_ids_.size());
+    std::merge(sorted_ids_.begin(), sorted_ids_.end(), recent_ids_.begin(), recent_ids_.end(), std::back_inserter(merged),
+        [this](int lhs, int rhs) { return terms_[lhs] < terms_[rhs]; });
+    sorted_ids_.swap(merged);
+    recent_ids_.clear();
+}
+
+bool MatchesWildcard(std::string_view pattern, std::string_view word)
+{
+    size_t p = 0;
+    size_t w = 0;
+    size_t star_p = std::string_view::npos;
+    size_t star_w = 0;
+    while (w < word.size())
+    {
+        if (p < pattern.size() && pattern[p] == '*')
+        {
+            star_p = p++;
+            star_w = w;
+        }
+        else if (p < pattern.size() && pattern[p] == word[w])
+        {
+            ++p;
+            ++w;
+        }
+        else if (star_p != std::string_view::npos)
+        {
+            // let the last '*' swallow one more character and retry
+            p = star_p + 1;
+            w = ++star_w;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Word bytes back to back in large chunks; views of stored words stay valid for its lifetime
+class WordArena
+{
+public:
+    WordArena() = default;
+    WordArena(const WordArena&) = delete;
+    WordArena& operator=(const WordArena&) = delete;
+
+    std::string_view Store(std::string_view word);
+
+    // Heap bytes of the chunks, including unused space
+    size_t GetMemoryUsage() const;
+
+private:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* current_chunk_ = nullptr;     // chunk that small words are appended to
+    size_t chunk_used_ = CHUNK_SIZE;    // bytes taken in current_chunk_
+    size_t arena_size_ = 0;            // heap bytes of the chunks
+};
+
+// Words shared by the dictionaries of many indexes, each stored once. Thread safe and
+// append-only: a word stays until the pool goes, so its views never dangle.
+class TermPool
+{
+public:
+    TermPool() = default;
+    TermPool(const TermPool&) = delete;
+    TermPool& operator=(const TermPool&) = delete;
+
+    // View of the pooled copy of word, adding it first if needed
+    std::string_view Intern(std::string_view word);
+
+    size_t GetTermCount() const;
+
+    // Heap bytes of the words and their hash table
+    size_t GetMemoryUsage() const;
+
+private:
+    mutable std::mutex mutex_;
+    WordArena arena_;
+    std::unordered_set<std::string_view> words_;
+};
+
+// Interned, append-only set of words with dense integer IDs.
+//
+// Word bytes live back to back in large arena chunks, so a term costs its
+// length plus a string_view and one sorted-position entry, instead of a tree
+// node and a std::string. IDs are kept in lexicographic order of their words:
+// a large sorted array plus a small sorted array of recent additions that is
+// merged in once it grows. Prefix and wildcard expansion are range scans.
+//
+// Dictionaries given a TermPool keep their words there instead, so many small
+// ones share the bytes of common words and no arena chunk of their own. IDs
+// stay dense per dictionary.
+class TermDictionary
+{
+public:
+    static const int NOT_FOUND = -1;
+
+    explicit TermDictionary(std::shared_ptr<TermPool> pool = nullptr)
+        : pool_(std::move(pool)) {}
+    TermDictionary(const TermDictionary&) = delete;
+    TermDictionary& operator=(const TermDictionary&) = delete;
+
+    // Returns the ID of word, interning it first if needed
+    int Add(std::string_view word);
+
+    int Find(std::string_view word) const;
+
+    std::string_view GetTerm(int term_id) const { return terms_[term_id]; }
+
+    // Term ID -> word table, indexed by term ID; invalidated by Add
+    const std::string_view* GetTermsData() const { return terms_.data(); }
+
+    size_t GetTermCount() const { return terms_.size(); }
+
+    // IDs of the words starting with prefix, in lexicographic order, at most limit of them
+    std::vector<int> ExpandPrefix(std::string_view prefix, size_t limit) const;
+
+    // IDs of the words matching pattern, where '*' stands for any sequence of characters, at most
+    // limit of them. The words starting with the literal part before the first '*' are examined
+    // until limit match, so a pattern with a leading '*' may scan the whole dictionary.
+    std::vector<int> ExpandWildcard(std::string_view pattern, size_t limit) const;
+
+    // Heap bytes held by the dictionary, including unused arena space; the pool is not counted
+    size_t GetMemoryUsage() const;
+
+private:
+    std::shared_ptr<TermPool> pool_;    // holds the words if set, otherwise arena_ does
+    WordArena arena_;
+    std::vector<std::string_view> terms_;
+    std::vector<int> sorted_ids_;       // bulk of the IDs in word order
+    std::vector<int> recent_ids_;       // recently added IDs in word order
+
+    void MergeRecent();
+
+    // Calls visit with the IDs of the words starting with prefix in lexicographic order,
+    // until it returns false
+    template <typename Visitor>
+    void ForEachWithPrefix(std::string_view prefix, Visitor visit) const;
+};
+
+// '*' in pattern matches any (possibly empty) sequence of characters
+bool MatchesWildcard(std::string_view pattern, std::string_view word);
@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "memory_stats.h"
+
+// How term frequencies are kept in the forward index and the postings
+enum class TermFreqPrecision
+{
+    DOUBLE,
+    FLOAT,
+    QUANTIZED_16,   // 16 bit floating point code, relative error below 2.5e-4
+};
+
+// 16 bit code of a frequency in (0, 1]: how far its binary exponent is below zero in 5 bits,
+// then the top 11 bits of the mantissa, rounded to nearest. The relative error stays below
+// 2.5e-4; frequencies under 2^-31 become 2^-31. A decoded code encodes back to itself.
+inline uint16_t EncodeTermFreq16(double term_freq)
+{
+    const float value = std::clamp(static_cast<float>(term_freq), 1.0f / (1u << 31), 1.0f);
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits += 1u << 11;   // a carry out of the mantissa raises the exponent, as rounding should
+    const uint32_t exponent = 127 - (bits >> 23);
+    return static_cast<uint16_t>((exponent << 11) | ((bits >> 12) & 0x7FF));
+}
+
+inline double DecodeTermFreq16(uint16_t code)
+{
+    const uint32_t bits = ((127u - (code >> 11)) << 23) | (static_cast<uint32_t>(code & 0x7FF) << 12);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline size_t GetTermFreqSize(TermFreqPrecision precision)
+{
+    switch (precision)
+    {
+    case TermFreqPrecision::FLOAT:
+        return sizeof(float);
+    case TermFreqPrecision::QUANTIZED_16:
+        return sizeof(uint16_t);
+    default:
+        return sizeof(double);
+    }
+}
+
+// Term frequencies stored with some precision, decoded on access
+class TermFreqView
+{
+public:
+    TermFreqView() = default;
+
+    TermFreqView(const unsigned char* data, TermFreqPrecision precision)
+        : data_(data),
+        precision_(precision) {}
+
+    double operator[](size_t i) const
+    {
+        switch (precision_)
+        {
+        case TermFreqPrecision::FLOAT:
+        {
+            float value;
+            std::memcpy(&value, data_ + i * sizeof(float), sizeof(value));
+            return value;
+        }
+        case TermFreqPrecision::QUANTIZED_16:
+        {
+            uint16_t code;
+            std::memcpy(&code, data_ + i * sizeof(uint16_t), sizeof(code));
+            return DecodeTermFreq16(code);
+        }
+        default:
+        {
+            double value;
+            std::memcpy(&value, data_ + i * sizeof(double), sizeof(value));
+            return value;
+        }
+        }
+    }
+
+    TermFreqView operator+(size_t offset) const { return TermFreqView(data_ + offset * GetTermFreqSize(precision_), precision_); }
+
+    const unsigned char* GetData() const { return data_; }
+    TermFreqPrecision GetPrecision() const { return precision_; }
+
+private:
+    const unsigned char* data_ = nullptr;
+    TermFreqPrecision precision_ = TermFreqPrecision::DOUBLE;
+};
+
+// Growable array of term frequencies, encoded with a precision chosen up front
+class TermFreqArray
+{
+public:
+    explicit TermFreqArray(TermFreqPrecision precision = TermFreqPrecision::DOUBLE)
+        : precision_(precision) {}
+
+    TermFreqPrecision GetPrecision() const { return precision_; }
+
+    size_t size() const { return bytes_.size() / GetTermFreqSize(precision_); }
+    bool empty() const { return bytes_.empty(); }
+    void reserve(size_t count) { bytes_.reserve(count * GetTermFreqSize(precision_)); }
+
+    double operator[](size_t i) const { return GetView()[i]; }
+
+    void push_back(double term_freq)
+    {
+        switch (precision_)
+        {
+        case TermFreqPrecision::FLOAT:
+            Append(static_cast<float>(term_freq));
+            break;
+        case TermFreqPrecision::QUANTIZED_16:
+            Append(EncodeTermFreq16(term_freq));
+            break;
+        default:
+            Append(term_freq);
+            break;
+        }
+    }
+
+    TermFreqView GetView() const { return TermFreqView(bytes_.data(), precision_); }
+
+    size_t GetMemoryUsage() const { return HeapBytes(bytes_); }
+
+private:
+    TermFreqPrecision precision_;
+    std::vector<unsigned char> bytes_;
+
+    template <typename T>
+    void Append(T value)
+    {
+        const size_t size = bytes_.size();
+        bytes_.resize(size + sizeof(T));
+        std::memcpy(bytes_.data() + size, &value, sizeof(T));
+    }
+};
\ No newline at end of file
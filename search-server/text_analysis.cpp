@@ -0,0 +1,251 @@
+#include "text_analysis.h"
+
+#include <array>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+// Simple case folding of every code point written with at most two bytes
+constexpr std::array<uint16_t, 0x800> MakeFoldTable()
+{
+    std::array<uint16_t, 0x800> table{};
+    for (uint16_t code_point = 0; code_point < table.size(); ++code_point)
+        table[code_point] = code_point;
+    const auto shift = [&table](uint16_t first, uint16_t last, int offset)
+    {
+        for (uint16_t code_point = first; code_point <= last; ++code_point)
+            table[code_point] = static_cast<uint16_t>(code_point + offset);
+    };
+    // upper case letters at the even or the odd code points of a range, each followed by its lower case
+    const auto pairs = [&table](uint16_t first, uint16_t last)
+    {
+        for (uint16_t code_point = first; code_point < last; code_point += 2)
+            table[code_point] = static_cast<uint16_t>(code_point + 1);
+    };
+
+    shift('A', 'Z', 0x20);
+    table[0x00B5] = 0x03BC;     // micro sign
+    shift(0x00C0, 0x00D6, 0x20);
+    shift(0x00D8, 0x00DE, 0x20);
+
+    pairs(0x0100, 0x012F);
+    pairs(0x0132, 0x0137);
+    pairs(0x0139, 0x0148);
+    pairs(0x014A, 0x0177);
+    table[0x0178] = 0x00FF;
+    pairs(0x0179, 0x017E);
+    table[0x017F] = 's';        // long s
+
+    pairs(0x0370, 0x0373);
+    table[0x0376] = 0x0377;
+    table[0x037F] = 0x03F3;
+    table[0x0386] = 0x03AC;
+    shift(0x0388, 0x038A, 0x25);
+    table[0x038C] = 0x03CC;
+    shift(0x038E, 0x038F, 0x3F);
+    shift(0x0391, 0x03A1, 0x20);
+    shift(0x03A3, 0x03AB, 0x20);
+    table[0x03C2] = 0x03C3;     // final sigma
+    table[0x03CF] = 0x03D7;
+    table[0x03D0] = 0x03B2;
+    table[0x03D1] = 0x03B8;
+    table[0x03D5] = 0x03C6;
+    table[0x03D6] = 0x03C0;
+    pairs(0x03D8, 0x03EF);
+    table[0x03F0] = 0x03BA;
+    table[0x03F1] = 0x03C1;
+    table[0x03F4] = 0x03B8;
+    table[0x03F5] = 0x03B5;
+    table[0x03F7] = 0x03F8;
+    table[0x03F9] = 0x03F2;
+    table[0x03FA] = 0x03FB;
+    shift(0x03FD, 0x03FF, -0x82);
+
+    shift(0x0400, 0x040F, 0x50);
+    shift(0x0410, 0x042F, 0x20);
+    pairs(0x0460, 0x0481);
+    pairs(0x048A, 0x04BF);
+    table[0x04C0] = 0x04CF;
+    pairs(0x04C1, 0x04CE);
+    pairs(0x04D0, 0x052F);
+
+    shift(0x0531, 0x0556, 0x30);
+    return table;
+}
+
+constexpr std::array<uint16_t, 0x800> FOLD_TABLE = MakeFoldTable();
+
+bool IsContinuationByte(unsigned char c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
+// Code point of a well-formed two-byte sequence at pos, or -1
+int DecodeTwoByteSequence(std::string_view text, size_t pos)
+{
+    const unsigned char lead = text[pos];
+    if (lead < 0xC2 || lead > 0xDF || pos + 1 >= text.size() || !IsContinuationByte(text[pos + 1]))
+        return -1;
+    return ((lead & 0x1F) << 6) | (text[pos + 1] & 0x3F);
+}
+
+// Position of the first byte at or after pos that is an upper case ASCII letter or not ASCII
+size_t FindFoldCandidate(std::string_view text, size_t pos)
+{
+#ifdef __SSE2__
+    for (; pos + 16 <= text.size(); pos += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + pos));
+        // bytes from 0x80 on are negative, so they never compare as upper case
+        const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(chunk, _mm_set1_epi8('Z' + 1)));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(upper, chunk));
+        if (mask != 0)
+            return pos + __builtin_ctz(mask);
+    }
+#endif
+    for (; pos < text.size(); ++pos)
+    {
+        const unsigned char c = text[pos];
+        if (c >= 0x80 || (c >= 'A' && c <= 'Z'))
+            return pos;
+    }
+    return pos;
+}
+
+// Position of the first byte at or after pos that folding changes
+size_t FindFoldedByte(std::string_view text, size_t pos)
+{
+    while ((pos = FindFoldCandidate(text, pos)) < text.size())
+    {
+        if (static_cast<unsigned char>(text[pos]) < 0x80)
+            return pos;
+        const int code_point = DecodeTwoByteSequence(text, pos);
+        if (code_point >= 0 && FOLD_TABLE[code_point] != code_point)
+            return pos;
+        pos += code_point >= 0 ? 2 : 1;
+    }
+    return pos;
+}
+}
+
+void SplitOnSpaces::Split(std::string_view text, std::vector<std::string_view>& words)
+{
+    while (true)
+    {
+        const size_t word_begin = text.find_first_not_of(' ');
+        if (word_begin == text.npos)
+            return;
+        text.remove_prefix(word_begin);
+        const size_t word_end = std::min(text.find(' '), text.size());
+        words.push_back(text.substr(0, word_end));
+        text.remove_prefix(word_end);
+    }
+}
+
+bool RejectInvalidUtf8::Accepts(std::string_view word)
+{
+    for (size_t pos = 0; pos < word.size();)
+    {
+        const unsigned char lead = word[pos];
+        if (lead < 0x80)
+        {
+            ++pos;
+            continue;
+        }
+        size_t length = 0;
+        unsigned char min_second = 0x80, max_second = 0xBF;   // excludes overlong forms, surrogates and too large code points
+        if (lead >= 0xC2 && lead <= 0xDF)
+            length = 2;
+        else if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            length = 3;
+            if (lead == 0xE0)
+                min_second = 0xA0;
+            else if (lead == 0xED)
+                max_second = 0x9F;
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            length = 4;
+            if (lead == 0xF0)
+                min_second = 0x90;
+            else if (lead == 0xF4)
+                max_second = 0x8F;
+        }
+        else
+            return false;
+        if (pos + length > word.size())
+            return false;
+        const unsigned char second = word[pos + 1];
+        if (second < min_second || second > max_second)
+            return false;
+        for (size_t i = 2; i < length; ++i)
+        {
+            if (!IsContinuationByte(word[pos + i]))
+                return false;
+        }
+        pos += length;
+    }
+    return true;
+}
+
+std::string_view FoldCase::Rewrite(std::string_view text, std::string& buffer)
+{
+    const size_t first = FindFoldedByte(text, 0);
+    if (first == text.size())
+        return text;
+
+    buffer.assign(text);
+    char* const data = buffer.data();
+    const size_t size = buffer.size();
+    // a two-byte letter may fold to an ASCII one, so the write position can fall behind
+    size_t read = first;
+    size_t write = first;
+    while (read < size)
+    {
+#ifdef __SSE2__
+        if (read + 16 <= size)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + read));
+            if (_mm_movemask_epi8(chunk) == 0)
+            {
+                const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(chunk, _mm_set1_epi8('Z' + 1)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(data + write), _mm_add_epi8(chunk, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+                read += 16;
+                write += 16;
+                continue;
+            }
+        }
+#endif
+        const unsigned char c = data[read];
+        if (c < 0x80)
+        {
+            data[write++] = static_cast<char>(c >= 'A' && c <= 'Z' ? c + 0x20 : c);
+            ++read;
+            continue;
+        }
+        const int code_point = DecodeTwoByteSequence(std::string_view(data, size), read);
+        if (code_point < 0)
+        {
+            data[write++] = data[read++];
+            continue;
+        }
+        const uint16_t folded = FOLD_TABLE[code_point];
+        if (folded < 0x80)
+        {
+            data[write++] = static_cast<char>(folded);
+        }
+        else
+        {
+            data[write++] = static_cast<char>(0xC0 | (folded >> 6));
+            data[write++] = static_cast<char>(0x80 | (folded & 0x3F));
+        }
+        read += 2;
+    }
+    buffer.resize(write);
+    return buffer;
+}
\ No newline at end of file
@@ -0,0 +1,191 @@
+#pragma once
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std::string_literals;
+
+// How SearchServer turns a document or query into words, fixed when it is constructed
+enum class TextAnalysis
+{
+    EXACT,          // split on spaces, words compared byte for byte
+    CASE_FOLDED,    // also UTF-8 validated and case folded, so "Cat" and "cat" are one term
+};
+
+using StopWords = std::set<std::string, std::less<>>;
+
+// Stages of a TextAnalyzer, by what they work on
+enum class AnalysisStage
+{
+    TEXT,       // rewrites the whole text before it is split, so words stay views into one buffer
+    SPLIT,      // splits the text into words
+    CHECK,      // a word failing it makes the text invalid
+    FILTER,     // a word failing it is left out
+};
+
+// Words are separated by one or more spaces
+struct SplitOnSpaces
+{
+    static constexpr AnalysisStage STAGE = AnalysisStage::SPLIT;
+
+    static void Split(std::string_view text, std::vector<std::string_view>& words);
+};
+
+// No bytes below ' '
+struct RejectControlCharacters
+{
+    static constexpr AnalysisStage STAGE = AnalysisStage::CHECK;
+
+    static bool Accepts(std::string_view word)
+    {
+        return std::none_of(word.begin(), word.end(), [](char c) { return c >= '\0' && c < ' '; });
+    }
+};
+
+// Well-formed UTF-8: shortest forms, no surrogates, nothing past U+10FFFF
+struct RejectInvalidUtf8
+{
+    static constexpr AnalysisStage STAGE = AnalysisStage::CHECK;
+
+    static bool Accepts(std::string_view word);
+};
+
+// Simple case folding of ASCII and of the two-byte UTF-8 scripts: Latin-1 and
+// Latin Extended-A, Greek, Cyrillic and Armenian. Other characters and malformed
+// bytes are copied as they are. Folding never lengthens the text, and text that
+// is already folded is returned as it is, without touching the buffer.
+struct FoldCase
+{
+    static constexpr AnalysisStage STAGE = AnalysisStage::TEXT;
+
+    static std::string_view Rewrite(std::string_view text, std::string& buffer);
+};
+
+struct DropStopWords
+{
+    static constexpr AnalysisStage STAGE = AnalysisStage::FILTER;
+
+    static bool Accepts(std::string_view word, const StopWords& stop_words) { return stop_words.count(word) == 0; }
+};
+
+// Analyzer composed at compile time: the TEXT stages in order, the SPLIT stage,
+// then for every word the CHECK and FILTER stages in order. Words view the text
+// or the buffer, which is only written when a TEXT stage changes something, so
+// analyzing allocates nothing per word.
+template <typename... Stages>
+struct TextAnalyzer
+{
+    static_assert(((Stages::STAGE == AnalysisStage::SPLIT) + ...) == 1, "A TextAnalyzer needs exactly one SPLIT stage");
+
+    static std::string_view Rewrite(std::string_view text, std::string& buffer)
+    {
+        ((text = RewriteBy<Stages>(text, buffer)), ...);
+        return text;
+    }
+
+    static void Split(std::string_view text, std::vector<std::string_view>& words)
+    {
+        (SplitBy<Stages>(text, words), ...);
+    }
+
+    static bool IsValidWord(std::string_view word)
+    {
+        return (IsAcceptedBy<Stages>(word) && ...);
+    }
+
+    static bool IsKeptWord(std::string_view word, const StopWords& stop_words)
+    {
+        return (IsKeptBy<Stages>(word, stop_words) && ...);
+    }
+
+    // The kept words of text; throws invalid_argument on a word failing a check
+    static void Analyze(std::string_view text, const StopWords& stop_words, std::string& buffer, std::vector<std::string_view>& words)
+    {
+        words.clear();
+        Split(Rewrite(text, buffer), words);
+        auto kept_end = words.begin();
+        for (const std::string_view word : words)
+        {
+            if (!IsValidWord(word))
+                throw std::invalid_argument("Invalid word: "s + static_cast<std::string>(word));
+            if (IsKeptWord(word, stop_words))
+                *kept_end++ = word;
+        }
+        words.erase(kept_end, words.end());
+    }
+
+private:
+    template <typename Stage>
+    static std::string_view RewriteBy(std::string_view text, std::string& buffer)
+    {
+        if constexpr (Stage::STAGE == AnalysisStage::TEXT)
+            return Stage::Rewrite(text, buffer);
+        else
+            return text;
+    }
+
+    template <typename Stage>
+    static void SplitBy(std::string_view text, std::vector<std::string_view>& words)
+    {
+        if constexpr (Stage::STAGE == AnalysisStage::SPLIT)
+            Stage::Split(text, words);
+    }
+
+    template <typename Stage>
+    static bool IsAcceptedBy(std::string_view word)
+    {
+        if constexpr (Stage::STAGE == AnalysisStage::CHECK)
+            return Stage::Accepts(word);
+        else
+            return true;
+    }
+
+    template <typename Stage>
+    static bool IsKeptBy(std::string_view word, const StopWords& stop_words)
+    {
+        if constexpr (Stage::STAGE == AnalysisStage::FILTER)
+            return Stage::Accepts(word, stop_words);
+        else
+            return true;
+    }
+};
+
+// Words as they are written: what SearchServer always did
+using ExactAnalyzer = TextAnalyzer<SplitOnSpaces, RejectControlCharacters, DropStopWords>;
+
+using CaseFoldingAnalyzer = TextAnalyzer<FoldCase, SplitOnSpaces, RejectInvalidUtf8, RejectControlCharacters, DropStopWords>;
+
+// Calls function with the analyzer of analysis
+template <typename Function>
+decltype(auto) WithTextAnalyzer(TextAnalysis analysis, Function function)
+{
+    if (analysis == TextAnalysis::CASE_FOLDED)
+    {
+        return function(CaseFoldingAnalyzer());
+    }
+    return function(ExactAnalyzer());
+}
+
+// Stop words as the analyzer sees them; throws invalid_argument on an invalid one
+template <typename StringContainer>
+StopWords MakeStopWords(const StringContainer& words, TextAnalysis analysis)
+{
+    return WithTextAnalyzer(analysis, [&words](auto analyzer)
+        {
+            StopWords stop_words;
+            std::string buffer;
+            for (const auto& word : words)
+            {
+                const std::string_view analyzed = analyzer.Rewrite(word, buffer);
+                if (analyzed.empty())
+                    continue;
+                if (!analyzer.IsValidWord(analyzed))
+                    throw std::invalid_argument("Invalid stop word: "s + std::string(word));
+                stop_words.emplace(analyzed);
+            }
+            return stop_words;
+        });
+}
\ No newline at end of file
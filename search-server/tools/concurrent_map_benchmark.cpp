@@ -0,0 +1,154 @@
+// Compares ConcurrentMap with the std::map based version it replaced.
+//
+//   concurrent_map_benchmark [threads] [operations per thread] [distinct keys]
+//
+// Build from the search-server directory:
+//   g++ -std=c++17 -O2 -I. tools/concurrent_map_benchmark.cpp -o concurrent_map_benchmark -ltbb -lpthread
+
+#include <execution>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concurrent_map.h"
+#include "log_duration.h"
+
+namespace
+{
+    // The previous ConcurrentMap: std::map buckets chosen by key modulo, one std::mutex each
+    template <typename Key, typename Value>
+    class MapBucketConcurrentMap
+    {
+    public:
+        struct Bucket
+        {
+            std::map<Key, Value> map;
+            std::mutex mutex;
+        };
+
+        struct Access
+        {
+            std::lock_guard<std::mutex> lg;
+            Value& ref_to_value;
+
+            explicit Access(Bucket& b, const Key& k)
+                : lg(b.mutex),
+                ref_to_value(b.map[k]) {}
+        };
+
+        explicit MapBucketConcurrentMap(size_t bucket_count)
+            : buckets_(bucket_count) {}
+
+        Access operator[](const Key& key)
+        {
+            return Access{ buckets_[size_t(key) % buckets_.size()], key };
+        }
+
+        std::map<Key, Value> BuildOrdinaryMap()
+        {
+            std::map<Key, Value> result;
+            for (auto& bucket : buckets_)
+            {
+                std::lock_guard lg(bucket.mutex);
+                for (const auto& [k, v] : bucket.map)
+                {
+                    result[k] = v;
+                }
+            }
+            return result;
+        }
+
+    private:
+        std::vector<Bucket> buckets_;
+    };
+
+    std::vector<std::vector<int>> GenerateKeys(size_t threads, size_t operations, int distinct_keys)
+    {
+        std::mt19937 generator;
+        std::vector<std::vector<int>> keys(threads, std::vector<int>(operations));
+        for (auto& thread_keys : keys)
+            for (int& key : thread_keys)
+                key = std::uniform_int_distribution<int>(0, distinct_keys - 1)(generator);
+        return keys;
+    }
+
+    template <typename Map>
+    void AddInParallel(Map& map, const std::vector<std::vector<int>>& keys)
+    {
+        std::vector<std::thread> threads;
+        for (const auto& thread_keys : keys)
+        {
+            threads.emplace_back([&map, &thread_keys]
+                {
+                    for (const int key : thread_keys)
+                        map[key].ref_to_value += 1.0;
+                });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    template <typename Map>
+    void Run(std::string_view name, size_t shards, const std::vector<std::vector<int>>& keys)
+    {
+        Map map(shards);
+        {
+            LOG_DURATION(std::string(name) + " add"s);
+            AddInParallel(map, keys);
+        }
+        double total = 0;
+        {
+            LOG_DURATION(std::string(name) + " to std::map"s);
+            for (const auto& [key, value] : map.BuildOrdinaryMap())
+                total += value;
+        }
+        std::cout << name << " total "s << total << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t threads = argc > 1 ? std::stoul(argv[1]) : std::max(2u, std::thread::hardware_concurrency());
+    const size_t operations = argc > 2 ? std::stoul(argv[2]) : 1'000'000;
+    const int distinct_keys = argc > 3 ? std::stoi(argv[3]) : 100'000;
+    const auto keys = GenerateKeys(threads, operations, distinct_keys);
+    const size_t shards = threads * 8;
+
+    Run<MapBucketConcurrentMap<int, double>>("std::map buckets"sv, shards, keys);
+    Run<ConcurrentMap<int, double>>("open addressing"sv, shards, keys);
+
+    ConcurrentMap<int, double> map(shards);
+    AddInParallel(map, keys);
+    {
+        LOG_DURATION("open addressing snapshot, par"s);
+        std::cout << "snapshot entries "s << map.Snapshot(std::execution::par).size() << std::endl;
+    }
+    {
+        LOG_DURATION("open addressing merge into std::unordered_map"s);
+        std::unordered_map<int, double> merged;
+        map.MergeInto(merged);
+        std::cout << "merged entries "s << merged.size() << std::endl;
+    }
+
+    // keys the previous version could not take
+    ConcurrentMap<std::string, int> words(shards);
+    {
+        LOG_DURATION("open addressing string keys add"s);
+        std::vector<std::thread> workers;
+        for (const auto& thread_keys : keys)
+        {
+            workers.emplace_back([&words, &thread_keys]
+                {
+                    for (const int key : thread_keys)
+                        ++words["word"s + std::to_string(key)].ref_to_value;
+                });
+        }
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+    std::cout << "string keys "s << words.Size() << std::endl;
+}
\ No newline at end of file
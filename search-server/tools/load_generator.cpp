@@ -0,0 +1,298 @@
+// Drives a running query_server with pipelined requests and reports throughput and latency.
+//
+//   load_generator (--port N | --unix PATH) [--connections C] [--depth D] [--requests N]
+//                  [--populate DOCUMENTS] [--queries FILE]
+//
+// Every connection keeps up to D requests in flight. With --populate the server first gets
+// DOCUMENTS random documents over the protocol; queries come from FILE, one per line,
+// or are generated from the same random dictionary.
+// Build from the search-server directory:
+//   g++ -std=c++17 -O2 -I. tools/load_generator.cpp line_protocol.cpp document.cpp -lpthread
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "line_protocol.h"
+
+using namespace std::string_literals;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        std::string unix_path;
+        int port = 0;
+        size_t connections = 4;
+        size_t depth = 32;
+        size_t requests = 100000;
+        size_t populate = 0;
+        std::string queries_path;
+    };
+
+    int Connect(const Options& options)
+    {
+        int fd;
+        int result;
+        if (!options.unix_path.empty())
+        {
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            std::strncpy(address.sun_path, options.unix_path.c_str(), sizeof(address.sun_path) - 1);
+            result = connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        }
+        else
+        {
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(static_cast<uint16_t>(options.port));
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            result = connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        }
+        if (fd < 0 || result != 0)
+            throw std::runtime_error("Cannot connect: "s + std::strerror(errno));
+        return fd;
+    }
+
+    void WriteAll(int fd, std::string_view data)
+    {
+        while (!data.empty())
+        {
+            const ssize_t written = write(fd, data.data(), data.size());
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error("write failed: "s + std::strerror(errno));
+            }
+            data.remove_prefix(static_cast<size_t>(written));
+        }
+    }
+
+    std::vector<std::string> GenerateDictionary(std::mt19937& generator, size_t word_count, size_t max_length)
+    {
+        std::vector<std::string> words;
+        words.reserve(word_count);
+        for (size_t i = 0; i < word_count; ++i)
+        {
+            const size_t length = std::uniform_int_distribution<size_t>(1, max_length)(generator);
+            std::string word(length, ' ');
+            for (char& c : word)
+                c = static_cast<char>(std::uniform_int_distribution<int>('a', 'z')(generator));
+            words.push_back(std::move(word));
+        }
+        std::sort(words.begin(), words.end());
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+        return words;
+    }
+
+    std::string GenerateText(std::mt19937& generator, const std::vector<std::string>& dictionary, size_t word_count, double minus_probability)
+    {
+        std::string text;
+        for (size_t i = 0; i < word_count; ++i)
+        {
+            if (i > 0)
+                text.push_back(' ');
+            if (std::uniform_real_distribution<>(0, 1)(generator) < minus_probability)
+                text.push_back('-');
+            text += dictionary[std::uniform_int_distribution<size_t>(0, dictionary.size() - 1)(generator)];
+        }
+        return text;
+    }
+
+    // Sends the requests over one connection keeping at most depth of them unanswered,
+    // and returns the latency of each answered request in nanoseconds
+    std::vector<int64_t> RunConnection(const Options& options, const std::vector<std::string>& lines, size_t& errors)
+    {
+        const int fd = Connect(options);
+        std::vector<Clock::time_point> sent(lines.size());
+        std::vector<int64_t> latencies;
+        latencies.reserve(lines.size());
+
+        std::mutex mutex;
+        std::condition_variable window_open;
+        size_t in_flight = 0;
+
+        std::thread receiver([&]
+            {
+                std::string buffer;
+                char chunk[64 * 1024];
+                while (latencies.size() < lines.size())
+                {
+                    const ssize_t size = read(fd, chunk, sizeof(chunk));
+                    if (size <= 0)
+                        break;
+                    buffer.append(chunk, static_cast<size_t>(size));
+                    const Clock::time_point now = Clock::now();
+                    // send times are written under the mutex, so they are read under it too
+                    std::lock_guard lock(mutex);
+                    size_t answered = 0;
+                    const size_t consumed = ConsumeLines(buffer, [&](std::string_view line)
+                        {
+                            const uint64_t id = ParseRequestId(line);
+                            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent[id]).count());
+                            if (line.find(" ERR "s) != std::string_view::npos)
+                                ++errors;
+                            ++answered;
+                        });
+                    buffer.erase(0, consumed);
+                    in_flight -= answered;
+                    window_open.notify_one();
+                }
+            });
+
+        // requests that fit into the window go out in one write
+        std::string batch;
+        for (size_t next = 0; next < lines.size();)
+        {
+            size_t free_slots;
+            {
+                std::unique_lock lock(mutex);
+                window_open.wait(lock, [&] { return in_flight < options.depth; });
+                free_slots = std::min(options.depth - in_flight, lines.size() - next);
+                in_flight += free_slots;
+                const Clock::time_point now = Clock::now();
+                for (size_t i = 0; i < free_slots; ++i)
+                    sent[next + i] = now;
+            }
+            batch.clear();
+            for (size_t i = 0; i < free_slots; ++i, ++next)
+            {
+                batch += std::to_string(next);
+                batch += lines[next];
+                batch.push_back('\n');
+            }
+            WriteAll(fd, batch);
+        }
+        shutdown(fd, SHUT_WR);
+        receiver.join();
+        close(fd);
+        return latencies;
+    }
+
+    void PrintReport(std::string_view title, std::vector<int64_t>& latencies, Clock::duration elapsed, size_t errors)
+    {
+        std::sort(latencies.begin(), latencies.end());
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        const auto percentile = [&](double p)
+        {
+            if (latencies.empty())
+                return 0.0;
+            const size_t index = std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+            return latencies[index] / 1000.0;
+        };
+        std::cout << title << ": "s << latencies.size() << " requests, "s << errors << " errors, "s
+            << std::fixed << std::setprecision(0) << latencies.size() / seconds << " QPS"s << std::endl;
+        std::cout << std::setprecision(1) << "  latency us: p50 "s << percentile(0.5) << ", p90 "s << percentile(0.9)
+            << ", p99 "s << percentile(0.99) << ", p99.9 "s << percentile(0.999)
+            << ", max "s << (latencies.empty() ? 0.0 : latencies.back() / 1000.0) << std::endl;
+    }
+
+    // Splits the request lines between the connections and runs them concurrently
+    void RunPhase(std::string_view title, const Options& options, const std::vector<std::string>& lines)
+    {
+        std::vector<std::vector<std::string>> per_connection(options.connections);
+        for (size_t i = 0; i < lines.size(); ++i)
+            per_connection[i % options.connections].push_back(lines[i]);
+
+        std::vector<std::vector<int64_t>> latencies(options.connections);
+        std::vector<size_t> errors(options.connections);
+        std::vector<std::thread> threads;
+        const Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < options.connections; ++i)
+            threads.emplace_back([&, i] { latencies[i] = RunConnection(options, per_connection[i], errors[i]); });
+        for (std::thread& thread : threads)
+            thread.join();
+        const Clock::duration elapsed = Clock::now() - start;
+
+        std::vector<int64_t> all;
+        size_t error_count = 0;
+        for (size_t i = 0; i < options.connections; ++i)
+        {
+            all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+            error_count += errors[i];
+        }
+        PrintReport(title, all, elapsed, error_count);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string_view option = argv[i];
+        if (option == "--unix")
+            options.unix_path = argv[i + 1];
+        else if (option == "--port")
+            options.port = std::stoi(argv[i + 1]);
+        else if (option == "--connections")
+            options.connections = std::max<size_t>(1, std::stoul(argv[i + 1]));
+        else if (option == "--depth")
+            options.depth = std::max<size_t>(1, std::stoul(argv[i + 1]));
+        else if (option == "--requests")
+            options.requests = std::stoul(argv[i + 1]);
+        else if (option == "--populate")
+            options.populate = std::stoul(argv[i + 1]);
+        else if (option == "--queries")
+            options.queries_path = argv[i + 1];
+    }
+    if (options.unix_path.empty() && options.port == 0)
+    {
+        std::cerr << "Usage: load_generator (--port N | --unix PATH) [--connections C] [--depth D] [--requests N] [--populate DOCUMENTS] [--queries FILE]"s << std::endl;
+        return 1;
+    }
+
+    std::mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 1000, 10);
+
+    if (options.populate > 0)
+    {
+        std::vector<std::string> adds;
+        for (size_t i = 0; i < options.populate; ++i)
+            adds.push_back(" A "s + std::to_string(i) + " 0 "s + std::to_string(i % 10) + " "s + GenerateText(generator, dictionary, 70, 0));
+        RunPhase("populate"s, options, adds);
+    }
+
+    std::vector<std::string> queries;
+    if (!options.queries_path.empty())
+    {
+        std::ifstream input(options.queries_path);
+        std::string line;
+        while (std::getline(input, line))
+            if (!line.empty())
+                queries.push_back(" S "s + line);
+    }
+    else
+    {
+        for (size_t i = 0; i < 1000; ++i)
+            queries.push_back(" S "s + GenerateText(generator, dictionary, 7, 0.1));
+    }
+    if (queries.empty())
+        return 0;
+
+    std::vector<std::string> requests;
+    requests.reserve(options.requests);
+    for (size_t i = 0; i < options.requests; ++i)
+        requests.push_back(queries[i % queries.size()]);
+    RunPhase("search"s, options, requests);
+}
@@ -0,0 +1,260 @@
+// Replays a query log (query_log.h) against a snapshot of an index and reports throughput,
+// latency and whether the results still match the logged ones.
+//
+//   query_replay --log FILE (--index FILE | --wal PATH) [--stop-words WORDS] [--text-analysis exact|case-folded]
+//                [--positional-index on|off] [--relevance-model tf-idf|bm25] [--threads N]
+//                [--speed X | --rate QPS] [--latency-target MS]
+//
+// The snapshot is an IndexBuilder file or a write-ahead log; it and the options must match the
+// logging server for the results to compare. Every query is due at its logged time divided by X
+// (1 by default, 0 replays without pauses), or with --rate at its position in the log over QPS.
+// Due times never wait for earlier queries, so the load stays open loop while --threads keep up,
+// and latency counts from the due time: a replay falling behind shows up in the latency instead
+// of stretching the schedule. Queries are searched the way they were logged, QUEUED ones through
+// a RequestQueue; ones logged with a custom predicate are skipped. Results are compared by count
+// and hash wherever both the logged and the replayed search were complete.
+// Build from the search-server directory:
+//   g++ -std=c++17 -O2 -I. tools/query_replay.cpp $(ls *.cpp | grep -v main.cpp) -ltbb -lpthread
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <execution>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "query_log.h"
+#include "request_queue.h"
+#include "search_server.h"
+#include "write_ahead_log.h"
+
+using namespace std::string_literals;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        std::string log_path;
+        std::string index_path;
+        std::string wal_path;
+        std::string stop_words;
+        TextAnalysis text_analysis = TextAnalysis::EXACT;
+        bool positional_index = false;
+        RelevanceModel relevance_model = RelevanceModel::TF_IDF;
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        double speed = 1;
+        double rate = 0;        // queries per second, 0 to follow the logged times
+        std::chrono::milliseconds latency_target{ 100 };
+    };
+
+    struct Outcome
+    {
+        int64_t latency = 0;    // ns from the due time to the result
+        int64_t service = 0;    // ns from the start of the search to the result
+        bool failed = false;
+        bool compared = false;
+        bool mismatched = false;
+    };
+
+    // Searches query the way it was logged; the result is incomplete when a budget or admission cut it short
+    BoundedSearchResult Replay(const SearchServer& server, RequestQueue* request_queue, const LoggedQuery& query)
+    {
+        const StatusFilter filter{ *query.status };
+        switch (query.search)
+        {
+        case LoggedSearch::SEQUENTIAL:
+            return { server.FindTopDocuments(std::execution::seq, query.raw_query, query.mode, filter), true };
+        case LoggedSearch::PARALLEL:
+            return { server.FindTopDocuments(std::execution::par, query.raw_query, query.mode, filter), true };
+        case LoggedSearch::BUDGETED:
+        {
+            SearchBudget budget;
+            if (query.time_budget)
+                budget.deadline = Clock::now() + *query.time_budget;
+            budget.max_postings = query.max_postings;
+            budget.max_documents = query.max_documents;
+            return server.FindTopDocuments(query.raw_query, budget, filter);
+        }
+        case LoggedSearch::QUEUED:
+        {
+            SearchResponse response = request_queue->Submit(query.raw_query, filter, query.priority).get();
+            return { std::move(response.documents), response.decision != AdmissionDecision::REJECTED && response.is_complete };
+        }
+        default:
+            return { server.FindTopDocuments(query.raw_query, query.mode, filter), true };
+        }
+    }
+
+    void PrintLatencies(std::string_view title, std::vector<int64_t>& latencies)
+    {
+        std::sort(latencies.begin(), latencies.end());
+        const auto percentile = [&](double p)
+        {
+            if (latencies.empty())
+                return 0.0;
+            const size_t index = std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+            return latencies[index] / 1000.0;
+        };
+        std::cout << std::fixed << std::setprecision(1) << "  "s << title << " us: p50 "s << percentile(0.5)
+            << ", p90 "s << percentile(0.9) << ", p99 "s << percentile(0.99) << ", p99.9 "s << percentile(0.999)
+            << ", max "s << (latencies.empty() ? 0.0 : latencies.back() / 1000.0) << std::endl;
+    }
+
+    Options ParseOptions(int argc, char* argv[])
+    {
+        Options options;
+        for (int i = 1; i + 1 < argc; i += 2)
+        {
+            const std::string_view option = argv[i];
+            const std::string_view value = argv[i + 1];
+            if (option == "--log")
+                options.log_path = value;
+            else if (option == "--index")
+                options.index_path = value;
+            else if (option == "--wal")
+                options.wal_path = value;
+            else if (option == "--stop-words")
+                options.stop_words = value;
+            else if (option == "--text-analysis")
+                options.text_analysis = value == "case-folded" ? TextAnalysis::CASE_FOLDED : TextAnalysis::EXACT;
+            else if (option == "--positional-index")
+                options.positional_index = value == "on";
+            else if (option == "--relevance-model")
+                options.relevance_model = value == "bm25" ? RelevanceModel::BM25 : RelevanceModel::TF_IDF;
+            else if (option == "--threads")
+                options.threads = std::max<size_t>(1, std::stoul(argv[i + 1]));
+            else if (option == "--speed")
+                options.speed = std::stod(argv[i + 1]);
+            else if (option == "--rate")
+                options.rate = std::stod(argv[i + 1]);
+            else if (option == "--latency-target")
+                options.latency_target = std::chrono::milliseconds(std::stol(argv[i + 1]));
+        }
+        return options;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const Options options = ParseOptions(argc, argv);
+    if (options.log_path.empty() || options.index_path.empty() == options.wal_path.empty())
+    {
+        std::cerr << "Usage: query_replay --log FILE (--index FILE | --wal PATH) [--stop-words WORDS]"
+            " [--text-analysis exact|case-folded] [--positional-index on|off] [--relevance-model tf-idf|bm25]"
+            " [--threads N] [--speed X | --rate QPS] [--latency-target MS]"s << std::endl;
+        return 1;
+    }
+
+    std::vector<LoggedQuery> queries = ReadQueryLog(options.log_path);
+    const size_t logged_count = queries.size();
+    queries.erase(std::remove_if(queries.begin(), queries.end(), [](const LoggedQuery& query) { return !query.status; }),
+        queries.end());
+    if (queries.empty())
+    {
+        std::cerr << "No replayable queries in "s << options.log_path << std::endl;
+        return 1;
+    }
+
+    SearchServer server(options.stop_words, options.text_analysis);
+    server.SetPositionalIndex(options.positional_index);
+    server.SetRelevanceModel(options.relevance_model);
+    if (!options.index_path.empty())
+    {
+        IndexBuilder::Open(options.index_path, server);
+    }
+    else
+    {
+        WriteAheadLog wal(options.wal_path);
+        wal.Recover(server);
+    }
+    server.FlushIndex();
+    std::cerr << "Loaded "s << server.GetDocumentCount() << " documents"s << std::endl;
+
+    std::unique_ptr<RequestQueue> request_queue;
+    if (std::any_of(queries.begin(), queries.end(), [](const LoggedQuery& query) { return query.search == LoggedSearch::QUEUED; }))
+    {
+        AdmissionOptions admission;
+        admission.latency_target = options.latency_target;
+        request_queue = std::make_unique<RequestQueue>(server, admission);
+    }
+
+    // due times, relative to the start of the replay
+    std::vector<Clock::duration> due(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        if (options.rate > 0)
+            due[i] = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(i / options.rate));
+        else if (options.speed > 0)
+            due[i] = std::chrono::duration_cast<Clock::duration>((queries[i].time - queries.front().time) / options.speed);
+    }
+
+    std::vector<Outcome> outcomes(queries.size());
+    std::atomic<size_t> next{ 0 };
+    std::vector<std::thread> threads;
+    const Clock::time_point start = Clock::now();
+    for (size_t t = 0; t < options.threads; ++t)
+    {
+        threads.emplace_back([&]
+            {
+                for (size_t i = next++; i < queries.size(); i = next++)
+                {
+                    const LoggedQuery& query = queries[i];
+                    const Clock::time_point due_time = start + due[i];
+                    std::this_thread::sleep_until(due_time);
+                    const Clock::time_point search_start = Clock::now();
+                    Outcome& outcome = outcomes[i];
+                    try
+                    {
+                        const BoundedSearchResult result = Replay(server, request_queue.get(), query);
+                        outcome.compared = query.is_complete && result.is_complete;
+                        outcome.mismatched = outcome.compared
+                            && (result.documents.size() != query.result_count || HashResult(result.documents) != query.result_hash);
+                    }
+                    catch (const std::exception&)
+                    {
+                        outcome.failed = true;
+                    }
+                    const Clock::time_point end = Clock::now();
+                    outcome.latency = std::chrono::duration_cast<std::chrono::nanoseconds>(end - due_time).count();
+                    outcome.service = std::chrono::duration_cast<std::chrono::nanoseconds>(end - search_start).count();
+                }
+            });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<int64_t> latencies;
+    std::vector<int64_t> service_times;
+    std::vector<int64_t> logged_latencies;
+    size_t errors = 0;
+    size_t compared = 0;
+    size_t mismatched = 0;
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        const Outcome& outcome = outcomes[i];
+        latencies.push_back(outcome.latency);
+        service_times.push_back(outcome.service);
+        logged_latencies.push_back(queries[i].latency.count());
+        errors += outcome.failed;
+        compared += outcome.compared;
+        mismatched += outcome.mismatched;
+    }
+
+    std::cout << "replayed "s << queries.size() << " of "s << logged_count << " logged queries in "s
+        << std::fixed << std::setprecision(3) << seconds << " s, "s << std::setprecision(0) << queries.size() / seconds
+        << " QPS, "s << errors << " errors"s << std::endl;
+    PrintLatencies("latency"s, latencies);
+    PrintLatencies("service"s, service_times);
+    PrintLatencies("logged "s, logged_latencies);
+    std::cout << "  results: "s << compared << " compared, "s << mismatched << " mismatched"s << std::endl;
+    if (request_queue)
+        std::cout << "  admission: "s << request_queue->GetAdmissionStats() << std::endl;
+    return mismatched == 0 && errors == 0 ? 0 : 2;
+}
@@ -0,0 +1,464 @@
+// Serves a SearchServer to other processes over the line protocol of line_protocol.h.
+//
+//   query_server (--port N | --unix PATH) [--workers N] [--stop-words "and with"] [--documents FILE]
+//                [--text-analysis exact|case-folded] [--positional-index on|off]
+//
+// FILE holds protocol request lines (normally "A" requests) applied before serving.
+// Build from the search-server directory:
+//   g++ -std=c++17 -O2 -I. tools/query_server.cpp $(ls *.cpp | grep -v main.cpp) -ltbb -lpthread
+
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "line_protocol.h"
+#include "search_server.h"
+
+using namespace std::string_literals;
+
+namespace
+{
+    const size_t READ_BUFFER_SIZE = 64 * 1024;
+    const size_t MAX_PENDING_INPUT = 1 << 20;   // an unterminated line longer than this is an error
+    const size_t MAX_BATCH_LINES = 64;          // requests handed to one worker at a time
+    const int MAX_IOVECS = 64;
+
+    struct Connection
+    {
+        int fd = -1;
+        std::string input;                      // bytes after the last complete line
+        std::deque<std::string> output;         // response batches not yet written
+        size_t output_offset = 0;               // bytes of output.front() already written
+        bool read_closed = false;
+        bool want_write = false;
+        bool closed = false;
+
+        std::mutex mutex;                       // guards completed
+        std::vector<std::string> completed;     // response batches finished by workers
+        std::atomic<int> in_flight{ 0 };        // batches handed to workers
+    };
+
+    struct Job
+    {
+        std::shared_ptr<Connection> connection;
+        std::string lines;
+    };
+
+    class QueryServer
+    {
+    public:
+        QueryServer(SearchServer& search_server, int listen_fd, size_t worker_count)
+            : search_server_(search_server),
+            listen_fd_(listen_fd),
+            epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+            event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        {
+            if (epoll_fd_ < 0 || event_fd_ < 0)
+                throw std::runtime_error("Cannot create epoll or eventfd descriptors"s);
+            Watch(listen_fd_, EPOLLIN, EPOLL_CTL_ADD);
+            Watch(event_fd_, EPOLLIN, EPOLL_CTL_ADD);
+            for (size_t i = 0; i < worker_count; ++i)
+                workers_.emplace_back([this] { WorkerLoop(); });
+        }
+
+        // Executes one request line and appends its response
+        void Execute(std::string_view line, std::string& out)
+        {
+            uint64_t id = 0;
+            try
+            {
+                id = ParseRequestId(line);
+                const ProtocolRequest request = ParseRequest(line);
+                switch (request.command)
+                {
+                case 'S':
+                {
+                    std::shared_lock lock(index_mutex_);
+                    AppendSearchResponse(out, id, search_server_.FindTopDocuments(request.text));
+                    break;
+                }
+                case 'M':
+                {
+                    std::shared_lock lock(index_mutex_);
+                    const auto [words, status] = search_server_.MatchDocument(request.text, request.document_id);
+                    AppendMatchResponse(out, id, words, status);
+                    break;
+                }
+                case 'A':
+                {
+                    std::unique_lock lock(index_mutex_);
+                    search_server_.AddDocument(request.document_id, request.text, request.status, request.ratings);
+                    AppendOkResponse(out, id);
+                    break;
+                }
+                case 'R':
+                {
+                    std::unique_lock lock(index_mutex_);
+                    search_server_.RemoveDocument(request.document_id);
+                    AppendOkResponse(out, id);
+                    break;
+                }
+                }
+            }
+            catch (const std::exception& e)
+            {
+                AppendErrorResponse(out, id, e.what());
+            }
+        }
+
+        void Run()
+        {
+            epoll_event events[64];
+            while (true)
+            {
+                const int count = epoll_wait(epoll_fd_, events, 64, -1);
+                if (count < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    throw std::runtime_error("epoll_wait failed: "s + std::strerror(errno));
+                }
+                for (int i = 0; i < count; ++i)
+                {
+                    const int fd = events[i].data.fd;
+                    if (fd == listen_fd_)
+                    {
+                        Accept();
+                    }
+                    else if (fd == event_fd_)
+                    {
+                        FlushReady();
+                    }
+                    else if (const auto it = connections_.find(fd); it != connections_.end())
+                    {
+                        const std::shared_ptr<Connection> connection = it->second;
+                        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                            Read(*connection, connection);
+                        if (events[i].events & EPOLLOUT)
+                            Flush(*connection);
+                        CloseIfDone(*connection);
+                    }
+                }
+            }
+        }
+
+    private:
+        SearchServer& search_server_;
+        std::shared_mutex index_mutex_;         // searches share it, mutations take it exclusively
+        const int listen_fd_;
+        const int epoll_fd_;
+        const int event_fd_;                    // workers signal finished batches through it
+        std::map<int, std::shared_ptr<Connection>> connections_;
+
+        std::mutex jobs_mutex_;
+        std::condition_variable jobs_ready_;
+        std::deque<Job> jobs_;
+        std::vector<std::thread> workers_;
+
+        std::mutex ready_mutex_;
+        std::vector<std::shared_ptr<Connection>> ready_;   // connections with completed batches
+
+        void Watch(int fd, uint32_t events, int operation)
+        {
+            epoll_event event{};
+            event.events = events;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd_, operation, fd, &event) != 0)
+                throw std::runtime_error("epoll_ctl failed: "s + std::strerror(errno));
+        }
+
+        void Accept()
+        {
+            while (true)
+            {
+                const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0)
+                    return;
+                auto connection = std::make_shared<Connection>();
+                connection->fd = fd;
+                connections_[fd] = connection;
+                Watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+            }
+        }
+
+        void Read(Connection& connection, const std::shared_ptr<Connection>& owner)
+        {
+            char buffer[READ_BUFFER_SIZE];
+            while (!connection.read_closed)
+            {
+                const ssize_t size = read(connection.fd, buffer, sizeof(buffer));
+                if (size > 0)
+                {
+                    connection.input.append(buffer, static_cast<size_t>(size));
+                }
+                else if (size == 0 || (errno != EAGAIN && errno != EINTR))
+                {
+                    connection.read_closed = true;
+                }
+                else if (errno == EAGAIN)
+                {
+                    break;
+                }
+            }
+
+            // complete lines go to the workers in batches of up to MAX_BATCH_LINES
+            std::string_view input = connection.input;
+            size_t dispatched = 0;
+            size_t lines = 0;
+            size_t batch_begin = 0;
+            ConsumeLines(input, [&](std::string_view line)
+                {
+                    dispatched = line.data() + line.size() + 1 - input.data();
+                    if (++lines == MAX_BATCH_LINES)
+                    {
+                        Dispatch(owner, input.substr(batch_begin, dispatched - batch_begin));
+                        batch_begin = dispatched;
+                        lines = 0;
+                    }
+                });
+            if (dispatched > batch_begin)
+                Dispatch(owner, input.substr(batch_begin, dispatched - batch_begin));
+            connection.input.erase(0, dispatched);
+
+            if (connection.input.size() > MAX_PENDING_INPUT)
+                connection.read_closed = true;
+        }
+
+        void Dispatch(const std::shared_ptr<Connection>& connection, std::string_view lines)
+        {
+            ++connection->in_flight;
+            {
+                std::lock_guard lock(jobs_mutex_);
+                jobs_.push_back(Job{ connection, std::string(lines) });
+            }
+            jobs_ready_.notify_one();
+        }
+
+        void WorkerLoop()
+        {
+            while (true)
+            {
+                Job job;
+                {
+                    std::unique_lock lock(jobs_mutex_);
+                    jobs_ready_.wait(lock, [this] { return !jobs_.empty(); });
+                    job = std::move(jobs_.front());
+                    jobs_.pop_front();
+                }
+
+                // all responses of the batch are formatted into one buffer and written with it
+                std::string responses;
+                ConsumeLines(job.lines, [&](std::string_view line) { Execute(line, responses); });
+                {
+                    std::lock_guard lock(job.connection->mutex);
+                    job.connection->completed.push_back(std::move(responses));
+                }
+                --job.connection->in_flight;
+                {
+                    std::lock_guard lock(ready_mutex_);
+                    ready_.push_back(std::move(job.connection));
+                }
+                const uint64_t one = 1;
+                [[maybe_unused]] const ssize_t written = write(event_fd_, &one, sizeof(one));
+            }
+        }
+
+        void FlushReady()
+        {
+            uint64_t counter;
+            [[maybe_unused]] const ssize_t size = read(event_fd_, &counter, sizeof(counter));
+            std::vector<std::shared_ptr<Connection>> ready;
+            {
+                std::lock_guard lock(ready_mutex_);
+                ready.swap(ready_);
+            }
+            for (const auto& connection : ready)
+            {
+                Flush(*connection);
+                CloseIfDone(*connection);
+            }
+        }
+
+        void Flush(Connection& connection)
+        {
+            if (connection.closed)
+                return;
+            {
+                std::lock_guard lock(connection.mutex);
+                for (std::string& batch : connection.completed)
+                    connection.output.push_back(std::move(batch));
+                connection.completed.clear();
+            }
+
+            // one writev covers many batches, no concatenation
+            while (!connection.output.empty())
+            {
+                iovec vectors[MAX_IOVECS];
+                int vector_count = 0;
+                for (auto it = connection.output.begin(); it != connection.output.end() && vector_count < MAX_IOVECS; ++it)
+                {
+                    const size_t offset = vector_count == 0 ? connection.output_offset : 0;
+                    vectors[vector_count].iov_base = it->data() + offset;
+                    vectors[vector_count].iov_len = it->size() - offset;
+                    ++vector_count;
+                }
+                ssize_t written = writev(connection.fd, vectors, vector_count);
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    if (errno != EAGAIN)
+                    {
+                        connection.output.clear();
+                        connection.read_closed = true;
+                    }
+                    break;
+                }
+                while (written > 0)
+                {
+                    const size_t left = connection.output.front().size() - connection.output_offset;
+                    if (static_cast<size_t>(written) < left)
+                    {
+                        connection.output_offset += written;
+                        break;
+                    }
+                    written -= left;
+                    connection.output.pop_front();
+                    connection.output_offset = 0;
+                }
+            }
+
+            const bool want_write = !connection.output.empty();
+            if (want_write != connection.want_write)
+            {
+                connection.want_write = want_write;
+                Watch(connection.fd, EPOLLIN | EPOLLRDHUP | (want_write ? static_cast<uint32_t>(EPOLLOUT) : 0u), EPOLL_CTL_MOD);
+            }
+        }
+
+        void CloseIfDone(Connection& connection)
+        {
+            if (connection.closed || !connection.read_closed || connection.in_flight > 0 || !connection.output.empty())
+                return;
+            {
+                std::lock_guard lock(connection.mutex);
+                if (!connection.completed.empty())
+                    return;
+            }
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection.fd, nullptr);
+            close(connection.fd);
+            connection.closed = true;
+            connections_.erase(connection.fd);
+        }
+    };
+
+    int Listen(const std::string& unix_path, int port)
+    {
+        int fd;
+        if (!unix_path.empty())
+        {
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (unix_path.size() >= sizeof(address.sun_path))
+                throw std::invalid_argument("Socket path is too long: "s + unix_path);
+            std::strcpy(address.sun_path, unix_path.c_str());
+            unlink(unix_path.c_str());
+            if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+                throw std::runtime_error("Cannot bind "s + unix_path + ": "s + std::strerror(errno));
+        }
+        else
+        {
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            const int enable = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(static_cast<uint16_t>(port));
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+                throw std::runtime_error("Cannot bind port "s + std::to_string(port) + ": "s + std::strerror(errno));
+        }
+        if (listen(fd, SOMAXCONN) != 0)
+            throw std::runtime_error("listen failed: "s + std::strerror(errno));
+        return fd;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string unix_path;
+    int port = 0;
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    std::string stop_words;
+    std::string documents_path;
+    TextAnalysis text_analysis = TextAnalysis::EXACT;
+    bool positional_index = false;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string_view option = argv[i];
+        if (option == "--unix")
+            unix_path = argv[i + 1];
+        else if (option == "--port")
+            port = std::stoi(argv[i + 1]);
+        else if (option == "--workers")
+            workers = std::stoul(argv[i + 1]);
+        else if (option == "--stop-words")
+            stop_words = argv[i + 1];
+        else if (option == "--documents")
+            documents_path = argv[i + 1];
+        else if (option == "--text-analysis")
+            text_analysis = std::string_view(argv[i + 1]) == "case-folded" ? TextAnalysis::CASE_FOLDED : TextAnalysis::EXACT;
+        else if (option == "--positional-index")
+            positional_index = std::string_view(argv[i + 1]) == "on";
+    }
+    if (unix_path.empty() && port == 0)
+    {
+        std::cerr << "Usage: query_server (--port N | --unix PATH) [--workers N] [--stop-words WORDS] [--documents FILE]"
+            " [--text-analysis exact|case-folded] [--positional-index on|off]"s << std::endl;
+        return 1;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    SearchServer search_server(stop_words, text_analysis);
+    search_server.SetPositionalIndex(positional_index);
+    QueryServer server(search_server, Listen(unix_path, port), workers);
+
+    if (!documents_path.empty())
+    {
+        std::ifstream documents(documents_path);
+        std::string line;
+        std::string response;
+        while (std::getline(documents, line))
+        {
+            response.clear();
+            server.Execute(line, response);
+            if (response.find(" ERR "s) != std::string::npos)
+                std::cerr << response;
+        }
+        search_server.FlushIndex();
+        std::cerr << "Loaded "s << search_server.GetDocumentCount() << " documents"s << std::endl;
+    }
+
+    server.Run();
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std::string_literals;
+
+// LEB128: 7 bits per byte, high bit set on every byte but the last
+inline void AppendVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Reads one varint from the front of in and advances it
+inline uint64_t ReadVarint(std::string_view& in)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (in.empty())
+            throw std::out_of_range("Truncated varint"s);
+        const auto byte = static_cast<unsigned char>(in.front());
+        in.remove_prefix(1);
+        result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return result;
+    }
+    throw std::invalid_argument("Malformed varint"s);
+}
+
+// Maps signed values to unsigned so that small magnitudes stay short: 0, -1, 1, -2 -> 0, 1, 2, 3
+inline uint64_t ZigZagEncode(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t ZigZagDecode(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
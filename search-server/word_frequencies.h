@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <iterator>
+#include <string_view>
+#include <utility>
+
+#include "term_freqs.h"
+
+// Read-only view over one document's forward index: term IDs sorted ascending
+// with the matching term frequencies. Iterating yields (word, frequency) pairs.
+// The view stays valid until the next modification of the SearchServer.
+class WordFrequencies
+{
+public:
+
+    class Iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = std::pair<std::string_view, double>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        // Holds the arrays themselves, so it outlives the view it came from
+        Iterator(const std::string_view* words, const int* term_ids, TermFreqView freqs, size_t pos)
+            : words_(words),
+            term_ids_(term_ids),
+            freqs_(freqs),
+            pos_(pos) {}
+
+        value_type operator*() const { return (*this)[0]; }
+        value_type operator[](difference_type n) const { return { words_[term_ids_[pos_ + n]], freqs_[pos_ + n] }; }
+        Iterator& operator++() { ++pos_; return *this; }
+        Iterator operator++(int) { Iterator old = *this; ++pos_; return old; }
+        Iterator& operator--() { --pos_; return *this; }
+        Iterator operator--(int) { Iterator old = *this; --pos_; return old; }
+        Iterator& operator+=(difference_type n) { pos_ += n; return *this; }
+        Iterator& operator-=(difference_type n) { pos_ -= n; return *this; }
+        Iterator operator+(difference_type n) const { Iterator result = *this; return result += n; }
+        Iterator operator-(difference_type n) const { Iterator result = *this; return result -= n; }
+        friend Iterator operator+(difference_type n, const Iterator& it) { return it + n; }
+        difference_type operator-(const Iterator& other) const
+        {
+            return static_cast<difference_type>(pos_) - static_cast<difference_type>(other.pos_);
+        }
+        bool operator==(const Iterator& other) const { return pos_ == other.pos_; }
+        bool operator!=(const Iterator& other) const { return pos_ != other.pos_; }
+        bool operator<(const Iterator& other) const { return pos_ < other.pos_; }
+        bool operator>(const Iterator& other) const { return pos_ > other.pos_; }
+        bool operator<=(const Iterator& other) const { return pos_ <= other.pos_; }
+        bool operator>=(const Iterator& other) const { return pos_ >= other.pos_; }
+
+    private:
+        const std::string_view* words_;
+        const int* term_ids_;
+        TermFreqView freqs_;
+        size_t pos_;
+    };
+
+    WordFrequencies() = default;
+
+    WordFrequencies(const std::string_view* words, const int* term_ids, TermFreqView freqs, size_t size)
+        : words_(words),
+        term_ids_(term_ids),
+        freqs_(freqs),
+        size_(size) {}
+
+    Iterator begin() const { return Iterator{ words_, term_ids_, freqs_, 0 }; }
+    Iterator end() const { return Iterator{ words_, term_ids_, freqs_, size_ }; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const int* GetTermIds() const { return term_ids_; }
+
+    // Both views list the same set of words (frequencies are not compared)
+    bool SameWords(const WordFrequencies& other) const
+    {
+        if (size_ != other.size_)
+            return false;
+        for (size_t i = 0; i < size_; ++i)
+            if (term_ids_[i] != other.term_ids_[i])
+                return false;
+        return true;
+    }
+
+private:
+    const std::string_view* words_ = nullptr;
+    const int* term_ids_ = nullptr;
+    TermFreqView freqs_;
+    size_t size_ = 0;
+};
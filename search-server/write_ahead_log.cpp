@@ -0,0 +1,448 @@
+#include "write_ahead_log.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <execution>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "index_builder.h"
+#include "search_server.h"
+#include "varint.h"
+
+using namespace std::string_literals;
+
+// Record frame: u32 payload size | u32 CRC-32 of payload | payload (little endian).
+// Payload: u8 type | varint sequence number | varint document id, and for ADD:
+// u8 status | varint rating count | zigzag varint ratings | varint text size | text.
+// The snapshot file is the "SSWALSN2" magic, the u64 sequence number of the last record
+// it covers, and the live documents as an IndexBuilder index file.
+namespace
+{
+    const char RECORD_ADD = 1;
+    const char RECORD_REMOVE = 2;
+    const size_t FRAME_HEADER_SIZE = 8;
+    const std::string_view SNAPSHOT_MAGIC = "SSWALSN2";
+
+    struct Mutation
+    {
+        char type = 0;
+        uint64_t lsn = 0;
+        int document_id = 0;
+        DocumentStatus status = DocumentStatus::ACTUAL;
+        std::vector<int> ratings;
+        std::string text;
+        bool valid = false;
+    };
+
+    uint32_t Crc32(std::string_view data)
+    {
+        static const std::array<uint32_t, 256> table = []
+        {
+            std::array<uint32_t, 256> result{};
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                result[i] = c;
+            }
+            return result;
+        }();
+        uint32_t crc = 0xFFFFFFFFu;
+        for (char ch : data)
+            crc = table[(crc ^ static_cast<unsigned char>(ch)) & 0xFF] ^ (crc >> 8);
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    void AppendFixed32(std::string& out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+
+    uint32_t ReadFixed32(std::string_view in)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+            value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+        return value;
+    }
+
+    void AppendFixed64(std::string& out, uint64_t value)
+    {
+        AppendFixed32(out, static_cast<uint32_t>(value));
+        AppendFixed32(out, static_cast<uint32_t>(value >> 32));
+    }
+
+    uint64_t ReadFixed64(std::string_view in)
+    {
+        return ReadFixed32(in) | static_cast<uint64_t>(ReadFixed32(in.substr(4))) << 32;
+    }
+
+    void AppendFrame(std::string& out, std::string_view payload)
+    {
+        AppendFixed32(out, static_cast<uint32_t>(payload.size()));
+        AppendFixed32(out, Crc32(payload));
+        out.append(payload);
+    }
+
+    std::string EncodeAdd(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings)
+    {
+        std::string body;
+        AppendVarint(body, static_cast<uint64_t>(document_id));
+        body.push_back(static_cast<char>(status));
+        AppendVarint(body, ratings.size());
+        for (int rating : ratings)
+            AppendVarint(body, ZigZagEncode(rating));
+        AppendVarint(body, document.size());
+        body.append(document);
+        return body;
+    }
+
+    // Splits data into frame payloads; stops at the first incomplete frame (a torn write)
+    std::vector<std::string_view> SplitFrames(std::string_view data)
+    {
+        std::vector<std::string_view> frames;
+        while (data.size() >= FRAME_HEADER_SIZE)
+        {
+            const uint32_t size = ReadFixed32(data);
+            if (data.size() - FRAME_HEADER_SIZE < size)
+                break;
+            frames.push_back(data.substr(0, FRAME_HEADER_SIZE + size));
+            data.remove_prefix(FRAME_HEADER_SIZE + size);
+        }
+        return frames;
+    }
+
+    Mutation DecodeFrame(std::string_view frame)
+    {
+        Mutation mutation;
+        std::string_view payload = frame.substr(FRAME_HEADER_SIZE);
+        if (Crc32(payload) != ReadFixed32(frame.substr(4)) || payload.empty())
+            return mutation;
+        try
+        {
+            mutation.type = payload.front();
+            payload.remove_prefix(1);
+            mutation.lsn = ReadVarint(payload);
+            mutation.document_id = static_cast<int>(ReadVarint(payload));
+            if (mutation.type == RECORD_ADD)
+            {
+                if (payload.empty())
+                    return mutation;
+                mutation.status = static_cast<DocumentStatus>(payload.front());
+                payload.remove_prefix(1);
+                mutation.ratings.resize(ReadVarint(payload));
+                for (int& rating : mutation.ratings)
+                    rating = static_cast<int>(ZigZagDecode(ReadVarint(payload)));
+                const uint64_t text_size = ReadVarint(payload);
+                if (payload.size() != text_size)
+                    return mutation;
+                mutation.text = std::string(payload);
+            }
+            else if (mutation.type != RECORD_REMOVE)
+            {
+                return mutation;
+            }
+        }
+        catch (const std::exception&)
+        {
+            return mutation;
+        }
+        mutation.valid = true;
+        return mutation;
+    }
+
+    // Decodes frames in parallel and drops everything from the first damaged record on
+    std::vector<Mutation> DecodeFrames(const std::vector<std::string_view>& frames)
+    {
+        std::vector<Mutation> mutations(frames.size());
+        std::transform(std::execution::par, frames.begin(), frames.end(), mutations.begin(), DecodeFrame);
+        const auto first_bad = std::find_if(mutations.begin(), mutations.end(),
+            [](const Mutation& mutation) { return !mutation.valid; });
+        mutations.erase(first_bad, mutations.end());
+        return mutations;
+    }
+
+    std::string ReadFile(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    void ThrowErrno(const std::string& what)
+    {
+        throw std::runtime_error(what + ": "s + std::strerror(errno));
+    }
+
+    void WriteAll(int fd, std::string_view data)
+    {
+        while (!data.empty())
+        {
+            const ssize_t written = ::write(fd, data.data(), data.size());
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                ThrowErrno("WAL write failed"s);
+            }
+            data.remove_prefix(static_cast<size_t>(written));
+        }
+    }
+
+    std::string DirectoryOf(const std::string& path)
+    {
+        const size_t slash = path.rfind('/');
+        return slash == std::string::npos ? "."s : path.substr(0, slash + 1);
+    }
+
+    // Opens the snapshot at path and reads its sequence number, leaving in at the index;
+    // returns 0 with in closed if there is no snapshot
+    uint64_t OpenSnapshot(const std::string& path, std::ifstream& in)
+    {
+        in.open(path, std::ios::binary);
+        if (!in)
+            return 0;
+        std::string header(SNAPSHOT_MAGIC.size() + 8, '\0');
+        if (!in.read(header.data(), header.size()) || std::string_view(header).substr(0, SNAPSHOT_MAGIC.size()) != SNAPSHOT_MAGIC)
+            throw std::runtime_error("Bad WAL snapshot: "s + path);
+        return ReadFixed64(std::string_view(header).substr(SNAPSHOT_MAGIC.size()));
+    }
+}
+
+WriteAheadLog::WriteAheadLog(const std::string& path)
+    : WriteAheadLog(path, std::chrono::milliseconds(5), 1 << 20, false)
+{}
+
+WriteAheadLog::WriteAheadLog(const std::string& path, std::chrono::milliseconds commit_interval,
+    size_t commit_bytes, bool wait_durable)
+    : path_(path),
+    snapshot_path_(path + ".snapshot"s),
+    commit_interval_(commit_interval),
+    commit_bytes_(commit_bytes),
+    wait_durable_(wait_durable)
+{
+    std::ifstream snapshot;
+    last_lsn_ = OpenSnapshot(snapshot_path_, snapshot);
+
+    // cut a torn or damaged tail so that new records follow the last good one
+    const std::string data = ReadFile(path_);
+    const std::vector<std::string_view> frames = SplitFrames(data);
+    const std::vector<Mutation> mutations = DecodeFrames(frames);
+    size_t valid_size = 0;
+    for (size_t i = 0; i < mutations.size(); ++i)
+        valid_size += frames[i].size();
+    if (!mutations.empty())
+        last_lsn_ = std::max(last_lsn_, mutations.back().lsn);
+    durable_lsn_ = last_lsn_;
+
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+        ThrowErrno("Cannot open WAL "s + path_);
+    if (valid_size != data.size() && ::ftruncate(fd_, static_cast<off_t>(valid_size)) != 0)
+        ThrowErrno("Cannot truncate WAL "s + path_);
+
+    committer_ = std::thread([this] { CommitLoop(); });
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    commit_requested_.notify_one();
+    committer_.join();
+    ::close(fd_);
+}
+
+void WriteAheadLog::LogAdd(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings)
+{
+    Append(RECORD_ADD, EncodeAdd(document_id, document, status, ratings));
+}
+
+void WriteAheadLog::LogRemove(int document_id)
+{
+    std::string body;
+    AppendVarint(body, static_cast<uint64_t>(document_id));
+    Append(RECORD_REMOVE, body);
+}
+
+void WriteAheadLog::Append(char type, const std::string& body)
+{
+    std::unique_lock lock(mutex_);
+    if (!error_.empty())
+        throw std::runtime_error(error_);
+
+    std::string payload(1, type);
+    AppendVarint(payload, ++last_lsn_);
+    payload += body;
+    AppendFrame(buffer_, payload);
+
+    if (wait_durable_)
+        WaitDurable(lock, last_lsn_);
+    else if (buffer_.size() >= commit_bytes_)
+        commit_requested_.notify_one();
+}
+
+void WriteAheadLog::Sync()
+{
+    std::unique_lock lock(mutex_);
+    WaitDurable(lock, last_lsn_);
+}
+
+void WriteAheadLog::WaitDurable(std::unique_lock<std::mutex>& lock, uint64_t lsn)
+{
+    if (durable_lsn_ >= lsn)
+        return;
+    sync_requested_ = true;
+    commit_requested_.notify_one();
+    committed_.wait(lock, [this, lsn] { return durable_lsn_ >= lsn || !error_.empty(); });
+    if (!error_.empty())
+        throw std::runtime_error(error_);
+}
+
+void WriteAheadLog::CommitLoop()
+{
+    std::unique_lock lock(mutex_);
+    while (true)
+    {
+        commit_requested_.wait_for(lock, commit_interval_,
+            [this] { return stop_ || sync_requested_ || buffer_.size() >= commit_bytes_; });
+        if (buffer_.empty())
+        {
+            if (stop_)
+                break;
+            continue;
+        }
+
+        std::string batch;
+        batch.swap(buffer_);
+        const uint64_t batch_lsn = last_lsn_;
+        sync_requested_ = false;
+
+        lock.unlock();
+        std::string error;
+        try
+        {
+            WriteAll(fd_, batch);
+            if (::fdatasync(fd_) != 0)
+                ThrowErrno("WAL fdatasync failed"s);
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+        }
+        lock.lock();
+
+        if (error.empty())
+            durable_lsn_ = batch_lsn;
+        else if (error_.empty())
+            error_ = error;
+        committed_.notify_all();
+    }
+}
+
+void WriteAheadLog::Recover(SearchServer& server) const
+{
+    // the snapshot is an index image, so loading it analyzes no text
+    std::ifstream snapshot;
+    const uint64_t snapshot_lsn = OpenSnapshot(snapshot_path_, snapshot);
+    if (snapshot.is_open())
+        IndexBuilder::Open(snapshot, snapshot_path_, server);
+
+    const std::string data = ReadFile(path_);
+    std::vector<Mutation> tail = DecodeFrames(SplitFrames(data));
+    // a crash between writing the snapshot and truncating the log leaves covered records behind
+    tail.erase(tail.begin(), std::find_if(tail.begin(), tail.end(),
+        [snapshot_lsn](const Mutation& mutation) { return mutation.lsn > snapshot_lsn; }));
+
+    // an ADD that is removed later in the tail never has to be indexed
+    std::vector<bool> skip(tail.size(), false);
+    std::map<int, size_t> removed_later;
+    for (size_t i = tail.size(); i-- > 0;)
+    {
+        const Mutation& mutation = tail[i];
+        if (mutation.type == RECORD_REMOVE)
+        {
+            removed_later[mutation.document_id] = i;
+        }
+        else if (const auto it = removed_later.find(mutation.document_id); it != removed_later.end())
+        {
+            skip[i] = skip[it->second] = true;
+            removed_later.erase(it);
+        }
+    }
+
+    for (size_t i = 0; i < tail.size(); ++i)
+    {
+        if (skip[i])
+            continue;
+        const Mutation& mutation = tail[i];
+        if (mutation.type == RECORD_ADD)
+            server.AddDocument(mutation.document_id, mutation.text, mutation.status, mutation.ratings);
+        else
+            server.RemoveDocument(mutation.document_id);
+    }
+}
+
+void WriteAheadLog::Checkpoint(const SearchServer& server)
+{
+    Sync();
+    uint64_t lsn;
+    {
+        std::lock_guard lock(mutex_);
+        lsn = last_lsn_;
+    }
+
+    // write-then-rename keeps the previous snapshot intact until the new one is durable
+    const std::string tmp_path = snapshot_path_ + ".tmp"s;
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Cannot create WAL snapshot "s + tmp_path);
+        std::string header(SNAPSHOT_MAGIC);
+        AppendFixed64(header, lsn);
+        out.write(header.data(), header.size());
+        IndexBuilder::Save(server, out);
+        out.close();
+        if (!out)
+            throw std::runtime_error("Cannot write WAL snapshot "s + tmp_path);
+    }
+    const int fd = ::open(tmp_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        ThrowErrno("Cannot open WAL snapshot "s + tmp_path);
+    if (::fsync(fd) != 0)
+    {
+        ::close(fd);
+        ThrowErrno("WAL snapshot fsync failed"s);
+    }
+    ::close(fd);
+    if (::rename(tmp_path.c_str(), snapshot_path_.c_str()) != 0)
+        ThrowErrno("Cannot install WAL snapshot "s + snapshot_path_);
+    const int dir_fd = ::open(DirectoryOf(snapshot_path_).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+
+    std::lock_guard lock(mutex_);
+    if (::ftruncate(fd_, 0) != 0)
+        ThrowErrno("Cannot truncate WAL "s + path_);
+}
+
+uint64_t WriteAheadLog::GetLastSequenceNumber() const
+{
+    std::lock_guard lock(mutex_);
+    return last_lsn_;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+
+class SearchServer;
+
+// Append-only binary log of AddDocument/RemoveDocument calls.
+//
+// Records are buffered in memory and written by a background thread that
+// fsyncs once per batch (group commit), so ingest does not wait on the disk.
+// Checkpoint() writes the live documents next to the log as an IndexBuilder
+// index image and truncates the log; Recover() opens the image with
+// IndexBuilder::Open and replays only the log tail, so restart time follows
+// the tail rather than the corpus. The snapshot keeps the document storage of
+// the server and, with DocumentStorage::RAW_TEXT, the texts as they were added.
+//
+//   SearchServer server(stop_words);
+//   WriteAheadLog wal("index.wal");
+//   wal.Recover(server);
+//   server.SetWriteAheadLog(&wal);
+class WriteAheadLog
+{
+public:
+    explicit WriteAheadLog(const std::string& path);
+
+    // A batch is committed when it reaches commit_bytes or every commit_interval.
+    // With wait_durable set, every logged mutation blocks until it is on disk.
+    WriteAheadLog(const std::string& path, std::chrono::milliseconds commit_interval,
+        size_t commit_bytes, bool wait_durable);
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    ~WriteAheadLog();
+
+    void LogAdd(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+
+    void LogRemove(int document_id);
+
+    // Blocks until every mutation logged so far is durable
+    void Sync();
+
+    // Rebuilds server, which must be empty, from the last snapshot and the log records
+    // written after it. Must be called before the log is attached to the server.
+    void Recover(SearchServer& server) const;
+
+    // Persists the current documents of server as the new snapshot and empties the log.
+    // Must be called from the thread that mutates the server.
+    void Checkpoint(const SearchServer& server);
+
+    uint64_t GetLastSequenceNumber() const;
+
+private:
+    const std::string path_;
+    const std::string snapshot_path_;
+    const std::chrono::milliseconds commit_interval_;
+    const size_t commit_bytes_;
+    const bool wait_durable_;
+    int fd_ = -1;
+
+    mutable std::mutex mutex_;
+    std::condition_variable commit_requested_;
+    std::condition_variable committed_;
+    std::string buffer_;                // encoded records not yet handed to the committer
+    uint64_t last_lsn_ = 0;             // sequence number of the last logged record
+    uint64_t durable_lsn_ = 0;          // records up to this one are fsynced
+    bool sync_requested_ = false;
+    bool stop_ = false;
+    std::string error_;                 // first I/O error of the committer thread
+    std::thread committer_;
+
+    void Append(char type, const std::string& body);
+    void WaitDurable(std::unique_lock<std::mutex>& lock, uint64_t lsn);
+    void CommitLoop();
+};